@@ -9,7 +9,9 @@
 #include <chrono>
 #include <mavsdk/mavsdk.h>
 #include <mavsdk/plugins/action/action.h>
+#include <mavsdk/plugins/mission/mission.h>
 #include <mavsdk/plugins/telemetry/telemetry.h>
+#include <iomanip>
 #include <iostream>
 #include <future>
 #include <memory>
@@ -23,46 +25,36 @@
 #include <unistd.h>
 //#include <fstream>
 #include <string>
+#include <vector>
 #include <mutex>
 #include <condition_variable>
 #include <string.h>
 
-#include "json/json.hpp"
+#include "flight_recorder.h"
+#include "mission_file.h"
+#include "sensor_reader.h"
+#include "vehicle_monitor.h"
 
 using namespace mavsdk;
 using std::chrono::seconds;
 using std::this_thread::sleep_for;
-using json = nlohmann::json;
+
+// Position and attitude rate while recording
+constexpr double RECORD_RATE_HZ = 50.0;
 
 
 void usage(const std::string& bin_name)
 {
-    std::cerr << "Usage : " << bin_name << " <connection_url>\n"
+    std::cerr << "Usage : " << bin_name << " <connection_url> [mission.json] [--record <log>]\n"
               << "Connection URL format should be :\n"
               << " For TCP : tcp://[server_host][:server_port]\n"
               << " For UDP : udp://[bind_host][:bind_port]\n"
               << " For Serial : serial:///path/to/serial/dev[:baudrate]\n"
-              << "For example, to connect to the simulator use URL: udp://:14540\n";
-}
-
-
-bool slice_input_json(std::string &input, std::string &json_str) {
-    std::size_t eof_pos = input.find_first_of('\x07');
-    if (eof_pos == std::string::npos) {
-        return false;
-    }
-    json_str = input.substr(0, eof_pos);
-    input.erase(0, eof_pos +1 );
-    return true;
-}
-
-
-void clean_input(std::string &input) {
-    std::size_t eof_pos = input.find_first_of('\x07');
-    if (eof_pos < std::string::npos) {
-      eof_pos = input.size();  
-    }
-    input.erase(0, eof_pos);
+              << "For example, to connect to the simulator use URL: udp://:14540\n"
+              << "With a mission file the waypoints are uploaded as one mission and flown,\n"
+              << "see example_mission.json\n"
+              << "With --record position, attitude and SimCoupler samples are written to a\n"
+              << "binary log at full rate, print it with flight_log_dump\n";
 }
 
 
@@ -97,59 +89,153 @@ int get_socket(std::string addr, uint16_t port) {
 }
 
 
-bool check_if_json(std::string input) {
-    return input.find('\x07') != std::string::npos;
+void print_current_output(const SensorReader &reader) {
+    GpsSample sample;
+    if (!reader.gps.load(sample)) {
+        std::cout << "No GPS position received yet\n" << std::endl;
+        return;
+    }
+    auto now = std::chrono::steady_clock::now().time_since_epoch();
+    double age_s = (std::chrono::duration_cast<std::chrono::nanoseconds>(now).count() - sample.received_ns) / 1e9;
+
+    std::cout << std::setprecision(15) << "GPS position\n"
+        << "lat: " << sample.position.latitude_deg
+        << "\nlon: " << sample.position.longitude_deg
+        << "\nalt: " << sample.position.altitude
+        << std::setprecision(3) << "\nage: " << age_s << " s"
+        << "\n" << std::endl;
 }
 
 
-void print_current_output(int sockfd, std::string &raw_json_buf) {
-    
-    if (!check_if_json(raw_json_buf)) {
-        char buf[1500] = { 0 };
-        int n = recv(sockfd, buf, sizeof(buf), 0);
-        raw_json_buf += buf;
-    }
-    std::string json_str;
-    if (slice_input_json(raw_json_buf, json_str)) {
-        json data;
-        try {
-            data = json::parse(json_str);
-        } catch (...) {
-            return;
+// Starts the uploaded mission and waits until the last item is reached
+bool fly_mission(Mission &mission, const MissionFile &mission_file, const SensorReader &reader)
+{
+    std::promise<void> finished;
+    auto finished_future = finished.get_future();
+    bool done = false;
+
+    auto progress_handle = mission.subscribe_mission_progress([&](Mission::MissionProgress progress) {
+        std::cout << "Mission progress: " << progress.current << " / " << progress.total << '\n';
+        print_current_output(reader);
+        if (progress.current == progress.total && !done) {
+            done = true;
+            finished.set_value();
         }
-        std::cout << "GPS position\n" 
-            << "lat: " << data["latitudeDeg"] 
-            << "\nlon: " << data["longitudeDeg"]
-            << "\nalt: " << data["altitude"]
-            << "\n" << std::endl;
+    });
+
+    std::cout << "Starting mission...\n";
+    const Mission::Result start_result = mission.start_mission();
+    bool ok = start_result == Mission::Result::Success;
+    if (!ok) {
+        std::cerr << "Mission start failed: " << start_result << '\n';
+    } else if (finished_future.wait_for(std::chrono::duration<double>(mission_file.timeout_s))
+               != std::future_status::ready) {
+        std::cerr << "Mission not finished after " << mission_file.timeout_s << " s\n";
+        ok = false;
     }
+
+    mission.unsubscribe_mission_progress(progress_handle);
+    return ok;
+}
+
+
+// Hard-coded flight used without a mission file, ends with a return to launch
+bool fly_demo(Action &action, VehicleMonitor &monitor, const SensorReader &reader)
+{
+    print_current_output(reader);
+    // Take off
+    std::cout << "Taking off...\n";
+    const Action::Result takeoff_result = action.takeoff();
+    if (takeoff_result != Action::Result::Success) {
+        std::cerr << "Takeoff failed: " << takeoff_result << '\n';
+        return false;
+    }
+
+    // Continue as soon as the vehicle hovers
+    const auto takeoff_altitude = action.get_takeoff_altitude();
+    const float hover_altitude = takeoff_altitude.first == Action::Result::Success ? 0.9f * takeoff_altitude.second : 2.0f;
+    if (!monitor.wait_altitude(hover_altitude, seconds(30))) {
+        return false;
+    }
+
+    print_current_output(reader);
+	std::cout << "Flying to valid location 48.055050856124694, 11.652178200099572" << std::endl;
+	action.goto_location(48.055050856124694, 11.652178200099572, NAN, NAN);
+    if (!monitor.wait_within(48.055050856124694, 11.652178200099572, 1.0, seconds(30))) {
+        return false;
+    }
+
+    print_current_output(reader);
+	std::cout << "Flying to invalid location 48.056529056548406, 11.652396728102497" << std::endl;
+    // the SerialFilter drops the command, it times out instead of being acknowledged
+	const Action::Result invalid_result = action.goto_location(48.056529056548406, 11.652396728102497, NAN, NAN);
+    std::cout << "Goto outside the geofence: " << invalid_result << std::endl;
+
+    print_current_output(reader);
+	std::cout << "Returning to home" << std::endl;
+	action.return_to_launch();
+	/*
+	action.goto_location(48.05502700126609, 11.652206077452211, NAN, NAN);
+	sleep_for(seconds(30));
+    const Action::Result land_result = action.land();
+    if (land_result != Action::Result::Success) {
+        std::cerr << "Land failed: " << land_result << '\n';
+        return false;
+    }*/
+    return true;
 }
 
 
 int main(int argc, char** argv)
 {
-    if (argc != 2) {
+    std::vector<std::string> args;
+    std::string record_path;
+    for (int i = 1; i < argc; i++) {
+        if (std::string(argv[i]) == "--record" && i + 1 < argc) {
+            record_path = argv[++i];
+        } else {
+            args.push_back(argv[i]);
+        }
+    }
+    if (args.size() != 1 && args.size() != 2) {
         usage(argv[0]);
         return 1;
     }
+    const std::string connection_url = args[0];
+
+    MissionFile mission_file;
+    const bool use_mission_file = args.size() == 2;
+    if (use_mission_file && !load_mission_file(args[1], mission_file)) {
+        return 1;
+    }
+
+    FlightRecorder recorder;
+    if (!record_path.empty() && !recorder.open(record_path)) {
+        return 1;
+    }
+
     std::cout << "SimCoupler connection initiated" << std::endl;
     int sockfd = get_socket("192.168.1.2", 5555);
 
-    std::string raw_json_buf;
-  
-    {
-        char buf[1500] = { 0 };
-        int n = recv(sockfd, buf, sizeof(buf), 0);
-        raw_json_buf += buf;
-        clean_input(raw_json_buf);
+    // keeps the latest sensor values while the mission below blocks
+    SensorReader::GpsCallback record_gps;
+    if (recorder.is_open()) {
+        record_gps = [&recorder](const GpsSample &sample) {
+            recorder.write(flight_log::SimGps, flight_log::SimGpsRecord{
+                sample.position.latitude_deg, sample.position.longitude_deg, sample.position.altitude });
+        };
+    }
+    SensorReader reader(sockfd, record_gps);
+    if (!reader.start()) {
+        return 1;
     }
     
-    print_current_output(sockfd, raw_json_buf);
+    print_current_output(reader);
     Mavsdk mavsdk;
 	double timeout = 10.0;
 	mavsdk.set_timeout_s(timeout);
 	std::cout << "Set timeout to: " << timeout << '\n';
-    ConnectionResult connection_result = mavsdk.add_any_connection(argv[1]);
+    ConnectionResult connection_result = mavsdk.add_any_connection(connection_url);
 
     if (connection_result != ConnectionResult::Success) {
         std::cerr << "Connection failed: " << connection_result << '\n';
@@ -162,32 +248,67 @@ int main(int argc, char** argv)
         return 1;
     }
 
-    print_current_output(sockfd, raw_json_buf);
+    print_current_output(reader);
     // Instantiate plugins.
     auto telemetry = Telemetry{system.value()};
     auto action = Action{system.value()};
+    auto mission = Mission{system.value()};
+
+    if (use_mission_file) {
+        // all waypoints in one transfer, PX4 flies home after the last one
+        mission.set_return_to_launch_after_mission(mission_file.return_to_launch);
 
-    // We want to listen to the altitude of the drone at 1 Hz.
-    const auto set_rate_result = telemetry.set_rate_position(1.0);
+        std::cout << "Uploading mission with " << mission_file.plan.mission_items.size() << " waypoints...\n";
+        const Mission::Result upload_result = mission.upload_mission(mission_file.plan);
+        if (upload_result != Mission::Result::Success) {
+            std::cerr << "Mission upload failed: " << upload_result << '\n';
+            return 1;
+        }
+    }
+
+    // We want to listen to the altitude of the drone at 1 Hz, the recorder takes all it can get.
+    const double position_rate_hz = recorder.is_open() ? RECORD_RATE_HZ : 1.0;
+    const auto set_rate_result = telemetry.set_rate_position(position_rate_hz);
     if (set_rate_result != Telemetry::Result::Success) {
         std::cerr << "Setting rate failed: " << set_rate_result << '\n';
         return 1;
     }
 
-    print_current_output(sockfd, raw_json_buf);
+    print_current_output(reader);
     // Set up callback to monitor altitude while the vehicle is in flight
-    telemetry.subscribe_position([](Telemetry::Position position) {
-        std::cout << "Altitude: " << position.relative_altitude_m << " m\n";
+    auto last_altitude_print = std::chrono::steady_clock::time_point();
+    telemetry.subscribe_position([&recorder, last_altitude_print](Telemetry::Position position) mutable {
+        if (recorder.is_open()) {
+            recorder.write(flight_log::Position, flight_log::PositionRecord{
+                position.latitude_deg, position.longitude_deg,
+                position.absolute_altitude_m, position.relative_altitude_m });
+        }
+        auto now = std::chrono::steady_clock::now();
+        if (now - last_altitude_print >= seconds(1)) {
+            last_altitude_print = now;
+            std::cout << "Altitude: " << position.relative_altitude_m << " m\n";
+        }
     });
 
-    print_current_output(sockfd, raw_json_buf);
-    // Check until vehicle is ready to arm
-    while (telemetry.health_all_ok() != true) {
-        std::cout << "Vehicle is getting ready to arm\n";
-        sleep_for(seconds(1));
+    if (recorder.is_open()) {
+        if (telemetry.set_rate_attitude_euler(RECORD_RATE_HZ) != Telemetry::Result::Success) {
+            std::cerr << "Setting attitude rate failed, recording at the default rate\n";
+        }
+        telemetry.subscribe_attitude_euler([&recorder](Telemetry::EulerAngle angle) {
+            recorder.write(flight_log::Attitude, flight_log::AttitudeRecord{
+                angle.roll_deg, angle.pitch_deg, angle.yaw_deg, 0, angle.timestamp_us });
+        });
+    }
+
+    print_current_output(reader);
+    // Wait until vehicle is ready to arm
+    VehicleMonitor monitor(telemetry);
+    std::cout << "Vehicle is getting ready to arm\n";
+    if (!monitor.wait_health_ok(seconds(60))) {
+        return 1;
     }
 
-    print_current_output(sockfd, raw_json_buf);
+    print_current_output(reader);
     // Arm vehicle
     std::cout << "Arming...\n";
     const Action::Result arm_result = action.arm();
@@ -197,51 +318,41 @@ int main(int argc, char** argv)
         return 1;
     }
 
-    print_current_output(sockfd, raw_json_buf);
-    // Take off
-    std::cout << "Taking off...\n";
-    const Action::Result takeoff_result = action.takeoff();
-    if (takeoff_result != Action::Result::Success) {
-        std::cerr << "Takeoff failed: " << takeoff_result << '\n';
+    if (use_mission_file) {
+        if (!fly_mission(mission, mission_file, reader)) {
+            return 1;
+        }
+        if (!mission_file.return_to_launch) {
+            std::cout << "Mission finished, vehicle holds at the last waypoint\n";
+            print_current_output(reader);
+            return 0;
+        }
+        std::cout << "Mission finished, returning to home" << std::endl;
+    } else if (!fly_demo(action, monitor, reader)) {
         return 1;
     }
 
-    print_current_output(sockfd, raw_json_buf);
-    // Let it hover for a bit before landing again.
-    sleep_for(seconds(5));
-	std::cout << "Flying to valid location 48.055050856124694, 11.652178200099572" << std::endl;
-	action.goto_location(48.055050856124694, 11.652178200099572, NAN, NAN);
-    sleep_for(seconds(5));
-
-    print_current_output(sockfd, raw_json_buf);
-	std::cout << "Flying to invalid location 48.056529056548406, 11.652396728102497" << std::endl;
-	action.goto_location(48.056529056548406, 11.652396728102497, NAN, NAN);
-	sleep_for(seconds(5));
-
-    print_current_output(sockfd, raw_json_buf);
-	std::cout << "Returning to home" << std::endl;
-	action.return_to_launch();
-	/*
-	action.goto_location(48.05502700126609, 11.652206077452211, NAN, NAN);
-	sleep_for(seconds(30));
-    const Action::Result land_result = action.land();
-    if (land_result != Action::Result::Success) {
-        std::cerr << "Land failed: " << land_result << '\n';
+    std::cout << "Vehicle is landing...\n";
+    if (!monitor.wait_landed(seconds(120))) {
         return 1;
-    }*/
-
-    // Check if vehicle is still in air
-    while (telemetry.in_air()) {
-        std::cout << "Vehicle is landing...\n";
-        print_current_output(sockfd, raw_json_buf);
-        sleep_for(seconds(2));
     }
     std::cout << "Landed!\n";
 
-    // We are relying on auto-disarming but let's keep watching the telemetry for a bit longer.
-    sleep_for(seconds(3));
+    // We are relying on auto-disarming
+    if (!monitor.wait_armed(false, seconds(10))) {
+        return 1;
+    }
     std::cout << "Finished...\n";
-    print_current_output(sockfd, raw_json_buf);
+    print_current_output(reader);
+
+    if (recorder.is_open()) {
+        auto stats = recorder.stats();
+        std::cout << "Recorded " << stats.records << " samples, " << stats.bytes << " bytes to " << record_path;
+        if (stats.dropped) {
+            std::cout << ", " << stats.dropped << " dropped";
+        }
+        std::cout << std::endl;
+    }
 
     return 0;
 }
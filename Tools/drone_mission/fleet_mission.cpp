@@ -0,0 +1,369 @@
+/*
+ * Copyright (C) 2023-2024, HENSOLDT Cyber GmbH
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * For commercial licensing, contact: info.cyber@hensoldt.net
+ */
+
+/*
+ * Flies one mission file with several vehicles at once, to see how the
+ * SerialFilter's latency and drop rate scale with the vehicle count.
+ *
+ * Every autopilot found on the connections becomes one vehicle with its own
+ * MAVSDK plugins. Every vehicle flies on its own thread, as its mission
+ * blocks on the round trips, the main thread aggregates their telemetry
+ * once per second and prints a summary with the command round trips and
+ * position rates per vehicle at the end.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <mavsdk/mavsdk.h>
+#include <mavsdk/plugins/action/action.h>
+#include <mavsdk/plugins/mission/mission.h>
+#include <mavsdk/plugins/telemetry/telemetry.h>
+
+#include "mission_file.h"
+#include "vehicle_monitor.h"
+
+using namespace mavsdk;
+using Clock = std::chrono::steady_clock;
+using std::chrono::seconds;
+
+
+struct Config {
+    std::vector<std::string> connections;
+    std::string mission_path;
+    size_t vehicles = 1;
+    double discover_s = 30;
+};
+
+enum class Phase { Waiting, Uploading, Arming, Flying, Landing, Done, Failed };
+
+static const char *phase_name(Phase phase) {
+    switch (phase) {
+    case Phase::Waiting:   return "waiting";
+    case Phase::Uploading: return "uploading";
+    case Phase::Arming:    return "arming";
+    case Phase::Flying:    return "flying";
+    case Phase::Landing:   return "landing";
+    case Phase::Done:      return "done";
+    default:               return "failed";
+    }
+}
+
+struct Vehicle {
+    explicit Vehicle(std::shared_ptr<System> system) :
+        system(system),
+        sysid(system->get_system_id()),
+        telemetry(system),
+        action(system),
+        mission(system),
+        monitor(telemetry) {}
+
+    std::shared_ptr<System> system;
+    uint8_t sysid;
+    Telemetry telemetry;
+    Action action;
+    Mission mission;
+    VehicleMonitor monitor;
+
+    std::atomic<Phase> phase{Phase::Waiting};
+    std::atomic<int> progress_current{0};
+    std::atomic<int> progress_total{0};
+
+    // written by the worker, read after it finished
+    double upload_ms = 0;
+    double arm_ms = 0;
+    double start_ms = 0;
+    double flight_s = 0;
+    std::string error;
+};
+
+
+void usage(const std::string& bin_name)
+{
+    std::cerr << "Usage : " << bin_name << " --mission <file> --connect <url> [options]\n"
+              << "Options:\n"
+              << " --mission <file>   mission flown by every vehicle, see mission_file.h\n"
+              << " --connect <url>    MAVSDK connection URL, repeatable (e.g. one per SITL instance)\n"
+              << " --vehicles <n>     autopilots to wait for before starting (default 1)\n"
+              << " --discover <s>     time to wait for the autopilots (default 30)\n";
+}
+
+
+static double elapsed_ms(Clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+
+template <typename T>
+static std::string to_string(const T &value) {
+    std::ostringstream s;
+    s << value;
+    return s.str();
+}
+
+
+// Interval discover() looks at the systems again without a new one
+static constexpr std::chrono::milliseconds DISCOVER_RECHECK{100};
+
+// Every new system wakes the waiting thread. A system is usually announced
+// before it is known to be an autopilot, so the systems are also looked at
+// again every DISCOVER_RECHECK.
+static std::vector<std::shared_ptr<System>> discover(Mavsdk &mavsdk, size_t count, double timeout_s) {
+    std::mutex mutex;
+    std::condition_variable changed;
+
+    auto autopilots = [&] {
+        std::vector<std::shared_ptr<System>> found;
+        for (auto &system : mavsdk.systems()) {
+            if (system->has_autopilot()) {
+                found.push_back(system);
+            }
+        }
+        return found;
+    };
+
+    auto handle = mavsdk.subscribe_on_new_system([&] {
+        std::lock_guard<std::mutex> lock(mutex);
+        changed.notify_all();
+    });
+    {
+        auto end = Clock::now() + std::chrono::duration_cast<Clock::duration>(
+                                      std::chrono::duration<double>(timeout_s));
+        std::unique_lock<std::mutex> lock(mutex);
+        while (autopilots().size() < count && Clock::now() < end) {
+            changed.wait_until(lock, std::min(end, Clock::now() + DISCOVER_RECHECK));
+        }
+    }
+    mavsdk.unsubscribe_on_new_system(handle);
+    return autopilots();
+}
+
+
+static void run_vehicle(Vehicle &v, const MissionFile &mission_file) {
+    auto fail = [&v](const std::string &error) {
+        v.error = error;
+        v.phase = Phase::Failed;
+    };
+
+    if (!v.monitor.wait_health_ok(seconds(60))) {
+        return fail("health not ok");
+    }
+
+    v.phase = Phase::Uploading;
+    v.mission.set_return_to_launch_after_mission(mission_file.return_to_launch);
+    auto start = Clock::now();
+    const Mission::Result upload_result = v.mission.upload_mission(mission_file.plan);
+    v.upload_ms = elapsed_ms(start);
+    if (upload_result != Mission::Result::Success) {
+        return fail("upload: " + to_string(upload_result));
+    }
+
+    v.phase = Phase::Arming;
+    start = Clock::now();
+    const Action::Result arm_result = v.action.arm();
+    v.arm_ms = elapsed_ms(start);
+    if (arm_result != Action::Result::Success) {
+        return fail("arm: " + to_string(arm_result));
+    }
+
+    v.phase = Phase::Flying;
+    std::promise<void> finished;
+    auto finished_future = finished.get_future();
+    bool done = false;
+    auto progress_handle = v.mission.subscribe_mission_progress([&](Mission::MissionProgress progress) {
+        v.progress_current = progress.current;
+        v.progress_total = progress.total;
+        if (progress.current == progress.total && !done) {
+            done = true;
+            finished.set_value();
+        }
+    });
+
+    auto flight_start = Clock::now();
+    start = Clock::now();
+    const Mission::Result start_result = v.mission.start_mission();
+    v.start_ms = elapsed_ms(start);
+    bool ok = start_result == Mission::Result::Success &&
+              finished_future.wait_for(std::chrono::duration<double>(mission_file.timeout_s)) == std::future_status::ready;
+    v.mission.unsubscribe_mission_progress(progress_handle);
+    if (!ok) {
+        return fail(start_result != Mission::Result::Success ? "start: " + to_string(start_result) : "mission timeout");
+    }
+
+    if (mission_file.return_to_launch) {
+        v.phase = Phase::Landing;
+        if (!v.monitor.wait_landed(seconds(120))) {
+            return fail("landing timeout");
+        }
+    }
+    v.flight_s = elapsed_ms(flight_start) / 1000;
+    v.phase = Phase::Done;
+}
+
+
+// One line with the phases of all vehicles and the spread of their position rates
+static void print_progress(const std::vector<std::unique_ptr<Vehicle>> &vehicles,
+                           std::vector<uint64_t> &last_updates, double interval_s) {
+    size_t phases[(int)Phase::Failed + 1] = {};
+    double min_hz = 1e9, max_hz = 0, sum_hz = 0;
+
+    for (size_t i = 0; i < vehicles.size(); i++) {
+        uint64_t updates = vehicles[i]->monitor.state().position_updates;
+        double hz = (updates - last_updates[i]) / interval_s;
+        last_updates[i] = updates;
+        min_hz = std::min(min_hz, hz);
+        max_hz = std::max(max_hz, hz);
+        sum_hz += hz;
+        phases[(int)vehicles[i]->phase.load()]++;
+    }
+
+    for (int p = 0; p <= (int)Phase::Failed; p++) {
+        if (phases[p]) {
+            printf("%s %zu  ", phase_name((Phase)p), phases[p]);
+        }
+    }
+    printf("| position %.1f/%.1f/%.1f Hz (min/avg/max)\n", min_hz, sum_hz / vehicles.size(), max_hz);
+    fflush(stdout);
+}
+
+
+static void print_summary(const std::vector<std::unique_ptr<Vehicle>> &vehicles, double total_s) {
+    printf("\n%-6s %-8s %10s %10s %10s %10s %10s  %s\n",
+           "sysid", "result", "upload ms", "arm ms", "start ms", "flight s", "pos Hz", "error");
+
+    size_t ok = 0;
+    double max_upload = 0, max_arm = 0, max_start = 0, sum_flight = 0;
+    for (const auto &v : vehicles) {
+        double hz = v->monitor.state().position_updates / total_s;
+        printf("%-6u %-8s %10.1f %10.1f %10.1f %10.1f %10.1f  %s\n",
+               v->sysid, phase_name(v->phase), v->upload_ms, v->arm_ms, v->start_ms, v->flight_s, hz,
+               v->error.c_str());
+        if (v->phase == Phase::Done) {
+            ok++;
+            max_upload = std::max(max_upload, v->upload_ms);
+            max_arm = std::max(max_arm, v->arm_ms);
+            max_start = std::max(max_start, v->start_ms);
+            sum_flight += v->flight_s;
+        }
+    }
+    printf("\n%zu/%zu vehicles finished in %.1f s", ok, vehicles.size(), total_s);
+    if (ok) {
+        printf(", max upload %.1f ms, max arm %.1f ms, max start %.1f ms, mean flight %.1f s",
+               max_upload, max_arm, max_start, sum_flight / ok);
+    }
+    printf("\n");
+}
+
+
+int main(int argc, char** argv)
+{
+    Config cfg;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            usage(argv[0]);
+            return 1;
+        }
+        std::string val = argv[++i];
+
+        try {
+            if (arg == "--mission") {
+                cfg.mission_path = val;
+            } else if (arg == "--connect") {
+                cfg.connections.push_back(val);
+            } else if (arg == "--vehicles") {
+                cfg.vehicles = std::stoul(val);
+            } else if (arg == "--discover") {
+                cfg.discover_s = std::stod(val);
+            } else {
+                usage(argv[0]);
+                return 1;
+            }
+        } catch (...) {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (cfg.mission_path.empty() || cfg.connections.empty() || cfg.vehicles == 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    MissionFile mission_file;
+    if (!load_mission_file(cfg.mission_path, mission_file)) {
+        return 1;
+    }
+
+    Mavsdk mavsdk;
+    for (const auto &url : cfg.connections) {
+        ConnectionResult connection_result = mavsdk.add_any_connection(url);
+        if (connection_result != ConnectionResult::Success) {
+            std::cerr << "Connection " << url << " failed: " << connection_result << '\n';
+            return 1;
+        }
+    }
+
+    auto systems = discover(mavsdk, cfg.vehicles, cfg.discover_s);
+    if (systems.size() < cfg.vehicles) {
+        std::cerr << "Found " << systems.size() << " of " << cfg.vehicles << " autopilots\n";
+        return 1;
+    }
+    systems.resize(cfg.vehicles);
+
+    std::vector<std::unique_ptr<Vehicle>> vehicles;
+    for (auto &system : systems) {
+        vehicles.push_back(std::make_unique<Vehicle>(system));
+    }
+
+    std::cout << "Flying " << vehicles.size() << " vehicles\n";
+
+    // a mission blocks its thread for the whole flight, fewer threads than
+    // vehicles would fly them one after the other
+    std::atomic<size_t> finished{0};
+    std::vector<std::thread> workers;
+    auto start = Clock::now();
+    for (auto &vehicle : vehicles) {
+        workers.emplace_back([&, v = vehicle.get()] {
+            run_vehicle(*v, mission_file);
+            finished++;
+        });
+    }
+
+    std::vector<uint64_t> last_updates(vehicles.size(), 0);
+    auto last = Clock::now();
+    while (finished < vehicles.size()) {
+        std::this_thread::sleep_for(seconds(1));
+        auto now = Clock::now();
+        print_progress(vehicles, last_updates, std::chrono::duration<double>(now - last).count());
+        last = now;
+    }
+    for (auto &worker : workers) {
+        worker.join();
+    }
+
+    print_summary(vehicles, std::chrono::duration<double>(Clock::now() - start).count());
+
+    for (const auto &v : vehicles) {
+        if (v->phase != Phase::Done) {
+            return 1;
+        }
+    }
+    return 0;
+}
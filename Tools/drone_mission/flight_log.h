@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2023-2024, HENSOLDT Cyber GmbH
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * For commercial licensing, contact: info.cyber@hensoldt.net
+ */
+
+#pragma once
+
+#include <cstdint>
+
+/*
+ * Layout of the flight recorder log.
+ *
+ * The log is a sequence of fixed-size segments. The first one starts with
+ * a FileHeader, after that every segment holds records back to back, each
+ * a RecordHeader followed by its payload. Records never cross a segment
+ * boundary, the unused tail of a segment is zero, i.e. a Pad record.
+ * Timestamps are nanoseconds since the start of the recording and never
+ * decrease.
+ *
+ * The index is a separate file (<log>.idx) of IndexEntry, one about every
+ * INDEX_INTERVAL_NS, pointing at the first record at or after its time.
+ */
+namespace flight_log {
+
+constexpr char MAGIC[8] = "TRFLOG1";
+constexpr uint32_t VERSION = 1;
+constexpr uint32_t SEGMENT_SIZE = 16 * 1024 * 1024;
+constexpr int64_t INDEX_INTERVAL_NS = 100000000;
+
+struct FileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t segment_size;
+    int64_t start_unix_ns;      // wall clock time of t_ns 0
+    uint8_t reserved[40];
+};
+static_assert(sizeof(FileHeader) == 64, "FileHeader layout");
+
+enum RecordType : uint16_t {
+    Pad = 0,                    // rest of the segment is unused
+    Position = 1,
+    Attitude = 2,
+    SimGps = 3,
+};
+
+struct RecordHeader {
+    uint16_t type;
+    uint16_t size;              // payload bytes following the header
+    uint32_t reserved;
+    int64_t t_ns;
+};
+static_assert(sizeof(RecordHeader) == 16, "RecordHeader layout");
+
+// Telemetry::Position of the autopilot
+struct PositionRecord {
+    double latitude_deg;
+    double longitude_deg;
+    float absolute_altitude_m;
+    float relative_altitude_m;
+};
+
+// Telemetry::EulerAngle of the autopilot
+struct AttitudeRecord {
+    float roll_deg;
+    float pitch_deg;
+    float yaw_deg;
+    uint32_t reserved;
+    uint64_t timestamp_us;      // autopilot time
+};
+
+// NavSat record of the SimCoupler
+struct SimGpsRecord {
+    double latitude_deg;
+    double longitude_deg;
+    double altitude;
+};
+
+struct IndexEntry {
+    int64_t t_ns;
+    uint64_t offset;            // in the log file
+};
+
+} // namespace flight_log
@@ -0,0 +1,204 @@
+/*
+ * Copyright (C) 2023-2024, HENSOLDT Cyber GmbH
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * For commercial licensing, contact: info.cyber@hensoldt.net
+ */
+
+/*
+ * Prints a time window of a flight recorder log as CSV.
+ *
+ * The start of the window is looked up in the index, so only the records
+ * inside the window are read, however long the recording is.
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include "flight_log.h"
+
+using namespace flight_log;
+
+
+struct Config {
+    std::string path;
+    double from_s = 0;
+    double to_s = -1;           // < 0: until the end
+    int type = -1;              // < 0: all types
+};
+
+
+void usage(const std::string& bin_name)
+{
+    std::cerr << "Usage : " << bin_name << " <log> [options]\n"
+              << "Options:\n"
+              << " --from <s>      first second of the recording to print (default 0)\n"
+              << " --to <s>        last second to print (default: until the end)\n"
+              << " --type <name>   only records of this type: position, attitude, simgps\n";
+}
+
+
+static std::vector<IndexEntry> read_index(const std::string &path) {
+    std::vector<IndexEntry> index;
+    FILE *f = fopen((path + ".idx").c_str(), "rb");
+    if (!f) {
+        return index;
+    }
+    IndexEntry entry;
+    while (fread(&entry, sizeof(entry), 1, f) == 1) {
+        index.push_back(entry);
+    }
+    fclose(f);
+    return index;
+}
+
+
+// Offset of the last indexed record at or before t_ns
+static uint64_t seek(const std::vector<IndexEntry> &index, int64_t t_ns) {
+    auto it = std::upper_bound(index.begin(), index.end(), t_ns,
+                               [](int64_t t, const IndexEntry &e) { return t < e.t_ns; });
+    if (it == index.begin()) {
+        return sizeof(FileHeader);
+    }
+    return std::prev(it)->offset;
+}
+
+
+static void print_record(const RecordHeader &h, const char *payload) {
+    double t = h.t_ns / 1e9;
+
+    switch (h.type) {
+    case Position: {
+        PositionRecord r;
+        memcpy(&r, payload, std::min<size_t>(h.size, sizeof(r)));
+        printf("%.6f,position,%.9f,%.9f,%.3f,%.3f\n", t, r.latitude_deg, r.longitude_deg,
+               r.absolute_altitude_m, r.relative_altitude_m);
+        break;
+    }
+    case Attitude: {
+        AttitudeRecord r;
+        memcpy(&r, payload, std::min<size_t>(h.size, sizeof(r)));
+        printf("%.6f,attitude,%.3f,%.3f,%.3f,%llu\n", t, r.roll_deg, r.pitch_deg, r.yaw_deg,
+               (unsigned long long)r.timestamp_us);
+        break;
+    }
+    case SimGps: {
+        SimGpsRecord r;
+        memcpy(&r, payload, std::min<size_t>(h.size, sizeof(r)));
+        printf("%.6f,simgps,%.9f,%.9f,%.3f\n", t, r.latitude_deg, r.longitude_deg, r.altitude);
+        break;
+    }
+    default:
+        printf("%.6f,unknown_%u\n", t, h.type);
+        break;
+    }
+}
+
+
+int main(int argc, char** argv)
+{
+    Config cfg;
+
+    if (argc < 2) {
+        usage(argv[0]);
+        return 1;
+    }
+    cfg.path = argv[1];
+    for (int i = 2; i < argc; i++) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            usage(argv[0]);
+            return 1;
+        }
+        std::string val = argv[++i];
+
+        try {
+            if (arg == "--from") {
+                cfg.from_s = std::stod(val);
+            } else if (arg == "--to") {
+                cfg.to_s = std::stod(val);
+            } else if (arg == "--type") {
+                if (val == "position") {
+                    cfg.type = Position;
+                } else if (val == "attitude") {
+                    cfg.type = Attitude;
+                } else if (val == "simgps") {
+                    cfg.type = SimGps;
+                } else {
+                    usage(argv[0]);
+                    return 1;
+                }
+            } else {
+                usage(argv[0]);
+                return 1;
+            }
+        } catch (...) {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    int fd = open(cfg.path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(FileHeader)) {
+        std::cerr << "Error: " << cfg.path << " is not a flight log" << std::endl;
+        return 1;
+    }
+    size_t size = st.st_size;
+    void *map = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        std::cerr << "Error: " << cfg.path << " can not be mapped" << std::endl;
+        return 1;
+    }
+    const char *log = static_cast<const char *>(map);
+
+    FileHeader header;
+    memcpy(&header, log, sizeof(header));
+    if (memcmp(header.magic, MAGIC, sizeof(header.magic)) != 0 || header.version != VERSION
+        || header.segment_size == 0) {
+        std::cerr << "Error: " << cfg.path << " is not a flight log" << std::endl;
+        return 1;
+    }
+    uint64_t segment_size = header.segment_size;
+
+    int64_t from_ns = (int64_t)(cfg.from_s * 1e9);
+    int64_t to_ns = cfg.to_s < 0 ? INT64_MAX : (int64_t)(cfg.to_s * 1e9);
+    uint64_t offset = seek(read_index(cfg.path), from_ns);
+
+    printf("# start_unix_ns %lld\n", (long long)header.start_unix_ns);
+    while (offset < size) {
+        uint64_t segment_end = std::min<uint64_t>(offset - offset % segment_size + segment_size, size);
+
+        RecordHeader h;
+        if (segment_end - offset < sizeof(h)) {
+            offset = segment_end;
+            continue;
+        }
+        memcpy(&h, log + offset, sizeof(h));
+        if (h.type == Pad) {
+            offset = segment_end;
+            continue;
+        }
+        if (segment_end - offset - sizeof(h) < h.size || h.t_ns > to_ns) {
+            // torn record of an interrupted recording, or past the window
+            break;
+        }
+        if (h.t_ns >= from_ns && (cfg.type < 0 || h.type == cfg.type)) {
+            print_record(h, log + offset + sizeof(h));
+        }
+        offset += sizeof(h) + h.size;
+    }
+
+    munmap(map, size);
+    close(fd);
+    return 0;
+}
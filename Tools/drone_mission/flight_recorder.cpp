@@ -0,0 +1,215 @@
+/*
+ * Copyright (C) 2023-2024, HENSOLDT Cyber GmbH
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * For commercial licensing, contact: info.cyber@hensoldt.net
+ */
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "flight_recorder.h"
+
+using namespace flight_log;
+
+
+static bool write_all(int fd, const void *buf, size_t len) {
+    const char *p = static_cast<const char *>(buf);
+    while (len > 0) {
+        ssize_t n = ::write(fd, p, len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+
+FlightRecorder::~FlightRecorder() {
+    close();
+}
+
+
+bool FlightRecorder::open(const std::string &path, Clock::duration flush_interval) {
+    fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    index_fd = ::open((path + ".idx").c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0 || index_fd < 0) {
+        std::cerr << "Error: flight log " << path << " can not be created: " << strerror(errno) << std::endl;
+        close();
+        return false;
+    }
+
+    segment.base = 0;
+    if (ftruncate(fd, SEGMENT_SIZE) < 0) {
+        std::cerr << "Error: flight log " << path << ": " << strerror(errno) << std::endl;
+        close();
+        return false;
+    }
+    void *data = mmap(nullptr, SEGMENT_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+        std::cerr << "Error: flight log " << path << " can not be mapped: " << strerror(errno) << std::endl;
+        close();
+        return false;
+    }
+    segment.data = static_cast<char *>(data);
+
+    FileHeader header = {};
+    memcpy(header.magic, MAGIC, sizeof(header.magic));
+    header.version = VERSION;
+    header.segment_size = SEGMENT_SIZE;
+    header.start_unix_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    memcpy(segment.data, &header, sizeof(header));
+    pos = sizeof(header);
+    synced_pos = 0;
+    next_index_ns = 0;
+    failed = false;
+    stopping = false;
+    start = Clock::now();
+
+    flusher = std::thread(&FlightRecorder::flush_loop, this, flush_interval);
+    return true;
+}
+
+
+void FlightRecorder::close() {
+    if (flusher.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wakeup.notify_all();
+        flusher.join();
+    }
+    // records written while the flusher stopped
+    flush();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (segment.data) {
+        msync(segment.data, SEGMENT_SIZE, MS_SYNC);
+        munmap(segment.data, SEGMENT_SIZE);
+        segment.data = nullptr;
+        // the zero tail of the last segment is not needed
+        if (ftruncate(fd, segment.base + pos) < 0) {
+            std::cerr << "Error: flight log can not be truncated: " << strerror(errno) << std::endl;
+        }
+    }
+    if (fd >= 0) {
+        ::close(fd);
+        fd = -1;
+    }
+    if (index_fd >= 0) {
+        ::close(index_fd);
+        index_fd = -1;
+    }
+}
+
+
+void FlightRecorder::append(uint16_t type, const void *payload, uint16_t size) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if (!segment.data || failed) {
+        dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    size_t len = sizeof(RecordHeader) + size;
+    if (SEGMENT_SIZE - pos < len && !next_segment()) {
+        dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    // taken under the lock, so the log is ordered by time
+    int64_t t_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+    if (t_ns >= next_index_ns) {
+        index.push_back({ t_ns, segment.base + pos });
+        next_index_ns = t_ns - t_ns % INDEX_INTERVAL_NS + INDEX_INTERVAL_NS;
+    }
+
+    RecordHeader header = { type, size, 0, t_ns };
+    memcpy(segment.data + pos, &header, sizeof(header));
+    memcpy(segment.data + pos + sizeof(header), payload, size);
+    pos += len;
+
+    records.fetch_add(1, std::memory_order_relaxed);
+    bytes.fetch_add(len, std::memory_order_relaxed);
+}
+
+
+// Maps the next segment, the full one is synced and unmapped by the flusher
+bool FlightRecorder::next_segment() {
+    uint64_t base = segment.base + SEGMENT_SIZE;
+
+    if (ftruncate(fd, base + SEGMENT_SIZE) < 0) {
+        std::cerr << "Error: flight log can not grow: " << strerror(errno) << std::endl;
+        failed = true;
+        return false;
+    }
+    void *data = mmap(nullptr, SEGMENT_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, base);
+    if (data == MAP_FAILED) {
+        std::cerr << "Error: flight log segment can not be mapped: " << strerror(errno) << std::endl;
+        failed = true;
+        return false;
+    }
+
+    retired.push_back(segment);
+    segment = { static_cast<char *>(data), base };
+    pos = 0;
+    synced_pos = 0;
+    return true;
+}
+
+
+void FlightRecorder::flush_loop(Clock::duration interval) {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!stopping) {
+        wakeup.wait_for(lock, interval, [this] { return stopping; });
+        lock.unlock();
+        flush();
+        lock.lock();
+    }
+}
+
+
+void FlightRecorder::flush() {
+    std::vector<Segment> full;
+    std::vector<IndexEntry> entries;
+    Segment current;
+    size_t from, to;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        full.swap(retired);
+        entries.swap(index);
+        current = segment;
+        from = synced_pos;
+        to = pos;
+        synced_pos = pos;
+    }
+
+    // only the flusher unmaps, so the segments stay valid without the lock
+    for (const Segment &s : full) {
+        msync(s.data, SEGMENT_SIZE, MS_SYNC);
+        munmap(s.data, SEGMENT_SIZE);
+    }
+
+    if (to > from) {
+        size_t page = sysconf(_SC_PAGESIZE);
+        size_t first = from - from % page;
+        msync(current.data + first, to - first, MS_ASYNC);
+    }
+
+    if (!entries.empty() && !write_all(index_fd, entries.data(), entries.size() * sizeof(IndexEntry))) {
+        std::cerr << "Error: flight log index can not be written: " << strerror(errno) << std::endl;
+    }
+}
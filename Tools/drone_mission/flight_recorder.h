@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2023-2024, HENSOLDT Cyber GmbH
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * For commercial licensing, contact: info.cyber@hensoldt.net
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "flight_log.h"
+
+/*
+ * Writes telemetry at full rate into an append-only, memory-mapped log,
+ * see flight_log.h for the format.
+ *
+ * Any thread can write a record, which is only a copy into the current
+ * mapped segment under a short lock. A background thread syncs the written
+ * pages to disk, unmaps full segments and appends the time index, so
+ * writers never wait for I/O.
+ */
+class FlightRecorder {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Stats {
+        uint64_t records;
+        uint64_t bytes;
+        uint64_t dropped;       // after an I/O error
+    };
+
+    FlightRecorder() = default;
+    ~FlightRecorder();
+
+    FlightRecorder(const FlightRecorder &) = delete;
+    FlightRecorder &operator=(const FlightRecorder &) = delete;
+
+    // Creates <path> and <path>.idx, false if they can not be created
+    bool open(const std::string &path, Clock::duration flush_interval = std::chrono::seconds(1));
+    void close();
+
+    bool is_open() const {
+        return fd >= 0;
+    }
+
+    template <typename T>
+    void write(flight_log::RecordType type, const T &payload) {
+        static_assert(sizeof(T) <= UINT16_MAX, "record payload too large");
+        append(type, &payload, sizeof(T));
+    }
+
+    Stats stats() const {
+        return { records.load(std::memory_order_relaxed),
+                 bytes.load(std::memory_order_relaxed),
+                 dropped.load(std::memory_order_relaxed) };
+    }
+
+private:
+    struct Segment {
+        char *data;
+        uint64_t base;          // file offset
+    };
+
+    void append(uint16_t type, const void *payload, uint16_t size);
+    bool next_segment();
+    void flush_loop(Clock::duration interval);
+    void flush();
+
+    int fd = -1;
+    int index_fd = -1;
+    Clock::time_point start;
+
+    // guarded by mutex
+    std::mutex mutex;
+    Segment segment = { nullptr, 0 };
+    size_t pos = 0;
+    size_t synced_pos = 0;
+    std::vector<Segment> retired;
+    std::vector<flight_log::IndexEntry> index;
+    int64_t next_index_ns = 0;
+    bool failed = false;
+
+    std::thread flusher;
+    std::condition_variable wakeup;
+    bool stopping = false;
+
+    std::atomic<uint64_t> records{0};
+    std::atomic<uint64_t> bytes{0};
+    std::atomic<uint64_t> dropped{0};
+};
@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2023-2024, HENSOLDT Cyber GmbH
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * For commercial licensing, contact: info.cyber@hensoldt.net
+ */
+
+#include <fstream>
+#include <iostream>
+
+#include "json/json.hpp"
+#include "mission_file.h"
+
+using mavsdk::Mission;
+using json = nlohmann::json;
+
+
+// Value of key from the waypoint, else from the defaults, else unchanged
+template <typename T>
+static void get_value(const json &waypoint, const json &defaults, const char *key, T &value) {
+    if (waypoint.contains(key)) {
+        value = waypoint.at(key).get<T>();
+    } else if (defaults.contains(key)) {
+        value = defaults.at(key).get<T>();
+    }
+}
+
+
+static Mission::MissionItem parse_waypoint(const json &waypoint, const json &defaults) {
+    Mission::MissionItem item;
+
+    item.latitude_deg = waypoint.at("latitude_deg").get<double>();
+    item.longitude_deg = waypoint.at("longitude_deg").get<double>();
+    get_value(waypoint, defaults, "relative_altitude_m", item.relative_altitude_m);
+    get_value(waypoint, defaults, "speed_m_s", item.speed_m_s);
+    get_value(waypoint, defaults, "fly_through", item.is_fly_through);
+    get_value(waypoint, defaults, "loiter_time_s", item.loiter_time_s);
+    get_value(waypoint, defaults, "acceptance_radius_m", item.acceptance_radius_m);
+    get_value(waypoint, defaults, "yaw_deg", item.yaw_deg);
+    return item;
+}
+
+
+bool load_mission_file(const std::string &path, MissionFile &mission) {
+    std::ifstream file(path);
+    if (!file) {
+        std::cerr << "Error: mission file " << path << " can not be opened" << std::endl;
+        return false;
+    }
+
+    try {
+        json data = json::parse(file);
+        json defaults = data.value("defaults", json::object());
+
+        mission.return_to_launch = data.value("return_to_launch", mission.return_to_launch);
+        mission.timeout_s = data.value("timeout_s", mission.timeout_s);
+        mission.plan.mission_items.clear();
+        for (const json &waypoint : data.at("waypoints")) {
+            mission.plan.mission_items.push_back(parse_waypoint(waypoint, defaults));
+        }
+    } catch (const json::exception &e) {
+        std::cerr << "Error: mission file " << path << ": " << e.what() << std::endl;
+        return false;
+    }
+
+    if (mission.plan.mission_items.empty()) {
+        std::cerr << "Error: mission file " << path << " has no waypoints" << std::endl;
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,39 @@
+/*
+ * Copyright (C) 2023-2024, HENSOLDT Cyber GmbH
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * For commercial licensing, contact: info.cyber@hensoldt.net
+ */
+
+#pragma once
+
+#include <string>
+
+#include <mavsdk/plugins/mission/mission.h>
+
+/*
+ * A mission read from a JSON file:
+ *
+ * {
+ *   "return_to_launch": true,
+ *   "timeout_s": 600,
+ *   "defaults": { "relative_altitude_m": 10, "speed_m_s": 5 },
+ *   "waypoints": [
+ *     { "latitude_deg": 48.0554, "longitude_deg": 11.6531, "loiter_time_s": 2 }
+ *   ]
+ * }
+ *
+ * Every waypoint needs latitude_deg and longitude_deg. The other keys
+ * (relative_altitude_m, speed_m_s, fly_through, loiter_time_s,
+ * acceptance_radius_m, yaw_deg) fall back to "defaults" and then to MAVSDK's
+ * defaults.
+ */
+struct MissionFile {
+    mavsdk::Mission::MissionPlan plan;
+    bool return_to_launch = true;
+    double timeout_s = 600;     // whole mission, from start to the last item
+};
+
+// Prints the reason and returns false if the file can not be used
+bool load_mission_file(const std::string &path, MissionFile &mission);
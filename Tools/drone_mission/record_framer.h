@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2023-2024, HENSOLDT Cyber GmbH
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * For commercial licensing, contact: info.cyber@hensoldt.net
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <string_view>
+#include <vector>
+
+/*
+ * Splits the SimCoupler stream into records ending with '\x07'.
+ *
+ * Data is received straight into the buffer (prepare/commit) and records
+ * are handed out as views into it, nothing is copied per record. Only the
+ * unfinished record at the end is moved to the front when space runs out,
+ * and the buffer grows if a single record does not fit. Every byte is
+ * scanned once, with memchr.
+ *
+ * The stream may be joined in the middle of a record, so everything up to
+ * the first delimiter is dropped.
+ */
+class RecordFramer {
+public:
+    static constexpr char delimiter = '\x07';
+
+    explicit RecordFramer(size_t capacity = 16 * 1024) : buf(capacity) {}
+
+    // Space to receive at least min_space bytes into, see space()
+    char *prepare(size_t min_space) {
+        if (buf.size() - tail < min_space) {
+            // views handed out before are invalid from here on
+            size_t len = tail - head;
+            std::memmove(buf.data(), buf.data() + head, len);
+            scan -= head;
+            head = 0;
+            tail = len;
+            if (buf.size() - tail < min_space) {
+                buf.resize(std::max(buf.size() * 2, tail + min_space));
+            }
+        }
+        return buf.data() + tail;
+    }
+
+    size_t space() const {
+        return buf.size() - tail;
+    }
+
+    void commit(size_t len) {
+        tail += len;
+    }
+
+    // The next complete record without delimiter, valid until the next prepare()
+    bool next(std::string_view &record) {
+        for (;;) {
+            const char *start = buf.data() + scan;
+            const char *end = static_cast<const char *>(std::memchr(start, delimiter, tail - scan));
+            if (!end) {
+                scan = tail;
+                return false;
+            }
+
+            size_t pos = end - buf.data();
+            size_t first = head;
+            head = scan = pos + 1;
+            if (!synced) {
+                synced = true;
+                continue;
+            }
+            record = std::string_view(buf.data() + first, pos - first);
+            return true;
+        }
+    }
+
+private:
+    std::vector<char> buf;
+    size_t head = 0;        // start of the first unread record
+    size_t scan = 0;        // bytes before this are known to hold no delimiter
+    size_t tail = 0;        // end of the received data
+    bool synced = false;
+};
@@ -0,0 +1,171 @@
+/*
+ * Copyright (C) 2023-2024, HENSOLDT Cyber GmbH
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * For commercial licensing, contact: info.cyber@hensoldt.net
+ */
+
+#include <cerrno>
+#include <chrono>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "json/json.hpp"
+#include "sensor_reader.h"
+
+using json = nlohmann::json;
+
+
+static int64_t steady_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+// Full parse for records the SensorRecordReader does not understand
+static bool parse_json_position(std::string_view record, GpsPosition &pos) {
+    try {
+        json data = json::parse(record.begin(), record.end());
+        if (!data.is_object() || !data["latitudeDeg"].is_number()
+            || !data["longitudeDeg"].is_number() || !data["altitude"].is_number()) {
+            return false;
+        }
+        pos.latitude_deg = data["latitudeDeg"];
+        pos.longitude_deg = data["longitudeDeg"];
+        pos.altitude = data["altitude"];
+        return true;
+    } catch (...) {
+        return false;
+    }
+}
+
+
+SensorReader::~SensorReader() {
+    stop();
+}
+
+
+bool SensorReader::start() {
+    fcntl(sockfd, F_SETFL, fcntl(sockfd, F_GETFL) | O_NONBLOCK);
+
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    stopfd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (epfd < 0 || stopfd < 0) {
+        std::cerr << "Error: sensor reader setup failed: " << strerror(errno) << std::endl;
+        stop();
+        return false;
+    }
+
+    struct epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.fd = sockfd;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, sockfd, &ev) < 0) {
+        std::cerr << "Error: sensor reader setup failed: " << strerror(errno) << std::endl;
+        stop();
+        return false;
+    }
+    ev.data.fd = stopfd;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, stopfd, &ev);
+
+    thread = std::thread(&SensorReader::run, this);
+    return true;
+}
+
+
+void SensorReader::stop() {
+    if (thread.joinable()) {
+        uint64_t one = 1;
+        if (write(stopfd, &one, sizeof(one)) < 0) {
+            std::cerr << "Error: stopping sensor reader failed" << std::endl;
+        }
+        thread.join();
+    }
+    if (epfd >= 0) {
+        close(epfd);
+        epfd = -1;
+    }
+    if (stopfd >= 0) {
+        close(stopfd);
+        stopfd = -1;
+    }
+}
+
+
+void SensorReader::run() {
+    struct epoll_event events[2];
+
+    for (;;) {
+        int n = epoll_wait(epfd, events, 2, -1);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            std::cerr << "Error: sensor reader epoll_wait: " << strerror(errno) << std::endl;
+            break;
+        }
+
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.fd == stopfd) {
+                return;
+            }
+            if (!drain()) {
+                std::cerr << "SimCoupler connection closed" << std::endl;
+                closed = true;
+                return;
+            }
+        }
+    }
+    closed = true;
+}
+
+
+// Reads until the socket is empty, false if the connection is gone
+bool SensorReader::drain() {
+    for (;;) {
+        char *buf = framer.prepare(4096);
+        ssize_t n = recv(sockfd, buf, framer.space(), 0);
+        if (n == 0) {
+            return false;
+        }
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        framer.commit(n);
+        bytes.fetch_add(n, std::memory_order_relaxed);
+
+        // views are only valid until the next prepare()
+        int64_t now_ns = steady_ns();
+        std::string_view record;
+        while (framer.next(record)) {
+            handle_record(record, now_ns);
+        }
+    }
+}
+
+
+void SensorReader::handle_record(std::string_view record, int64_t now_ns) {
+    records.fetch_add(1, std::memory_order_relaxed);
+
+    GpsSample sample;
+    RecordResult result = SensorRecordReader(record).read(sample.position);
+    if (result == RecordResult::NotFound) {
+        return;
+    }
+    if (result == RecordResult::Unknown && !parse_json_position(record, sample.position)) {
+        unparsed.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    sample.received_ns = now_ns;
+    gps.publish(sample);
+    if (on_gps) {
+        on_gps(sample);
+    }
+}
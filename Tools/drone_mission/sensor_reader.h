@@ -0,0 +1,149 @@
+/*
+ * Copyright (C) 2023-2024, HENSOLDT Cyber GmbH
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * For commercial licensing, contact: info.cyber@hensoldt.net
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+
+#include "record_framer.h"
+#include "sensor_record.h"
+
+/*
+ * Latest value of a topic, written by one thread and read by any number.
+ *
+ * A seqlock: readers never block the writer and retry if they raced with
+ * a publish. The value is stored as atomic words so a torn copy is never
+ * undefined behaviour, only discarded.
+ */
+template <typename T>
+class LatestValue {
+    static_assert(std::is_trivially_copyable<T>::value, "LatestValue needs a trivially copyable type");
+
+public:
+    void publish(const T &value) {
+        uint64_t words[WORDS] = {};
+        std::memcpy(words, &value, sizeof(T));
+
+        uint64_t s = seq.load(std::memory_order_relaxed);
+        seq.store(s + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        for (size_t i = 0; i < WORDS; i++) {
+            data[i].store(words[i], std::memory_order_relaxed);
+        }
+        seq.store(s + 2, std::memory_order_release);
+    }
+
+    // False if nothing was published yet, version counts the publishes
+    bool load(T &value, uint64_t *version = nullptr) const {
+        uint64_t words[WORDS];
+        uint64_t s;
+
+        for (;;) {
+            s = seq.load(std::memory_order_acquire);
+            if (s & 1) {
+                continue;
+            }
+            for (size_t i = 0; i < WORDS; i++) {
+                words[i] = data[i].load(std::memory_order_relaxed);
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (seq.load(std::memory_order_relaxed) == s) {
+                break;
+            }
+        }
+
+        if (s == 0) {
+            return false;
+        }
+        std::memcpy(&value, words, sizeof(T));
+        if (version) {
+            *version = s / 2;
+        }
+        return true;
+    }
+
+private:
+    static constexpr size_t WORDS = (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+    std::atomic<uint64_t> seq{0};
+    std::atomic<uint64_t> data[WORDS] = {};
+};
+
+
+struct GpsSample {
+    GpsPosition position;
+    int64_t received_ns;    // steady clock
+};
+
+
+/*
+ * Drains the SimCoupler socket on its own thread.
+ *
+ * An epoll loop reads whatever arrived, frames and parses every record and
+ * publishes the newest value per topic. The mission thread reads the
+ * latest values at any time without blocking and without touching the
+ * socket. Records of topics without a decoder are only counted.
+ * Every decoded sample can also be passed to a callback on the reader
+ * thread, e.g. to record it.
+ */
+class SensorReader {
+public:
+    struct Stats {
+        uint64_t bytes;
+        uint64_t records;
+        uint64_t unparsed;      // malformed or unknown schema
+    };
+
+    using GpsCallback = std::function<void(const GpsSample &)>;
+
+    explicit SensorReader(int sockfd, GpsCallback on_gps = nullptr) : sockfd(sockfd), on_gps(on_gps) {}
+    ~SensorReader();
+
+    SensorReader(const SensorReader &) = delete;
+    SensorReader &operator=(const SensorReader &) = delete;
+
+    // False if the event loop could not be set up
+    bool start();
+    void stop();
+
+    // False once the SimCoupler closed the connection
+    bool connected() const {
+        return !closed.load(std::memory_order_relaxed);
+    }
+
+    Stats stats() const {
+        return { bytes.load(std::memory_order_relaxed),
+                 records.load(std::memory_order_relaxed),
+                 unparsed.load(std::memory_order_relaxed) };
+    }
+
+    LatestValue<GpsSample> gps;
+
+private:
+    void run();
+    bool drain();
+    void handle_record(std::string_view record, int64_t now_ns);
+
+    int sockfd;
+    GpsCallback on_gps;
+    int epfd = -1;
+    int stopfd = -1;
+    std::thread thread;
+    RecordFramer framer;
+
+    std::atomic<bool> closed{false};
+    std::atomic<uint64_t> bytes{0};
+    std::atomic<uint64_t> records{0};
+    std::atomic<uint64_t> unparsed{0};
+};
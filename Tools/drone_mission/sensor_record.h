@@ -0,0 +1,190 @@
+/*
+ * Copyright (C) 2023-2024, HENSOLDT Cyber GmbH
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * For commercial licensing, contact: info.cyber@hensoldt.net
+ */
+
+#pragma once
+
+#include <cstdlib>
+#include <cstring>
+#include <string_view>
+
+/*
+ * On-demand reader for the NavSat records of the SimCoupler.
+ *
+ * Walks the top-level object once and converts only latitudeDeg,
+ * longitudeDeg and altitude, nested values are skipped without being
+ * looked at. Nothing is allocated. Anything unexpected is reported as
+ * Unknown, so the caller can fall back to the full JSON parser.
+ */
+enum class RecordResult {
+    Found,
+    NotFound,   // a well-formed record of another topic
+    Unknown,
+};
+
+struct GpsPosition {
+    double latitude_deg;
+    double longitude_deg;
+    double altitude;
+};
+
+class SensorRecordReader {
+public:
+    explicit SensorRecordReader(std::string_view record) : p(record.data()), end(record.data() + record.size()) {}
+
+    RecordResult read(GpsPosition &pos) {
+        enum { LAT = 1, LON = 2, ALT = 4 };
+        unsigned int found = 0;
+
+        skip_ws();
+        if (!consume('{')) {
+            return RecordResult::Unknown;
+        }
+        skip_ws();
+        if (consume('}')) {
+            return RecordResult::NotFound;
+        }
+        for (;;) {
+            std::string_view key;
+            skip_ws();
+            if (!read_key(key)) {
+                return RecordResult::Unknown;
+            }
+            skip_ws();
+            if (!consume(':')) {
+                return RecordResult::Unknown;
+            }
+            skip_ws();
+
+            bool ok;
+            if (key == "latitudeDeg") {
+                ok = read_number(pos.latitude_deg);
+                found |= LAT;
+            } else if (key == "longitudeDeg") {
+                ok = read_number(pos.longitude_deg);
+                found |= LON;
+            } else if (key == "altitude") {
+                ok = read_number(pos.altitude);
+                found |= ALT;
+            } else {
+                ok = skip_value();
+            }
+            if (!ok) {
+                return RecordResult::Unknown;
+            }
+
+            skip_ws();
+            if (consume('}')) {
+                break;
+            }
+            if (!consume(',')) {
+                return RecordResult::Unknown;
+            }
+        }
+        return found == (LAT | LON | ALT) ? RecordResult::Found : RecordResult::NotFound;
+    }
+
+private:
+    const char *p;
+    const char *end;
+
+    void skip_ws() {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) {
+            p++;
+        }
+    }
+
+    bool consume(char c) {
+        if (p < end && *p == c) {
+            p++;
+            return true;
+        }
+        return false;
+    }
+
+    // Keys with escapes are left to the full parser
+    bool read_key(std::string_view &key) {
+        if (!consume('"')) {
+            return false;
+        }
+        const char *start = p;
+        const char *quote = static_cast<const char *>(std::memchr(p, '"', end - p));
+        if (!quote || std::memchr(start, '\\', quote - start)) {
+            return false;
+        }
+        key = std::string_view(start, quote - start);
+        p = quote + 1;
+        return true;
+    }
+
+    // The record is not NUL-terminated, so the number is copied for strtod
+    bool read_number(double &value) {
+        char num[32];
+        size_t len = 0;
+        while (p < end && len < sizeof(num) - 1 && *p && std::strchr("+-0123456789.eE", *p)) {
+            num[len++] = *p++;
+        }
+        if (len == 0) {
+            return false;
+        }
+        num[len] = '\0';
+
+        char *num_end;
+        value = std::strtod(num, &num_end);
+        return num_end == num + len;
+    }
+
+    bool skip_string() {
+        p++;
+        while (p < end) {
+            if (*p == '\\') {
+                p += 2;
+            } else if (*p++ == '"') {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool skip_value() {
+        int depth = 0;
+        while (p < end) {
+            switch (*p) {
+            case '"':
+                if (!skip_string()) {
+                    return false;
+                }
+                if (depth == 0) {
+                    return true;
+                }
+                continue;
+            case '{':
+            case '[':
+                depth++;
+                break;
+            case '}':
+            case ']':
+                if (depth == 0) {
+                    // end of the enclosing object, the scalar before is done
+                    return true;
+                }
+                if (--depth == 0) {
+                    p++;
+                    return true;
+                }
+                break;
+            case ',':
+                if (depth == 0) {
+                    return true;
+                }
+                break;
+            }
+            p++;
+        }
+        return false;
+    }
+};
@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2023-2024, HENSOLDT Cyber GmbH
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * For commercial licensing, contact: info.cyber@hensoldt.net
+ */
+
+#include <cmath>
+
+#include "vehicle_monitor.h"
+
+using mavsdk::Telemetry;
+
+
+VehicleMonitor::VehicleMonitor(Telemetry &telemetry) : telemetry(telemetry) {
+    health_handle = telemetry.subscribe_health_all_ok([this](bool ok) {
+        update([&](State &s) { s.health_all_ok = ok; });
+    });
+    armed_handle = telemetry.subscribe_armed([this](bool armed) {
+        update([&](State &s) { s.armed = armed; });
+    });
+    in_air_handle = telemetry.subscribe_in_air([this](bool in_air) {
+        update([&](State &s) { s.in_air = in_air; });
+    });
+    landed_state_handle = telemetry.subscribe_landed_state([this](Telemetry::LandedState landed_state) {
+        update([&](State &s) { s.landed_state = landed_state; });
+    });
+    position_handle = telemetry.subscribe_position([this](Telemetry::Position position) {
+        update([&](State &s) {
+            s.position = position;
+            s.has_position = true;
+            s.position_updates++;
+        });
+    });
+}
+
+
+VehicleMonitor::~VehicleMonitor() {
+    telemetry.unsubscribe_position(position_handle);
+    telemetry.unsubscribe_landed_state(landed_state_handle);
+    telemetry.unsubscribe_in_air(in_air_handle);
+    telemetry.unsubscribe_armed(armed_handle);
+    telemetry.unsubscribe_health_all_ok(health_handle);
+}
+
+
+VehicleMonitor::State VehicleMonitor::state() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return current;
+}
+
+
+bool VehicleMonitor::wait_health_ok(Clock::duration timeout) {
+    return wait_until([](const State &s) { return s.health_all_ok; }, timeout, "health ok");
+}
+
+
+bool VehicleMonitor::wait_armed(bool armed, Clock::duration timeout) {
+    return wait_until([armed](const State &s) { return s.armed == armed; }, timeout,
+                      armed ? "armed" : "disarmed");
+}
+
+
+bool VehicleMonitor::wait_altitude(float relative_altitude_m, Clock::duration timeout) {
+    return wait_until([relative_altitude_m](const State &s) {
+        return s.has_position && s.position.relative_altitude_m >= relative_altitude_m;
+    }, timeout, "altitude");
+}
+
+
+bool VehicleMonitor::wait_within(double latitude_deg, double longitude_deg, double radius_m,
+                                 Clock::duration timeout) {
+    return wait_until([=](const State &s) {
+        return s.has_position &&
+               distance_m(s.position.latitude_deg, s.position.longitude_deg, latitude_deg, longitude_deg) <= radius_m;
+    }, timeout, "target position");
+}
+
+
+bool VehicleMonitor::wait_landed(Clock::duration timeout) {
+    return wait_until([](const State &s) {
+        return !s.in_air && s.landed_state == Telemetry::LandedState::OnGround;
+    }, timeout, "landing");
+}
+
+
+double VehicleMonitor::distance_m(double lat1_deg, double lon1_deg, double lat2_deg, double lon2_deg) {
+    constexpr double earth_radius_m = 6371000.0;
+    constexpr double rad = M_PI / 180.0;
+
+    double x = (lon2_deg - lon1_deg) * rad * std::cos((lat1_deg + lat2_deg) / 2 * rad);
+    double y = (lat2_deg - lat1_deg) * rad;
+    return std::sqrt(x * x + y * y) * earth_radius_m;
+}
@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2023-2024, HENSOLDT Cyber GmbH
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * For commercial licensing, contact: info.cyber@hensoldt.net
+ */
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <iostream>
+#include <mutex>
+
+#include <mavsdk/plugins/telemetry/telemetry.h>
+
+/*
+ * Waits for vehicle states instead of polling them.
+ *
+ * The telemetry subscriptions update one State and wake up every waiter,
+ * so a mission step continues as soon as its precondition holds. Each wait
+ * has a timeout and reports what it waited for when it expires.
+ */
+class VehicleMonitor {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    struct State {
+        bool health_all_ok = false;
+        bool armed = false;
+        bool in_air = false;
+        mavsdk::Telemetry::LandedState landed_state = mavsdk::Telemetry::LandedState::Unknown;
+        bool has_position = false;
+        mavsdk::Telemetry::Position position {};
+        uint64_t position_updates = 0;
+    };
+
+    explicit VehicleMonitor(mavsdk::Telemetry &telemetry);
+    ~VehicleMonitor();
+
+    VehicleMonitor(const VehicleMonitor &) = delete;
+    VehicleMonitor &operator=(const VehicleMonitor &) = delete;
+
+    State state() const;
+
+    // Blocks until pred(state) holds, false after the timeout
+    template <typename Pred>
+    bool wait_until(Pred pred, Clock::duration timeout, const char *what) {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (changed.wait_for(lock, timeout, [&] { return pred(current); })) {
+            return true;
+        }
+        std::cerr << "Timed out waiting for " << what << " after "
+                  << std::chrono::duration_cast<std::chrono::seconds>(timeout).count() << " s\n";
+        return false;
+    }
+
+    bool wait_health_ok(Clock::duration timeout);
+    bool wait_armed(bool armed, Clock::duration timeout);
+    bool wait_altitude(float relative_altitude_m, Clock::duration timeout);
+    bool wait_within(double latitude_deg, double longitude_deg, double radius_m, Clock::duration timeout);
+    bool wait_landed(Clock::duration timeout);
+
+    // Horizontal distance in m, good enough for the few hundred m of a geofence
+    static double distance_m(double lat1_deg, double lon1_deg, double lat2_deg, double lon2_deg);
+
+private:
+    template <typename F>
+    void update(F f) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            f(current);
+        }
+        changed.notify_all();
+    }
+
+    mavsdk::Telemetry &telemetry;
+    mutable std::mutex mutex;
+    std::condition_variable changed;
+    State current;
+
+    mavsdk::Telemetry::HealthAllOkHandle health_handle;
+    mavsdk::Telemetry::ArmedHandle armed_handle;
+    mavsdk::Telemetry::InAirHandle in_air_handle;
+    mavsdk::Telemetry::LandedStateHandle landed_state_handle;
+    mavsdk::Telemetry::PositionHandle position_handle;
+};
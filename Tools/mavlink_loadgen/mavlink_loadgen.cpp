@@ -0,0 +1,585 @@
+/*
+ * Copyright (C) 2023-2024, HENSOLDT Cyber GmbH
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * For commercial licensing, contact: info.cyber@hensoldt.net
+ */
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "system_config.h"
+
+#include "common/mavlink.h"
+
+#include "components/SerialFilter/mavlink_filter/cmd_trace.h"
+
+using Clock = std::chrono::steady_clock;
+
+
+/*
+ * Sends a mix of messages through the SerialFilter and measures how long
+ * the COMMAND_ACKs take. Commands are kept by (command, seq). COMMAND_ACK
+ * carries no sequence number, so an ACK answers the oldest command of its id
+ * still waiting; every stream sends its own command id. Commands waiting
+ * longer than the timeout are counted as lost.
+ *
+ * With MAVLINK_CMD_TRACE_ENABLED the filter reports the round trip of every
+ * command by (command, seq), like the commands are kept here. A command the
+ * filter dropped or PX4 never answered is taken out by its report, so it
+ * does not take the ACK of a later command. Taking the time the filter held
+ * a command from the round trip measured here leaves the time on the network
+ * between guest and filter, no clock has to be synchronized.
+ */
+enum class Kind {
+    CommandLong,
+    CommandInt,
+    DropPath,   // not forwarded by the filter, loads its drop path
+};
+
+
+struct Stream {
+    const char *name;
+    Kind kind;
+    uint16_t command;       // command id, with the seq the key of a command
+    double rate_hz = 0;
+    Clock::duration period = {};
+    Clock::time_point next = {};
+
+    std::deque<std::pair<Clock::time_point, uint8_t>> pending;  // send time and seq, oldest first
+    uint64_t sent = 0;
+    uint64_t acked = 0;
+    uint64_t denied = 0;    // answered with a result other than accepted, or dropped by the filter
+    uint64_t lost = 0;
+    std::vector<double> latency_ms;
+};
+
+
+// Round trip of a command, split up by the filter's CMDTRACE reports
+struct Traced {
+    Clock::time_point sent = {};
+    Clock::time_point acked = {};   // default: no ACK yet
+    uint16_t command = 0;
+};
+
+
+struct Breakdown {
+    uint64_t reports = 0;
+    uint64_t dropped = 0;           // by the filter
+    uint64_t no_ack = 0;            // forwarded, PX4 did not answer
+    std::vector<double> network_ms; // guest -> filter and back
+    std::vector<double> filter_ms;  // decision, write to PX4 and relaying the ACK
+    std::vector<double> px4_ms;     // filter -> PX4 -> ACK
+};
+
+
+struct Config {
+    std::string addr = VM_TRENTOS_ADDR;
+    uint16_t port = VM_TRENTOS_PORT;
+    double duration = 30;
+    double timeout = 1.0;
+    double stats_interval = 1.0;
+    double rate_long = 10;
+    double rate_int = 10;
+    double rate_drop_path = 0;
+    uint8_t sysid = 245;
+    uint8_t compid = MAV_COMP_ID_ONBOARD_COMPUTER;
+};
+
+
+void usage(const std::string& bin_name)
+{
+    std::cerr << "Usage : " << bin_name << " [options] [tcp://host:port]\n"
+              << " --command-long <hz>  COMMAND_LONG rate (default 10)\n"
+              << " --command-int <hz>   COMMAND_INT rate (default 10)\n"
+              << " --drop-path <hz>     SET_POSITION_TARGET_LOCAL_NED rate, the filter drops it (default 0)\n"
+              << " --duration <s>       length of the run (default 30)\n"
+              << " --timeout <s>        a command without ACK after this time is lost (default 1)\n"
+              << " --stats <s>          progress interval in seconds (default 1)\n"
+              << "The default connection is tcp://" VM_TRENTOS_ADDR ":" << VM_TRENTOS_PORT << "\n";
+}
+
+
+bool parse_url(const std::string &url, Config &cfg) {
+    const std::string prefix = "tcp://";
+    if (url.rfind(prefix, 0) != 0) {
+        return false;
+    }
+    std::string host = url.substr(prefix.size());
+    size_t colon = host.find(':');
+    if (colon != std::string::npos) {
+        cfg.port = (uint16_t)std::stoi(host.substr(colon + 1));
+        host.resize(colon);
+    }
+    if (!host.empty()) {
+        cfg.addr = host;
+    }
+    return true;
+}
+
+
+int get_socket(const std::string &addr, uint16_t port) {
+    struct sockaddr_in server_addr = {};
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(port);
+    server_addr.sin_addr.s_addr = inet_addr(addr.c_str());
+
+    int sock_client;
+    if ((sock_client = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
+        std::cerr << "Error: socket creation failed" << std::endl;
+        exit(-1);
+    }
+
+    while (connect(sock_client, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
+        std::cerr << "Error: connection to server with IP: "
+                  << addr << " Port: "
+                  << port << " failed." << std::endl;
+        sleep(1);
+    }
+
+    int one = 1;
+    setsockopt(sock_client, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    std::cout << "Connection to SerialFilter with IP: "
+              << addr << " Port: "
+              << port << " established." << std::endl;
+    return sock_client;
+}
+
+
+class LoadGen {
+public:
+    LoadGen(const Config &config, int fd) : cfg(config), fd(fd) {
+        // REQUEST_MESSAGE is answered by the autopilot without side effects,
+        // the two streams use different commands so their ACKs are told apart
+        add_stream("command_long", Kind::CommandLong, MAV_CMD_REQUEST_MESSAGE, cfg.rate_long);
+        add_stream("command_int", Kind::CommandInt, MAV_CMD_REQUEST_PROTOCOL_VERSION, cfg.rate_int);
+        add_stream("drop_path", Kind::DropPath, 0, cfg.rate_drop_path);
+    }
+
+    // Waits for the heartbeat of the autopilot behind the filter
+    bool find_target(double timeout_s) {
+        auto end = Clock::now() + std::chrono::duration_cast<Clock::duration>(
+                                      std::chrono::duration<double>(timeout_s));
+        while (Clock::now() < end && !target_sysid) {
+            if (!receive(100)) {
+                return false;
+            }
+        }
+        return target_sysid != 0;
+    }
+
+    bool run() {
+        auto start = Clock::now();
+        auto end = start + seconds(cfg.duration);
+        auto next_stats = start + seconds(cfg.stats_interval);
+        uint64_t sent_last = 0;
+        uint64_t acked_last = 0;
+
+        for (auto &s : streams) {
+            s.next = start;
+        }
+
+        while (Clock::now() < end) {
+            auto now = Clock::now();
+            auto next = std::min(end, next_stats);
+
+            for (auto &s : streams) {
+                if (s.rate_hz <= 0) {
+                    continue;
+                }
+                while (s.next <= now) {
+                    if (!send_stream(s, now)) {
+                        return false;
+                    }
+                    s.next += s.period;
+                }
+                next = std::min(next, s.next);
+            }
+            expire(now);
+
+            if (now >= next_stats) {
+                uint64_t sent = 0, acked = 0, pending = 0;
+                for (auto &s : streams) {
+                    sent += s.sent;
+                    acked += s.acked + s.denied;
+                    pending += s.pending.size();
+                }
+                printf("sent %6.0f msg/s | acks %6.0f/s | waiting %llu | rx drops %u\n",
+                       (sent - sent_last) / cfg.stats_interval,
+                       (acked - acked_last) / cfg.stats_interval,
+                       (unsigned long long)pending,
+                       (unsigned int)parse_status.packet_rx_drop_count);
+                fflush(stdout);
+                sent_last = sent;
+                acked_last = acked;
+                next_stats += seconds(cfg.stats_interval);
+            }
+
+            auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(next - Clock::now()).count();
+            if (!receive(wait > 0 ? (int)wait : 0)) {
+                return false;
+            }
+        }
+
+        // the last commands get the timeout to be answered
+        auto drain_end = Clock::now() + seconds(cfg.timeout);
+        while (Clock::now() < drain_end && outstanding()) {
+            if (!receive(10)) {
+                return false;
+            }
+        }
+        expire(Clock::now() + seconds(cfg.timeout));
+        return true;
+    }
+
+    void report() const {
+        printf("\n%-13s %8s %8s %8s %8s %7s %9s %9s %9s %9s %9s\n",
+               "stream", "sent", "acked", "denied", "lost", "loss", "p50 ms", "p90 ms", "p99 ms", "p99.9 ms", "max ms");
+        for (auto &s : streams) {
+            if (!s.sent) {
+                continue;
+            }
+            if (s.kind == Kind::DropPath) {
+                printf("%-13s %8llu %8s %8s %8s %7s\n", s.name, (unsigned long long)s.sent, "-", "-", "-", "-");
+                continue;
+            }
+
+            std::vector<double> l = s.latency_ms;
+            std::sort(l.begin(), l.end());
+            auto pct = [&l](double p) {
+                return l.empty() ? NAN : l[std::min(l.size() - 1, (size_t)(p / 100.0 * l.size()))];
+            };
+            printf("%-13s %8llu %8llu %8llu %8llu %6.2f%% %9.2f %9.2f %9.2f %9.2f %9.2f\n",
+                   s.name, (unsigned long long)s.sent, (unsigned long long)s.acked,
+                   (unsigned long long)s.denied, (unsigned long long)s.lost,
+                   100.0 * s.lost / s.sent,
+                   pct(50), pct(90), pct(99), pct(99.9), l.empty() ? NAN : l.back());
+        }
+
+        if (!trace.reports) {
+            return;
+        }
+        printf("\nround trip breakdown from %llu filter reports (%llu dropped by the filter, %llu without ACK)\n",
+               (unsigned long long)trace.reports, (unsigned long long)trace.dropped,
+               (unsigned long long)trace.no_ack);
+        printf("%-13s %9s %9s %9s %9s %9s\n", "part", "p50 ms", "p90 ms", "p99 ms", "p99.9 ms", "max ms");
+        print_part("guest-filter", trace.network_ms);
+        print_part("filter", trace.filter_ms);
+        print_part("filter-px4", trace.px4_ms);
+    }
+
+private:
+    static void print_part(const char *name, std::vector<double> l) {
+        std::sort(l.begin(), l.end());
+        auto pct = [&l](double p) {
+            return l.empty() ? NAN : l[std::min(l.size() - 1, (size_t)(p / 100.0 * l.size()))];
+        };
+        printf("%-13s %9.2f %9.2f %9.2f %9.2f %9.2f\n", name,
+               pct(50), pct(90), pct(99), pct(99.9), l.empty() ? NAN : l.back());
+    }
+
+    static Clock::duration seconds(double s) {
+        return std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(s));
+    }
+
+    void add_stream(const char *name, Kind kind, uint16_t command, double rate_hz) {
+        Stream s;
+        s.name = name;
+        s.kind = kind;
+        s.command = command;
+        s.rate_hz = rate_hz;
+        s.period = rate_hz > 0 ? seconds(1.0 / rate_hz) : Clock::duration::zero();
+        streams.push_back(std::move(s));
+    }
+
+    size_t outstanding() const {
+        size_t n = 0;
+        for (auto &s : streams) {
+            n += s.pending.size();
+        }
+        return n;
+    }
+
+    bool send_stream(Stream &s, Clock::time_point now) {
+        mavlink_message_t msg;
+
+        switch (s.kind) {
+        case Kind::CommandLong: {
+            mavlink_command_long_t c = {};
+            c.target_system = target_sysid;
+            c.target_component = target_compid;
+            c.command = s.command;
+            c.param1 = MAVLINK_MSG_ID_AUTOPILOT_VERSION;
+            mavlink_msg_command_long_encode_chan(cfg.sysid, cfg.compid, MAVLINK_COMM_1, &msg, &c);
+            break;
+        }
+        case Kind::CommandInt: {
+            // the filter checks the position of every COMMAND_INT against the geofence
+            double home[] = HOME_POSITION;
+            mavlink_command_int_t c = {};
+            c.target_system = target_sysid;
+            c.target_component = target_compid;
+            c.frame = MAV_FRAME_GLOBAL_RELATIVE_ALT_INT;
+            c.command = s.command;
+            c.param1 = 1;
+            c.x = (int32_t)(home[0] * 1e7);
+            c.y = (int32_t)(home[1] * 1e7);
+            c.z = NAN;
+            mavlink_msg_command_int_encode_chan(cfg.sysid, cfg.compid, MAVLINK_COMM_1, &msg, &c);
+            break;
+        }
+        case Kind::DropPath: {
+            // the filter drops it as unknown message, PX4 would ignore every field
+            mavlink_set_position_target_local_ned_t sp = {};
+            sp.target_system = target_sysid;
+            sp.target_component = target_compid;
+            sp.coordinate_frame = MAV_FRAME_LOCAL_NED;
+            sp.type_mask = 0x0fff;
+            mavlink_msg_set_position_target_local_ned_encode_chan(cfg.sysid, cfg.compid, MAVLINK_COMM_1, &msg, &sp);
+            break;
+        }
+        }
+
+        uint8_t buf[MAVLINK_MAX_PACKET_LEN];
+        uint16_t len = mavlink_msg_to_send_buffer(buf, &msg);
+        if (send(fd, buf, len, MSG_NOSIGNAL) != len) {
+            std::cerr << "send failed: " << strerror(errno) << std::endl;
+            return false;
+        }
+
+        s.sent++;
+        if (s.kind != Kind::DropPath) {
+            s.pending.emplace_back(now, msg.seq);
+            traced[msg.seq] = Traced{ now, {}, s.command };
+        }
+        return true;
+    }
+
+    void expire(Clock::time_point now) {
+        auto timeout = seconds(cfg.timeout);
+        for (auto &s : streams) {
+            while (!s.pending.empty() && now - s.pending.front().first > timeout) {
+                s.pending.pop_front();
+                s.lost++;
+            }
+        }
+    }
+
+    void handle(const mavlink_message_t &msg, Clock::time_point now) {
+        if (msg.msgid == MAVLINK_MSG_ID_HEARTBEAT && !target_sysid) {
+            mavlink_heartbeat_t hb;
+            mavlink_msg_heartbeat_decode(&msg, &hb);
+            if (hb.autopilot != MAV_AUTOPILOT_INVALID) {
+                target_sysid = msg.sysid;
+                target_compid = msg.compid;
+                std::cout << "Autopilot " << (int)msg.sysid << "/" << (int)msg.compid << " found" << std::endl;
+            }
+            return;
+        }
+        if (msg.msgid == MAVLINK_MSG_ID_DEBUG_FLOAT_ARRAY) {
+            handle_trace(msg);
+            return;
+        }
+        if (msg.msgid != MAVLINK_MSG_ID_COMMAND_ACK) {
+            return;
+        }
+
+        mavlink_command_ack_t ack;
+        mavlink_msg_command_ack_decode(&msg, &ack);
+        if (ack.result == MAV_RESULT_IN_PROGRESS) {
+            return;
+        }
+
+        // an ACK arriving after the timeout must not be taken for a newer command
+        expire(now);
+        for (auto &s : streams) {
+            if (s.kind == Kind::DropPath || s.command != ack.command || s.pending.empty()) {
+                continue;
+            }
+            auto [sent, seq] = s.pending.front();
+            s.pending.pop_front();
+            if (traced[seq].sent == sent) {
+                traced[seq].acked = now;
+            }
+            if (ack.result == MAV_RESULT_ACCEPTED) {
+                s.acked++;
+                s.latency_ms.push_back(std::chrono::duration<double, std::milli>(now - sent).count());
+            } else {
+                s.denied++;
+            }
+            return;
+        }
+    }
+
+    // Takes a command that will not be answered out of its stream, by (command, seq)
+    bool forget(uint16_t command, uint8_t seq, Clock::time_point sent, bool dropped) {
+        for (auto &s : streams) {
+            if (s.kind == Kind::DropPath || s.command != command) {
+                continue;
+            }
+            for (auto it = s.pending.begin(); it != s.pending.end(); ++it) {
+                if (it->second == seq && it->first == sent) {
+                    s.pending.erase(it);
+                    (dropped ? s.denied : s.lost)++;
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    // Splits the round trip of a command the filter reported on
+    void handle_trace(const mavlink_message_t &msg) {
+        mavlink_debug_float_array_t report;
+        mavlink_msg_debug_float_array_decode(&msg, &report);
+        if (strncmp(report.name, CMD_TRACE_REPORT_NAME, sizeof(report.name)) != 0 ||
+            report.data[CMD_TRACE_REPORT_SYSID] != cfg.sysid ||
+            report.data[CMD_TRACE_REPORT_COMPID] != cfg.compid) {
+            return;
+        }
+
+        uint8_t seq = (uint8_t)report.data[CMD_TRACE_REPORT_SEQ];
+        const Traced &t = traced[seq];
+        if (t.command != report.array_id) {
+            return;
+        }
+        trace.reports++;
+        if (!report.data[CMD_TRACE_REPORT_FORWARDED]) {
+            trace.dropped++;
+            forget(t.command, seq, t.sent, true);
+            return;
+        }
+        if (report.data[CMD_TRACE_REPORT_RESULT] == CMD_TRACE_NO_ACK) {
+            trace.no_ack++;
+            forget(t.command, seq, t.sent, false);
+            return;
+        }
+        if (t.acked == Clock::time_point{}) {
+            // the ACK was taken for an older command, or came after the timeout
+            return;
+        }
+
+        double round_trip_ms = std::chrono::duration<double, std::milli>(t.acked - t.sent).count();
+        double residence_ms = report.data[CMD_TRACE_REPORT_RESIDENCE_US] / 1000.0;
+        double px4_ms = report.data[CMD_TRACE_REPORT_PX4_US] / 1000.0;
+        trace.network_ms.push_back(round_trip_ms - residence_ms);
+        trace.filter_ms.push_back(residence_ms - px4_ms);
+        trace.px4_ms.push_back(px4_ms);
+    }
+
+    // Reads what arrived within timeout_ms, false if the connection is gone
+    bool receive(int timeout_ms) {
+        struct pollfd pfd = { fd, POLLIN, 0 };
+        if (poll(&pfd, 1, timeout_ms) < 0) {
+            return errno == EINTR;
+        }
+        if (!(pfd.revents & (POLLIN | POLLHUP | POLLERR))) {
+            return true;
+        }
+
+        uint8_t buf[4096];
+        ssize_t n = recv(fd, buf, sizeof(buf), 0);
+        if (n <= 0) {
+            std::cerr << "Connection closed" << std::endl;
+            return false;
+        }
+
+        auto now = Clock::now();
+        for (ssize_t i = 0; i < n; i++) {
+            mavlink_message_t msg;
+            if (mavlink_parse_char(MAVLINK_COMM_0, buf[i], &msg, &parse_status)) {
+                handle(msg, now);
+            }
+        }
+        return true;
+    }
+
+    const Config &cfg;
+    int fd;
+    mavlink_status_t parse_status = {};
+    uint8_t target_sysid = 0;
+    uint8_t target_compid = 0;
+    std::vector<Stream> streams;
+    std::array<Traced, 256> traced;     // by seq, the command is checked against the report
+    Breakdown trace;
+};
+
+
+int main(int argc, char** argv)
+{
+    Config cfg;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        try {
+            if (arg.rfind("tcp://", 0) == 0) {
+                if (!parse_url(arg, cfg)) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                continue;
+            }
+            if (i + 1 >= argc) {
+                usage(argv[0]);
+                return 1;
+            }
+            double val = std::stod(argv[++i]);
+
+            if (arg == "--command-long") {
+                cfg.rate_long = val;
+            } else if (arg == "--command-int") {
+                cfg.rate_int = val;
+            } else if (arg == "--drop-path") {
+                cfg.rate_drop_path = val;
+            } else if (arg == "--duration") {
+                cfg.duration = val;
+            } else if (arg == "--timeout") {
+                cfg.timeout = val;
+            } else if (arg == "--stats") {
+                cfg.stats_interval = val;
+            } else {
+                usage(argv[0]);
+                return 1;
+            }
+        } catch (...) {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (cfg.stats_interval <= 0) {
+        cfg.stats_interval = 1.0;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    int sockfd = get_socket(cfg.addr, cfg.port);
+
+    LoadGen gen(cfg, sockfd);
+    if (!gen.find_target(10.0)) {
+        std::cerr << "Timed out waiting for the autopilot heartbeat" << std::endl;
+        return 1;
+    }
+
+    bool ok = gen.run();
+    gen.report();
+    close(sockfd);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,825 @@
+/*
+ * Copyright (C) 2023-2024, HENSOLDT Cyber GmbH
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * For commercial licensing, contact: info.cyber@hensoldt.net
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "system_config.h"
+
+#include "common/mavlink.h"
+
+using Clock = std::chrono::steady_clock;
+
+
+// Stands in for PX4 on the host side of the SerialFilter, one connection at a time
+struct Config {
+    std::string addr = PX4_DRONE_ADDR;
+    uint16_t port = PX4_DRONE_PORT;
+    uint8_t sysid = 1;
+    uint8_t compid = MAV_COMP_ID_AUTOPILOT1;
+    unsigned int params = 1000;
+    double stats_interval = 1.0;
+    size_t max_pending = 256 * 1024;
+    std::map<std::string, double> rates;
+};
+
+
+struct Stream {
+    const char *name;
+    uint32_t msgid;
+    double rate_hz;
+    double default_hz = 0;      // rate from the command line, restored by interval 0
+    Clock::duration period = {};
+    Clock::time_point next = {};
+    uint64_t sent = 0;
+};
+
+
+// Bytes waiting for the socket. Sent bytes only advance the read offset, the
+// buffer is compacted once most of it was sent.
+class OutBuffer {
+public:
+    const uint8_t *data() const { return buf.data() + head; }
+    size_t size() const { return buf.size() - head; }
+    bool empty() const { return head == buf.size(); }
+
+    void append(const uint8_t *p, size_t len) { buf.insert(buf.end(), p, p + len); }
+
+    void consume(size_t n) {
+        head += n;
+        if (head == buf.size()) {
+            buf.clear();
+            head = 0;
+        } else if (head >= 64 * 1024 && head >= buf.size() / 2) {
+            buf.erase(buf.begin(), buf.begin() + head);
+            head = 0;
+        }
+    }
+
+    void clear() {
+        buf.clear();
+        head = 0;
+    }
+
+private:
+    std::vector<uint8_t> buf;
+    size_t head = 0;
+};
+
+
+struct Stats {
+    uint64_t rx_msgs = 0;
+    uint64_t rx_bytes = 0;
+    uint64_t tx_msgs = 0;
+    uint64_t tx_bytes = 0;
+    uint64_t acks = 0;
+    uint64_t stream_drops = 0;
+    uint64_t rx_drops = 0;
+};
+
+
+void usage(const std::string& bin_name)
+{
+    std::cerr << "Usage : " << bin_name << " [options]\n"
+              << " --addr <ip>           address to listen on (default " PX4_DRONE_ADDR ")\n"
+              << " --port <port>         port to listen on (default " << PX4_DRONE_PORT << ")\n"
+              << " --sysid <id>          system id of the vehicle (default 1)\n"
+              << " --params <n>          number of parameters (default 1000)\n"
+              << " --rate <stream>=<hz>  telemetry rate, 0 disables the stream\n"
+              << " --stats <s>           statistics interval in seconds (default 1)\n"
+              << " --max-pending <bytes> telemetry is skipped while more is unsent (default 262144)\n"
+              << "Streams: heartbeat sys_status attitude attitude_quaternion highres_imu\n"
+              << "         local_position_ned global_position_int gps_raw_int vfr_hud\n"
+              << "         altitude vibration odometry\n";
+}
+
+
+class Vehicle {
+public:
+    Vehicle(const Config &config) : cfg(config), boot(Clock::now()) {
+        streams = {
+            { "heartbeat",           MAVLINK_MSG_ID_HEARTBEAT,           1 },
+            { "sys_status",          MAVLINK_MSG_ID_SYS_STATUS,          1 },
+            { "attitude",            MAVLINK_MSG_ID_ATTITUDE,            50 },
+            { "attitude_quaternion", MAVLINK_MSG_ID_ATTITUDE_QUATERNION, 50 },
+            { "highres_imu",         MAVLINK_MSG_ID_HIGHRES_IMU,         50 },
+            { "local_position_ned",  MAVLINK_MSG_ID_LOCAL_POSITION_NED,  30 },
+            { "global_position_int", MAVLINK_MSG_ID_GLOBAL_POSITION_INT, 30 },
+            { "gps_raw_int",         MAVLINK_MSG_ID_GPS_RAW_INT,         5 },
+            { "vfr_hud",             MAVLINK_MSG_ID_VFR_HUD,             10 },
+            { "altitude",            MAVLINK_MSG_ID_ALTITUDE,            10 },
+            { "vibration",           MAVLINK_MSG_ID_VIBRATION,           0 },
+            { "odometry",            MAVLINK_MSG_ID_ODOMETRY,            0 },
+        };
+        for (auto &s : streams) {
+            auto it = cfg.rates.find(s.name);
+            s.default_hz = it != cfg.rates.end() ? it->second : s.rate_hz;
+            set_rate(s, s.default_hz);
+        }
+
+        param_values.resize(cfg.params);
+        for (unsigned int i = 0; i < cfg.params; i++) {
+            param_values[i] = (float)i;
+        }
+    }
+
+    bool known_stream(const std::string &name) const {
+        for (auto &s : streams) {
+            if (name == s.name) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Start of a connection: streams restart, parameters and the missions are kept
+    void reset() {
+        auto now = Clock::now();
+        for (auto &s : streams) {
+            s.next = now;
+            s.sent = 0;
+        }
+        param_next = param_end = 0;
+        upload_expected = upload_count = 0;
+        out.clear();
+        parse_status = {};
+    }
+
+    void receive(const uint8_t *buf, size_t len) {
+        stats.rx_bytes += len;
+        for (size_t i = 0; i < len; i++) {
+            mavlink_message_t msg;
+            if (mavlink_parse_char(MAVLINK_COMM_0, buf[i], &msg, &parse_status)) {
+                stats.rx_msgs++;
+                handle(msg);
+            }
+        }
+        stats.rx_drops = parse_status.packet_rx_drop_count;
+    }
+
+    // Sends what is due, returns the time of the next stream sample
+    Clock::time_point update(Clock::time_point now) {
+        Clock::time_point next = now + std::chrono::seconds(1);
+
+        for (auto &s : streams) {
+            if (s.rate_hz <= 0) {
+                continue;
+            }
+            if (s.next <= now) {
+                if (out.size() < cfg.max_pending) {
+                    send_stream(s.msgid, now);
+                    s.sent++;
+                } else {
+                    stats.stream_drops++;
+                }
+                s.next += s.period;
+                // a stream that fell behind does not send a burst to catch up
+                if (s.next < now) {
+                    s.next = now + s.period;
+                }
+            }
+            if (s.next < next) {
+                next = s.next;
+            }
+        }
+
+        // parameter lists go out as the connection keeps up
+        while (param_next < param_end && out.size() < cfg.max_pending) {
+            send_param(param_next++);
+        }
+        return next;
+    }
+
+    OutBuffer out;
+    Stats stats;
+
+private:
+    void set_rate(Stream &s, double hz) {
+        s.rate_hz = hz;
+        s.period = hz > 0 ? std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / hz))
+                          : Clock::duration::zero();
+        s.next = Clock::now();
+    }
+
+    uint32_t time_boot_ms(Clock::time_point now) const {
+        return (uint32_t)std::chrono::duration_cast<std::chrono::milliseconds>(now - boot).count();
+    }
+
+    uint64_t time_usec(Clock::time_point now) const {
+        return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(now - boot).count();
+    }
+
+    void send(mavlink_message_t &msg) {
+        uint8_t buf[MAVLINK_MAX_PACKET_LEN];
+        uint16_t len = mavlink_msg_to_send_buffer(buf, &msg);
+        out.append(buf, len);
+        stats.tx_msgs++;
+        stats.tx_bytes += len;
+    }
+
+    void send_heartbeat() {
+        mavlink_heartbeat_t hb = {};
+        hb.type = MAV_TYPE_QUADROTOR;
+        hb.autopilot = MAV_AUTOPILOT_PX4;
+        hb.base_mode = MAV_MODE_FLAG_CUSTOM_MODE_ENABLED | (armed ? MAV_MODE_FLAG_SAFETY_ARMED : 0);
+        hb.system_status = armed ? MAV_STATE_ACTIVE : MAV_STATE_STANDBY;
+        hb.mavlink_version = 3;
+
+        mavlink_message_t msg;
+        mavlink_msg_heartbeat_encode_chan(cfg.sysid, cfg.compid, MAVLINK_COMM_1, &msg, &hb);
+        send(msg);
+    }
+
+    // Slowly circles the home position at the requested altitude
+    void send_stream(uint32_t msgid, Clock::time_point now) {
+        double t = std::chrono::duration<double>(now - boot).count();
+        float x = (float)(10.0 * std::cos(t / 10.0));
+        float y = (float)(10.0 * std::sin(t / 10.0));
+        float z = -altitude;
+        int32_t lat = 480550508 + (int32_t)(x * 90);
+        int32_t lon = 116521782 + (int32_t)(y * 134);
+        mavlink_message_t msg;
+
+        switch (msgid) {
+        case MAVLINK_MSG_ID_HEARTBEAT:
+            send_heartbeat();
+            return;
+
+        case MAVLINK_MSG_ID_SYS_STATUS: {
+            mavlink_sys_status_t m = {};
+            m.onboard_control_sensors_present = 0x3fffff;
+            m.onboard_control_sensors_enabled = 0x3fffff;
+            m.onboard_control_sensors_health = 0x3fffff;
+            m.voltage_battery = 16000;
+            m.battery_remaining = 90;
+            mavlink_msg_sys_status_encode_chan(cfg.sysid, cfg.compid, MAVLINK_COMM_1, &msg, &m);
+            break;
+        }
+        case MAVLINK_MSG_ID_ATTITUDE: {
+            mavlink_attitude_t m = {};
+            m.time_boot_ms = time_boot_ms(now);
+            m.yaw = (float)std::fmod(t / 10.0, 2 * M_PI);
+            m.yawspeed = 0.1f;
+            mavlink_msg_attitude_encode_chan(cfg.sysid, cfg.compid, MAVLINK_COMM_1, &msg, &m);
+            break;
+        }
+        case MAVLINK_MSG_ID_ATTITUDE_QUATERNION: {
+            mavlink_attitude_quaternion_t m = {};
+            m.time_boot_ms = time_boot_ms(now);
+            m.q1 = (float)std::cos(t / 20.0);
+            m.q4 = (float)std::sin(t / 20.0);
+            m.yawspeed = 0.1f;
+            mavlink_msg_attitude_quaternion_encode_chan(cfg.sysid, cfg.compid, MAVLINK_COMM_1, &msg, &m);
+            break;
+        }
+        case MAVLINK_MSG_ID_HIGHRES_IMU: {
+            mavlink_highres_imu_t m = {};
+            m.time_usec = time_usec(now);
+            m.zacc = -9.81f;
+            m.zgyro = 0.1f;
+            m.abs_pressure = 1013.25f;
+            m.temperature = 20.0f;
+            m.fields_updated = 0x1fff;
+            mavlink_msg_highres_imu_encode_chan(cfg.sysid, cfg.compid, MAVLINK_COMM_1, &msg, &m);
+            break;
+        }
+        case MAVLINK_MSG_ID_LOCAL_POSITION_NED: {
+            mavlink_local_position_ned_t m = {};
+            m.time_boot_ms = time_boot_ms(now);
+            m.x = x;
+            m.y = y;
+            m.z = z;
+            mavlink_msg_local_position_ned_encode_chan(cfg.sysid, cfg.compid, MAVLINK_COMM_1, &msg, &m);
+            break;
+        }
+        case MAVLINK_MSG_ID_GLOBAL_POSITION_INT: {
+            mavlink_global_position_int_t m = {};
+            m.time_boot_ms = time_boot_ms(now);
+            m.lat = lat;
+            m.lon = lon;
+            m.alt = 500000 + (int32_t)(altitude * 1000);
+            m.relative_alt = (int32_t)(altitude * 1000);
+            m.hdg = UINT16_MAX;
+            mavlink_msg_global_position_int_encode_chan(cfg.sysid, cfg.compid, MAVLINK_COMM_1, &msg, &m);
+            break;
+        }
+        case MAVLINK_MSG_ID_GPS_RAW_INT: {
+            mavlink_gps_raw_int_t m = {};
+            m.time_usec = time_usec(now);
+            m.fix_type = GPS_FIX_TYPE_3D_FIX;
+            m.lat = lat;
+            m.lon = lon;
+            m.alt = 500000 + (int32_t)(altitude * 1000);
+            m.eph = 80;
+            m.epv = 120;
+            m.cog = UINT16_MAX;
+            m.satellites_visible = 12;
+            mavlink_msg_gps_raw_int_encode_chan(cfg.sysid, cfg.compid, MAVLINK_COMM_1, &msg, &m);
+            break;
+        }
+        case MAVLINK_MSG_ID_VFR_HUD: {
+            mavlink_vfr_hud_t m = {};
+            m.groundspeed = 1.0f;
+            m.alt = 500.0f + altitude;
+            m.throttle = armed ? 50 : 0;
+            mavlink_msg_vfr_hud_encode_chan(cfg.sysid, cfg.compid, MAVLINK_COMM_1, &msg, &m);
+            break;
+        }
+        case MAVLINK_MSG_ID_ALTITUDE: {
+            mavlink_altitude_t m = {};
+            m.time_usec = time_usec(now);
+            m.altitude_amsl = 500.0f + altitude;
+            m.altitude_relative = altitude;
+            m.altitude_local = altitude;
+            mavlink_msg_altitude_encode_chan(cfg.sysid, cfg.compid, MAVLINK_COMM_1, &msg, &m);
+            break;
+        }
+        case MAVLINK_MSG_ID_VIBRATION: {
+            mavlink_vibration_t m = {};
+            m.time_usec = time_usec(now);
+            m.vibration_x = m.vibration_y = m.vibration_z = 0.01f;
+            mavlink_msg_vibration_encode_chan(cfg.sysid, cfg.compid, MAVLINK_COMM_1, &msg, &m);
+            break;
+        }
+        case MAVLINK_MSG_ID_ODOMETRY: {
+            mavlink_odometry_t m = {};
+            m.time_usec = time_usec(now);
+            m.frame_id = MAV_FRAME_LOCAL_NED;
+            m.child_frame_id = MAV_FRAME_BODY_FRD;
+            m.x = x;
+            m.y = y;
+            m.z = z;
+            m.q[0] = 1.0f;
+            m.pose_covariance[0] = NAN;
+            m.velocity_covariance[0] = NAN;
+            mavlink_msg_odometry_encode_chan(cfg.sysid, cfg.compid, MAVLINK_COMM_1, &msg, &m);
+            break;
+        }
+        default:
+            return;
+        }
+        send(msg);
+    }
+
+    void send_param(uint16_t index) {
+        mavlink_param_value_t pv = {};
+        snprintf(pv.param_id, sizeof(pv.param_id), "SIM_PARAM_%04u", (unsigned int)index);
+        pv.param_value = param_values[index];
+        pv.param_type = MAV_PARAM_TYPE_REAL32;
+        pv.param_count = (uint16_t)param_values.size();
+        pv.param_index = index;
+
+        mavlink_message_t msg;
+        mavlink_msg_param_value_encode_chan(cfg.sysid, cfg.compid, MAVLINK_COMM_1, &msg, &pv);
+        send(msg);
+    }
+
+    int find_param(const char *id) const {
+        unsigned int index;
+        char name[MAVLINK_MSG_PARAM_VALUE_FIELD_PARAM_ID_LEN + 1] = {};
+        memcpy(name, id, MAVLINK_MSG_PARAM_VALUE_FIELD_PARAM_ID_LEN);
+        if (sscanf(name, "SIM_PARAM_%u", &index) != 1 || index >= param_values.size()) {
+            return -1;
+        }
+        return (int)index;
+    }
+
+    void send_command_ack(const mavlink_message_t &req, uint16_t command, uint8_t result) {
+        mavlink_command_ack_t ack = {};
+        ack.command = command;
+        ack.result = result;
+        ack.target_system = req.sysid;
+        ack.target_component = req.compid;
+
+        mavlink_message_t msg;
+        mavlink_msg_command_ack_encode_chan(cfg.sysid, cfg.compid, MAVLINK_COMM_1, &msg, &ack);
+        send(msg);
+        stats.acks++;
+    }
+
+    void send_mission_ack(const mavlink_message_t &req, uint8_t type, uint8_t mission_type) {
+        mavlink_mission_ack_t ack = {};
+        ack.target_system = req.sysid;
+        ack.target_component = req.compid;
+        ack.type = type;
+        ack.mission_type = mission_type;
+
+        mavlink_message_t msg;
+        mavlink_msg_mission_ack_encode_chan(cfg.sysid, cfg.compid, MAVLINK_COMM_1, &msg, &ack);
+        send(msg);
+    }
+
+    void send_mission_request(const mavlink_message_t &req, uint16_t seq, uint8_t mission_type) {
+        mavlink_mission_request_int_t r = {};
+        r.target_system = req.sysid;
+        r.target_component = req.compid;
+        r.seq = seq;
+        r.mission_type = mission_type;
+
+        mavlink_message_t msg;
+        mavlink_msg_mission_request_int_encode_chan(cfg.sysid, cfg.compid, MAVLINK_COMM_1, &msg, &r);
+        send(msg);
+    }
+
+    void send_mission_item(const mavlink_message_t &req, uint16_t seq, uint8_t mission_type) {
+        const auto &mission = missions[mission_type];
+        if (seq >= mission.size()) {
+            send_mission_ack(req, MAV_MISSION_INVALID_SEQUENCE, mission_type);
+            return;
+        }
+        mavlink_mission_item_int_t item = mission[seq];
+        item.target_system = req.sysid;
+        item.target_component = req.compid;
+        item.seq = seq;
+
+        mavlink_message_t msg;
+        mavlink_msg_mission_item_int_encode_chan(cfg.sysid, cfg.compid, MAVLINK_COMM_1, &msg, &item);
+        send(msg);
+    }
+
+    uint8_t handle_command(uint16_t command, const float param[7]) {
+        switch (command) {
+        case MAV_CMD_COMPONENT_ARM_DISARM:
+            armed = param[0] > 0.5f;
+            if (!armed) {
+                altitude = 0;
+            }
+            return MAV_RESULT_ACCEPTED;
+        case MAV_CMD_NAV_TAKEOFF:
+            if (!armed) {
+                return MAV_RESULT_TEMPORARILY_REJECTED;
+            }
+            altitude = std::isnan(param[6]) ? 2.5f : param[6];
+            return MAV_RESULT_ACCEPTED;
+        case MAV_CMD_NAV_LAND:
+        case MAV_CMD_NAV_RETURN_TO_LAUNCH:
+            altitude = 0;
+            return MAV_RESULT_ACCEPTED;
+        case MAV_CMD_SET_MESSAGE_INTERVAL:
+            for (auto &s : streams) {
+                if (s.msgid == (uint32_t)param[0]) {
+                    // -1 disables the stream, 0 restores the default
+                    if (param[1] < 0) {
+                        set_rate(s, 0);
+                    } else if (param[1] > 0) {
+                        set_rate(s, 1e6 / param[1]);
+                    } else {
+                        set_rate(s, s.default_hz);
+                    }
+                    return MAV_RESULT_ACCEPTED;
+                }
+            }
+            return MAV_RESULT_UNSUPPORTED;
+        case MAV_CMD_REQUEST_MESSAGE:
+            for (auto &s : streams) {
+                if (s.msgid == (uint32_t)param[0]) {
+                    send_stream(s.msgid, Clock::now());
+                    return MAV_RESULT_ACCEPTED;
+                }
+            }
+            return MAV_RESULT_UNSUPPORTED;
+        default:
+            // everything else is accepted, the stand-in does not fly
+            return MAV_RESULT_ACCEPTED;
+        }
+    }
+
+    void handle(const mavlink_message_t &msg) {
+        switch (msg.msgid) {
+        case MAVLINK_MSG_ID_COMMAND_LONG: {
+            mavlink_command_long_t c;
+            mavlink_msg_command_long_decode(&msg, &c);
+            float param[7] = { c.param1, c.param2, c.param3, c.param4, c.param5, c.param6, c.param7 };
+            send_command_ack(msg, c.command, handle_command(c.command, param));
+            break;
+        }
+        case MAVLINK_MSG_ID_COMMAND_INT: {
+            mavlink_command_int_t c;
+            mavlink_msg_command_int_decode(&msg, &c);
+            float param[7] = { c.param1, c.param2, c.param3, c.param4, (float)c.x, (float)c.y, c.z };
+            send_command_ack(msg, c.command, handle_command(c.command, param));
+            break;
+        }
+        case MAVLINK_MSG_ID_PARAM_REQUEST_LIST:
+            param_next = 0;
+            param_end = (uint16_t)param_values.size();
+            break;
+        case MAVLINK_MSG_ID_PARAM_REQUEST_READ: {
+            mavlink_param_request_read_t r;
+            mavlink_msg_param_request_read_decode(&msg, &r);
+            int index = r.param_index >= 0 ? r.param_index : find_param(r.param_id);
+            if (index >= 0 && index < (int)param_values.size()) {
+                send_param((uint16_t)index);
+            }
+            break;
+        }
+        case MAVLINK_MSG_ID_PARAM_SET: {
+            mavlink_param_set_t p;
+            mavlink_msg_param_set_decode(&msg, &p);
+            int index = find_param(p.param_id);
+            if (index >= 0) {
+                param_values[index] = p.param_value;
+                send_param((uint16_t)index);
+            }
+            break;
+        }
+        case MAVLINK_MSG_ID_MISSION_COUNT: {
+            mavlink_mission_count_t c;
+            mavlink_msg_mission_count_decode(&msg, &c);
+            upload_count = c.count;
+            upload_expected = 0;
+            upload_type = c.mission_type;
+            upload.assign(c.count, mavlink_mission_item_int_t{});
+            if (c.count == 0) {
+                missions[c.mission_type].clear();
+                send_mission_ack(msg, MAV_MISSION_ACCEPTED, c.mission_type);
+            } else {
+                send_mission_request(msg, 0, c.mission_type);
+            }
+            break;
+        }
+        case MAVLINK_MSG_ID_MISSION_ITEM_INT: {
+            mavlink_mission_item_int_t item;
+            mavlink_msg_mission_item_int_decode(&msg, &item);
+            if (upload_expected >= upload_count || item.seq != upload_expected ||
+                item.mission_type != upload_type) {
+                // a repeated item: ask for the one that is missing
+                if (upload_expected < upload_count) {
+                    send_mission_request(msg, upload_expected, item.mission_type);
+                }
+                break;
+            }
+            upload[upload_expected++] = item;
+            if (upload_expected < upload_count) {
+                send_mission_request(msg, upload_expected, item.mission_type);
+            } else {
+                missions[upload_type].swap(upload);
+                send_mission_ack(msg, MAV_MISSION_ACCEPTED, item.mission_type);
+            }
+            break;
+        }
+        case MAVLINK_MSG_ID_MISSION_REQUEST_LIST: {
+            mavlink_mission_count_t c = {};
+            c.target_system = msg.sysid;
+            c.target_component = msg.compid;
+            c.mission_type = mavlink_msg_mission_request_list_get_mission_type(&msg);
+            c.count = (uint16_t)missions[c.mission_type].size();
+
+            mavlink_message_t out_msg;
+            mavlink_msg_mission_count_encode_chan(cfg.sysid, cfg.compid, MAVLINK_COMM_1, &out_msg, &c);
+            send(out_msg);
+            break;
+        }
+        case MAVLINK_MSG_ID_MISSION_REQUEST_INT:
+            send_mission_item(msg, mavlink_msg_mission_request_int_get_seq(&msg),
+                              mavlink_msg_mission_request_int_get_mission_type(&msg));
+            break;
+        case MAVLINK_MSG_ID_MISSION_REQUEST:
+            send_mission_item(msg, mavlink_msg_mission_request_get_seq(&msg),
+                              mavlink_msg_mission_request_get_mission_type(&msg));
+            break;
+        case MAVLINK_MSG_ID_MISSION_CLEAR_ALL: {
+            uint8_t mission_type = mavlink_msg_mission_clear_all_get_mission_type(&msg);
+            if (mission_type == MAV_MISSION_TYPE_ALL) {
+                missions.clear();
+            } else {
+                missions[mission_type].clear();
+            }
+            send_mission_ack(msg, MAV_MISSION_ACCEPTED, mission_type);
+            break;
+        }
+        case MAVLINK_MSG_ID_TIMESYNC: {
+            mavlink_timesync_t ts;
+            mavlink_msg_timesync_decode(&msg, &ts);
+            if (ts.tc1 == 0) {
+                ts.tc1 = (int64_t)time_usec(Clock::now()) * 1000;
+                mavlink_message_t out_msg;
+                mavlink_msg_timesync_encode_chan(cfg.sysid, cfg.compid, MAVLINK_COMM_1, &out_msg, &ts);
+                send(out_msg);
+            }
+            break;
+        }
+        case MAVLINK_MSG_ID_PING: {
+            mavlink_ping_t ping;
+            mavlink_msg_ping_decode(&msg, &ping);
+            if (ping.target_system == 0) {
+                ping.target_system = msg.sysid;
+                ping.target_component = msg.compid;
+                mavlink_message_t out_msg;
+                mavlink_msg_ping_encode_chan(cfg.sysid, cfg.compid, MAVLINK_COMM_1, &out_msg, &ping);
+                send(out_msg);
+            }
+            break;
+        }
+        default:
+            break;
+        }
+    }
+
+    const Config &cfg;
+    Clock::time_point boot;
+    mavlink_status_t parse_status = {};
+
+    std::vector<Stream> streams;
+
+    std::vector<float> param_values;
+    uint16_t param_next = 0;
+    uint16_t param_end = 0;
+
+    // plan, fence and rally points are kept apart like PX4 does, by mission_type
+    std::map<uint8_t, std::vector<mavlink_mission_item_int_t>> missions;
+    std::vector<mavlink_mission_item_int_t> upload;
+    uint8_t upload_type = MAV_MISSION_TYPE_MISSION;
+    uint16_t upload_count = 0;
+    uint16_t upload_expected = 0;
+
+    bool armed = false;
+    float altitude = 0;
+};
+
+
+int listen_socket(const Config &cfg) {
+    struct sockaddr_in server_addr = {};
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(cfg.port);
+    server_addr.sin_addr.s_addr = inet_addr(cfg.addr.c_str());
+
+    int sock;
+    if ((sock = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
+        std::cerr << "Error: socket creation failed" << std::endl;
+        exit(-1);
+    }
+
+    int one = 1;
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    if (bind(sock, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0 ||
+        listen(sock, 1) < 0) {
+        std::cerr << "Error: listening on IP: " << cfg.addr
+                  << " Port: " << cfg.port << " failed: " << strerror(errno) << std::endl;
+        exit(-1);
+    }
+    return sock;
+}
+
+
+void print_stats(const Stats &now, const Stats &last, double seconds, size_t pending) {
+    printf("rx %7.0f msg/s %9.0f B/s | tx %7.0f msg/s %9.0f B/s | acks %5.0f/s | "
+           "skipped %llu | rx drops %llu | pending %zu B\n",
+           (now.rx_msgs - last.rx_msgs) / seconds,
+           (now.rx_bytes - last.rx_bytes) / seconds,
+           (now.tx_msgs - last.tx_msgs) / seconds,
+           (now.tx_bytes - last.tx_bytes) / seconds,
+           (now.acks - last.acks) / seconds,
+           (unsigned long long)now.stream_drops,
+           (unsigned long long)now.rx_drops,
+           pending);
+    fflush(stdout);
+}
+
+
+// Relays until the SerialFilter disconnects
+void serve(int fd, Vehicle &vehicle, const Config &cfg) {
+    auto stats_interval = std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>(cfg.stats_interval));
+    auto next_stats = Clock::now() + stats_interval;
+    Stats last = vehicle.stats;
+
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    vehicle.reset();
+
+    for (;;) {
+        auto now = Clock::now();
+        auto next = std::min(vehicle.update(now), next_stats);
+
+        if (now >= next_stats) {
+            print_stats(vehicle.stats, last, cfg.stats_interval, vehicle.out.size());
+            last = vehicle.stats;
+            next_stats += stats_interval;
+        }
+
+        // write as much as the socket takes, the rest waits for POLLOUT
+        if (!vehicle.out.empty()) {
+            ssize_t n = send(fd, vehicle.out.data(), vehicle.out.size(), MSG_NOSIGNAL);
+            if (n > 0) {
+                vehicle.out.consume((size_t)n);
+            } else if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+                std::cerr << "send failed: " << strerror(errno) << std::endl;
+                return;
+            }
+        }
+
+        struct pollfd pfd = { fd, POLLIN, 0 };
+        if (!vehicle.out.empty()) {
+            pfd.events |= POLLOUT;
+        }
+        auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(next - Clock::now()).count();
+        if (poll(&pfd, 1, wait > 0 ? (int)wait : 0) < 0 && errno != EINTR) {
+            std::cerr << "poll failed: " << strerror(errno) << std::endl;
+            return;
+        }
+
+        if (pfd.revents & (POLLIN | POLLHUP | POLLERR)) {
+            uint8_t buf[4096];
+            ssize_t n = recv(fd, buf, sizeof(buf), 0);
+            if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+                std::cout << "Connection closed" << std::endl;
+                return;
+            }
+            if (n > 0) {
+                vehicle.receive(buf, (size_t)n);
+            }
+        }
+    }
+}
+
+
+int main(int argc, char** argv)
+{
+    Config cfg;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            usage(argv[0]);
+            return 1;
+        }
+        std::string val = argv[++i];
+
+        if (arg == "--addr") {
+            cfg.addr = val;
+        } else if (arg == "--port") {
+            cfg.port = (uint16_t)std::stoi(val);
+        } else if (arg == "--sysid") {
+            cfg.sysid = (uint8_t)std::stoi(val);
+        } else if (arg == "--params") {
+            cfg.params = std::min(std::stoul(val), 65535ul);
+        } else if (arg == "--stats") {
+            cfg.stats_interval = std::stod(val);
+        } else if (arg == "--max-pending") {
+            cfg.max_pending = std::stoul(val);
+        } else if (arg == "--rate" && val.find('=') != std::string::npos) {
+            cfg.rates[val.substr(0, val.find('='))] = std::stod(val.substr(val.find('=') + 1));
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (cfg.stats_interval <= 0) {
+        cfg.stats_interval = 1.0;
+    }
+
+    Vehicle vehicle(cfg);
+    for (auto &r : cfg.rates) {
+        if (!vehicle.known_stream(r.first)) {
+            std::cerr << "Unknown stream: " << r.first << std::endl;
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    int sock = listen_socket(cfg);
+    std::cout << "PX4 stand-in listening on IP: " << cfg.addr
+              << " Port: " << cfg.port << std::endl;
+
+    for (;;) {
+        struct sockaddr_in client_addr;
+        socklen_t addr_len = sizeof(client_addr);
+        int fd = accept(sock, (struct sockaddr *)&client_addr, &addr_len);
+        if (fd < 0) {
+            std::cerr << "accept failed: " << strerror(errno) << std::endl;
+            continue;
+        }
+        std::cout << "Connection from " << inet_ntoa(client_addr.sin_addr)
+                  << ":" << ntohs(client_addr.sin_port) << std::endl;
+
+        serve(fd, vehicle, cfg);
+        close(fd);
+    }
+    return 0;
+}
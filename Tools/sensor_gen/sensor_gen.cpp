@@ -0,0 +1,367 @@
+/*
+ * Copyright (C) 2023-2024, HENSOLDT Cyber GmbH
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * For commercial licensing, contact: info.cyber@hensoldt.net
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "system_config.h"
+
+using Clock = std::chrono::steady_clock;
+
+// Records due at the same time go out in one write of at most this size
+constexpr size_t WRITE_BUF_SIZE = 64 * 1024;
+// Limits of --topic, a record always fits into the write buffer
+constexpr size_t MAX_RECORD_SIZE = 16 * 1024;
+constexpr size_t MAX_TOPIC_NAME = 64;
+
+
+// Stands in for the gazebo_proxy: sensor records in JSON, each followed by \x07
+enum class Sensor {
+    NavSat,
+    Imu,
+    AirPressure,
+    Magnetometer,
+};
+
+
+struct Topic {
+    std::string name;
+    Sensor sensor;
+    double rate_hz;
+    size_t size;            // records are padded to at least this many bytes
+    Clock::time_point next;
+    uint64_t seq;
+    uint64_t sent;
+    uint64_t sent_last;
+    double max_lag_ms;
+};
+
+
+struct Config {
+    std::string addr = PX4_TRENTOS_ADDR;
+    uint16_t port = PX4_TRENTOS_PORT_SIMCOUPLER;
+    std::vector<Topic> topics;
+    double stats_interval = 1.0;
+    double duration = 0;
+    double ramp_step = 0;
+    double ramp_factor = 2.0;
+};
+
+
+void usage(const std::string& bin_name)
+{
+    std::cerr << "Usage : " << bin_name << " [options]\n"
+              << " --addr <ip>                  SimCoupler address (default " PX4_TRENTOS_ADDR ")\n"
+              << " --port <port>                SimCoupler port (default " << PX4_TRENTOS_PORT_SIMCOUPLER << ")\n"
+              << " --topic <name>=<hz>[:<size>] topic to send, repeatable (default navsat=5),\n"
+              << "                              size at most " << MAX_RECORD_SIZE << " bytes\n"
+              << " --stats <s>                  statistics interval in seconds (default 1)\n"
+              << " --duration <s>               stop after this time, 0 runs forever (default 0)\n"
+              << " --ramp <s>[:<factor>]        multiply all rates by factor (default 2) every s seconds\n"
+              << "Sensors are chosen by the topic name: navsat, imu, air_pressure, magnetometer,\n"
+              << "other names send navsat records. Use e.g. imu_1=1000 for additional topics.\n";
+}
+
+
+Sensor sensor_of(const std::string &name) {
+    if (name.rfind("imu", 0) == 0) {
+        return Sensor::Imu;
+    } else if (name.rfind("air_pressure", 0) == 0) {
+        return Sensor::AirPressure;
+    } else if (name.rfind("magnetometer", 0) == 0) {
+        return Sensor::Magnetometer;
+    }
+    return Sensor::NavSat;
+}
+
+
+bool parse_topic(const std::string &arg, Topic &topic) {
+    size_t eq = arg.find('=');
+    if (eq == std::string::npos || eq == 0 || eq > MAX_TOPIC_NAME) {
+        return false;
+    }
+    size_t colon = arg.find(':', eq);
+
+    topic = Topic{};
+    topic.name = arg.substr(0, eq);
+    topic.sensor = sensor_of(topic.name);
+    try {
+        topic.rate_hz = std::stod(arg.substr(eq + 1, colon - eq - 1));
+        topic.size = colon == std::string::npos ? 0 : std::stoul(arg.substr(colon + 1));
+    } catch (...) {
+        return false;
+    }
+    return topic.rate_hz > 0 && topic.size <= MAX_RECORD_SIZE;
+}
+
+
+// Same layout as the gz messages the gazebo_proxy converts to JSON, len must
+// leave room for the record. Returns the number of bytes written.
+size_t format_record(char *buf, size_t len, const Topic &topic, double t) {
+    long sec = (long)t;
+    long nsec = (long)((t - sec) * 1e9);
+    int n;
+
+    // the closing } and the delimiter follow the formatted part
+    len -= 2;
+
+    switch (topic.sensor) {
+    case Sensor::Imu:
+        n = snprintf(buf, len,
+                     "{\"header\":{\"stamp\":{\"sec\":%ld,\"nsec\":%ld},\"data\":[{\"key\":\"seq\",\"value\":[\"%llu\"]}]},"
+                     "\"entityName\":\"%s\",\"orientation\":{\"x\":0,\"y\":0,\"z\":%.6f,\"w\":%.6f},"
+                     "\"angularVelocity\":{\"x\":0.001,\"y\":-0.002,\"z\":0.1},"
+                     "\"linearAcceleration\":{\"x\":0.01,\"y\":-0.02,\"z\":9.81}",
+                     sec, nsec, (unsigned long long)topic.seq, topic.name.c_str(),
+                     std::sin(t / 20.0), std::cos(t / 20.0));
+        break;
+    case Sensor::AirPressure:
+        n = snprintf(buf, len,
+                     "{\"header\":{\"stamp\":{\"sec\":%ld,\"nsec\":%ld},\"data\":[{\"key\":\"seq\",\"value\":[\"%llu\"]}]},"
+                     "\"pressure\":%.3f,\"variance\":0.01",
+                     sec, nsec, (unsigned long long)topic.seq, 95461.0 + std::sin(t));
+        break;
+    case Sensor::Magnetometer:
+        n = snprintf(buf, len,
+                     "{\"header\":{\"stamp\":{\"sec\":%ld,\"nsec\":%ld},\"data\":[{\"key\":\"seq\",\"value\":[\"%llu\"]}]},"
+                     "\"fieldTesla\":{\"x\":0.000021,\"y\":0.0000012,\"z\":-0.000043}",
+                     sec, nsec, (unsigned long long)topic.seq);
+        break;
+    default:
+        n = snprintf(buf, len,
+                     "{\"header\":{\"stamp\":{\"sec\":%ld,\"nsec\":%ld},\"data\":[{\"key\":\"seq\",\"value\":[\"%llu\"]}]},"
+                     "\"latitudeDeg\":%.12f,\"longitudeDeg\":%.12f,\"altitude\":%.3f,"
+                     "\"velocityEast\":0.1,\"velocityNorth\":0.1,\"frameId\":\"%s\"",
+                     sec, nsec, (unsigned long long)topic.seq,
+                     48.05502700126609 + 0.0001 * std::cos(t / 10.0),
+                     11.652206077452211 + 0.0001 * std::sin(t / 10.0),
+                     500.0 + std::sin(t / 5.0), topic.name.c_str());
+        break;
+    }
+    size_t pos = std::min((size_t)std::max(n, 0), len - 1);
+
+    // padding up to the requested size, the closing "} and the delimiter included
+    const char pad_key[] = ",\"padding\":\"";
+    if (topic.size > pos + 3 + sizeof(pad_key) && topic.size <= len + 2) {
+        memcpy(&buf[pos], pad_key, sizeof(pad_key) - 1);
+        pos += sizeof(pad_key) - 1;
+        size_t pad = topic.size - pos - 3;
+        memset(&buf[pos], 'x', pad);
+        pos += pad;
+        buf[pos++] = '"';
+    }
+    buf[pos++] = '}';
+    buf[pos++] = '\x07';
+    return pos;
+}
+
+
+int get_socket(const std::string &addr, uint16_t port) {
+    struct sockaddr_in server_addr = {};
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(port);
+    server_addr.sin_addr.s_addr = inet_addr(addr.c_str());
+
+    int sock_client;
+    if ((sock_client = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
+        std::cerr << "Error: socket creation failed" << std::endl;
+        exit(-1);
+    }
+
+    while (connect(sock_client, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
+        std::cerr << "Error: connection to server with IP: "
+                  << addr << " Port: "
+                  << port << " failed." << std::endl;
+        sleep(1);
+    }
+
+    int one = 1;
+    setsockopt(sock_client, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    std::cout << "Connection to SimCoupler with IP: "
+              << addr << " Port: "
+              << port << " established." << std::endl;
+    return sock_client;
+}
+
+
+bool send_all(int fd, const char *buf, size_t len) {
+    while (len) {
+        ssize_t n = send(fd, buf, len, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            std::cerr << "send failed: " << strerror(errno) << std::endl;
+            return false;
+        }
+        buf += n;
+        len -= (size_t)n;
+    }
+    return true;
+}
+
+
+void print_stats(std::vector<Topic> &topics, double seconds, uint64_t bytes) {
+    double target = 0;
+    double achieved = 0;
+
+    for (auto &topic : topics) {
+        double rate = (topic.sent - topic.sent_last) / seconds;
+        printf("%-16s target %8.1f Hz  achieved %8.1f Hz  max lag %7.2f ms\n",
+               topic.name.c_str(), topic.rate_hz, rate, topic.max_lag_ms);
+        target += topic.rate_hz;
+        achieved += rate;
+        topic.sent_last = topic.sent;
+        topic.max_lag_ms = 0;
+    }
+    printf("%-16s target %8.1f Hz  achieved %8.1f Hz  %10.0f B/s\n\n",
+           "total", target, achieved, bytes / seconds);
+    fflush(stdout);
+}
+
+
+int main(int argc, char** argv)
+{
+    Config cfg;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            usage(argv[0]);
+            return 1;
+        }
+        std::string val = argv[++i];
+
+        try {
+            if (arg == "--addr") {
+                cfg.addr = val;
+            } else if (arg == "--port") {
+                cfg.port = (uint16_t)std::stoi(val);
+            } else if (arg == "--topic") {
+                Topic topic;
+                if (!parse_topic(val, topic)) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                cfg.topics.push_back(topic);
+            } else if (arg == "--stats") {
+                cfg.stats_interval = std::stod(val);
+            } else if (arg == "--duration") {
+                cfg.duration = std::stod(val);
+            } else if (arg == "--ramp") {
+                size_t colon = val.find(':');
+                cfg.ramp_step = std::stod(val.substr(0, colon));
+                if (colon != std::string::npos) {
+                    cfg.ramp_factor = std::stod(val.substr(colon + 1));
+                }
+            } else {
+                usage(argv[0]);
+                return 1;
+            }
+        } catch (...) {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (cfg.topics.empty()) {
+        Topic topic;
+        parse_topic("navsat=5", topic);
+        cfg.topics.push_back(topic);
+    }
+    if (cfg.stats_interval <= 0) {
+        cfg.stats_interval = 1.0;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    int sockfd = get_socket(cfg.addr, cfg.port);
+
+    auto to_duration = [](double s) {
+        return std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(s));
+    };
+    auto start = Clock::now();
+    auto stats_interval = to_duration(cfg.stats_interval);
+    auto next_stats = start + stats_interval;
+    auto next_ramp = start + to_duration(cfg.ramp_step);
+    uint64_t bytes = 0;
+    std::vector<char> buf(WRITE_BUF_SIZE);
+
+    for (auto &topic : cfg.topics) {
+        topic.next = start;
+    }
+
+    for (;;) {
+        auto now = Clock::now();
+        double t = std::chrono::duration<double>(now - start).count();
+
+        if (cfg.duration > 0 && t >= cfg.duration) {
+            break;
+        }
+
+        if (now >= next_stats) {
+            print_stats(cfg.topics, cfg.stats_interval, bytes);
+            bytes = 0;
+            next_stats += stats_interval;
+        }
+
+        if (cfg.ramp_step > 0 && now >= next_ramp) {
+            for (auto &topic : cfg.topics) {
+                topic.rate_hz *= cfg.ramp_factor;
+            }
+            next_ramp += to_duration(cfg.ramp_step);
+            printf("Rates multiplied by %.2f\n", cfg.ramp_factor);
+        }
+
+        // all records that are due go out in one write
+        size_t len = 0;
+        auto next = next_stats;
+        for (auto &topic : cfg.topics) {
+            auto period = to_duration(1.0 / topic.rate_hz);
+            while (topic.next <= now && buf.size() - len > std::max(topic.size, (size_t)1024) + 16) {
+                double lag = std::chrono::duration<double, std::milli>(now - topic.next).count();
+                topic.max_lag_ms = std::max(topic.max_lag_ms, lag);
+                len += format_record(&buf[len], buf.size() - len, topic, t);
+                topic.seq++;
+                topic.sent++;
+                topic.next += period;
+            }
+            next = std::min(next, topic.next);
+        }
+
+        if (len) {
+            // a blocking write: when SimCoupler saturates the achieved rate drops
+            if (!send_all(sockfd, buf.data(), len)) {
+                break;
+            }
+            bytes += len;
+        }
+
+        auto wait = next - Clock::now();
+        if (wait > Clock::duration::zero()) {
+            std::this_thread::sleep_for(wait);
+        }
+    }
+
+    close(sockfd);
+    return 0;
+}
@@ -1,11 +1,13 @@
 /*
  * Copyright (C) 2023, HENSOLDT Cyber GmbH
  */
- 
- 
+
+
 #include "lib_debug/Debug.h"
+#include <stdatomic.h>
 #include <string.h>
 
+#include "OS_Dataport.h"
 #include "OS_Socket.h"
 #include "interfaces/if_OS_Socket.h"
 
@@ -13,308 +15,547 @@
 #include "lib_macros/Test.h"
 #include <arpa/inet.h>
 
+#include "TimeServer.h"
+
 #include <camkes.h>
 
+#include "mavlink_filter/cmd_trace.h"
+#include "mavlink_filter/egress_sched.h"
+#include "mavlink_filter/link_monitor.h"
 #include "mavlink_filter/mavlink_filter.h"
+#include "mavlink_filter/mavlink_router.h"
+#include "mavlink_filter/mavlink_scan.h"
+#include "mavlink_filter/param_cache.h"
+#include "mavlink_filter/vehicle_state.h"
+#include "libs/util/counters.h"
+#include "libs/util/log_ring.h"
+#include "libs/util/relay_engine.h"
 #include "libs/util/socket_helper.h"
+#include "libs/util/trace_server.h"
 
 //----------------------------------------------------------------------
 // Context
 //----------------------------------------------------------------------
 
 
-void socket_VM_event_callback(void* ctx);
-void socket_PX4_event_callback(void* ctx);
+static const if_OS_Timer_t timer =
+    IF_OS_TIMER_ASSIGN(
+        timeServer_rpc,
+        timeServer_notify);
+
+
+// Trace export on the PX4 side, started once the stack is up
+static trace_server_t trace_server;
+
+static const OS_Socket_Addr_t trace_addr = {
+    .addr = PX4_TRENTOS_ADDR,
+    .port = PX4_TRENTOS_PORT_TRACE
+};
+
+// Trace tracks, filter decisions are on MAVLINK_FILTER_TRACE_TRACK
+enum {
+    TRACE_TRACK_VM = 1,
+    TRACE_TRACK_PX4,
+    TRACE_TRACK_CONTROL = MAVLINK_FILTER_TRACE_TRACK + 1,
+};
+
+
+
+//----------------------------------------------------------------------
+// Links
+//----------------------------------------------------------------------
+
+
+// PX4 instances we relay to, one link each
+static const OS_Socket_Addr_t px4_peers[] = PX4_DRONE_PEERS;
+
+// Guest connections come first, followed by one link per PX4 instance
+#define VM_LINKS        MAVLINK_FILTER_MAX_LINKS
+#define PX4_LINKS       (sizeof(px4_peers) / sizeof(px4_peers[0]))
+#define NUM_LINKS       (VM_LINKS + PX4_LINKS)
+#define LINK_PX4(i)     (VM_LINKS + (i))
+
+_Static_assert(NUM_LINKS <= MAVLINK_ROUTER_MAX_LINKS, "too many links");
+_Static_assert(NUM_LINKS <= RELAY_ENGINE_MAX_LINKS, "too many links");
+
+// Data collected from PX4 for one relay call while a bulk transfer is running
+#define RELAY_READ_LEN  RELAY_ENGINE_READ_LEN
+
+static relay_engine_t engine = {
+    .lock = SharedResourceMutex_lock,
+    .unlock = SharedResourceMutex_unlock,
+};
 
+static void vm_read(int i, char * buf, size_t len, void * ctx);
+static void vm_open(int i, void * ctx);
+static void vm_writable(int i, void * ctx);
+static void px4_read(int i, char * buf, size_t len, void * ctx);
+static void link_closed(int i, void * ctx);
+static bool px4_foreign_event(const OS_Socket_Evt_t * event, void * ctx);
+static size_t px4_read_budget(void * ctx);
 
 // VM       <--> TRENTOS
-socket_ctx_t socket_VM = {
-    .socket = IF_OS_SOCKET_ASSIGN(socket_VM_nws),
-    .addr = {
-        .addr = VM_TRENTOS_ADDR,
-        .port = VM_TRENTOS_PORT
+static relay_side_t side_vm = {
+    .sock = {
+        .socket = IF_OS_SOCKET_ASSIGN(socket_VM_nws),
+        .addr = {
+            .addr = VM_TRENTOS_ADDR,
+            .port = VM_TRENTOS_PORT
+        },
+    },
+    .engine = &engine,
+    .first_link = 0,
+    .num_links = VM_LINKS,
+    .trace_track = TRACE_TRACK_VM,
+    .trace_name = "vm_callback",
+    .ops = {
+        .on_read = vm_read,
+        .on_open = vm_open,
+        .on_close = link_closed,
+        .on_writable = vm_writable,
     },
-    .callback = socket_VM_event_callback,
-    .callback_ctx = &socket_VM,
-    .conn_init = false,
 };
 
-
-// TRENTOS  <--> PX4(Linux Host)
-socket_ctx_t socket_PX4 = {
-    .socket     = IF_OS_SOCKET_ASSIGN(socket_PX4_nws),
-    .addr       = {
-        .addr = PX4_TRENTOS_ADDR,
-        .port = PX4_TRENTOS_PORT
+// TRENTOS  <--> PX4(Linux Host), the links are connected once a guest connects
+static relay_side_t side_px4 = {
+    .sock = {
+        .socket = IF_OS_SOCKET_ASSIGN(socket_PX4_nws),
+        .addr = {
+            .addr = PX4_TRENTOS_ADDR,
+            .port = PX4_TRENTOS_PORT
+        },
     },
-    .callback = socket_PX4_event_callback,
-    .callback_ctx = &socket_PX4,
-    .addr_partner = {
-        .addr = PX4_DRONE_ADDR,
-        .port = PX4_DRONE_PORT
+    .engine = &engine,
+    .first_link = LINK_PX4(0),
+    .num_links = PX4_LINKS,
+    .trace_track = TRACE_TRACK_PX4,
+    .trace_name = "px4_callback",
+    .spin = true,
+    .ops = {
+        .on_read = px4_read,
+        .on_close = link_closed,
+        .on_foreign_event = px4_foreign_event,
+        .read_budget = px4_read_budget,
     },
-    .conn_init = false,
 };
 
+// Frames cut off at the end of a read wait here for the rest
+static mavlink_scanner_t scanners[NUM_LINKS];
+
+// (sysid, compid) -> link, learned from the traffic of either side
+static mavlink_router_t routes_vm;
+static mavlink_router_t routes_px4;
+
+// Buffers holding complete frames only, no state is carried over
+static mavlink_scanner_t frames_scanner;
+
+// Complete frames of the current read, if they are not contiguous in the read buffer
+static char frames_buf[MAVLINK_FILTER_OUT_BUF_SIZE(RELAY_READ_LEN)];
+
+static char out_buf[NUM_LINKS][MAVLINK_FILTER_OUT_BUF_SIZE(RELAY_READ_LEN)];
+
+// PX4 -> VM traffic is prioritized per guest link once the link backs up
+static egress_sched_t egress[VM_LINKS];
+
+
+static mavlink_link_mask_t connected_links(int first, int count) {
+    mavlink_link_mask_t mask = 0;
+    for (int i = first; i < first + count; i++) {
+        if (relay_engine_connected(&engine, i)) {
+            mask |= MAVLINK_LINK_BIT(i);
+        }
+    }
+    return mask;
+}
+
+
+static size_t egress_write(void * ctx, const uint8_t * buf, size_t len) {
+    return relay_engine_write(&engine, (int)(uintptr_t)ctx, (const char *)buf, len);
+}
+
+
+// Sends the answers the filter generated itself while the guest keeps up,
+// the rest follows once the socket signals free space again
+static void send_replies(int i) {
+    static char buf[OS_DATAPORT_DEFAULT_SIZE];
+    size_t len;
+
+    while (egress_idle(&egress[i]) &&
+           (len = mavlink_filter_get_replies(i, buf, sizeof(buf)))) {
+        egress_send(&egress[i], (const uint8_t *)buf, len);
+    }
+}
+
+
+// buf holds complete frames, a PX4 link that backs up drops them whole,
+// returns false then
+static bool link_send(int i, const char * buf, size_t len) {
+    if (i < VM_LINKS) {
+        egress_send(&egress[i], (const uint8_t *)buf, len);
+    } else if (!relay_engine_send(&engine, i, buf, len)) {
+        LOG_RING_ERROR("PX4 link %d backed up, %u bytes of frames dropped", i, len);
+        return false;
+    }
+    return true;
+}
+
 
 
 //----------------------------------------------------------------------
-// Callback PX4
+// Routing
 //----------------------------------------------------------------------
 
 
-void socket_PX4_event_callback(void* ctx) {
-    Debug_ASSERT(NULL != ctx);
-    Debug_ASSERT(ctx != &socket_VM);
-    
-    socket_ctx_t * socket_from = ctx; 
-    socket_ctx_t * socket_to = &socket_VM;
-    
-    OS_Socket_Evt_t eventBuffer[OS_NETWORK_MAXIMUM_SOCKET_NO] = { 0 };
-    int numberOfSocketsWithEvents = 0;
+typedef struct {
+    uint8_t                     src;
+    bool                        from_px4;
+    const mavlink_router_t *    route;  // routes of the destination side, NULL: single destination
+    mavlink_link_mask_t         dst;
+    const uint8_t *             in;     // read buffer
+    size_t                      in_len;
+    const uint8_t *             frames; // complete frames of the read, in order
+    size_t                      frames_len;
+    size_t                      out_len[NUM_LINKS];
+} relay_t;
 
-    OS_Error_t err;
 
-    if ((err = OS_Socket_getPendingEvents(&socket_from->socket,
-                                          eventBuffer,
-                                          sizeof(eventBuffer),
-                                          &numberOfSocketsWithEvents))) { 
-        Debug_LOG_ERROR("failed to retrieve pending events. Error: %i", err);
+typedef struct {
+    uint8_t                     src;
+    mavlink_router_t *          learn;  // routes of the source side
+    bool                        from_px4;
+    uint64_t                    t_read; // timestamp_ticks() of the read, for the command tracer
+    const mavlink_router_t *    route;  // as in relay_t, for the links a frame went to
+    mavlink_link_mask_t         dst;
+} learn_t;
+
+
+/*
+ * Collects the frames of a read. As long as they follow each other in the
+ * read buffer they are sent from there. Only a frame completed in the
+ * scanner, skipped bytes or a probe answer in between move them to
+ * frames_buf.
+ */
+static void collect_frame(relay_t * r, const mavlink_frame_t * frame) {
+    bool in_read = frame->data >= r->in && frame->data < r->in + r->in_len;
+
+    if (!r->frames && in_read) {
+        r->frames = frame->data;
+    } else if (r->frames != (const uint8_t *)frames_buf &&
+               (!in_read || r->frames + r->frames_len != frame->data)) {
+        if (r->frames) {
+            memcpy(frames_buf, r->frames, r->frames_len);
+        }
+        r->frames = (const uint8_t *)frames_buf;
+    }
+
+    if (r->frames == (const uint8_t *)frames_buf) {
+        memcpy(&frames_buf[r->frames_len], frame->data, frame->len);
+    }
+    r->frames_len += frame->len;
+}
+
+
+static void relay_frame(const mavlink_frame_t * frame, void * ctx) {
+    relay_t * r = ctx;
+
+    // answers to the link monitor's probes end here
+    if (r->from_px4 && link_monitor_handle_frame(r->src, frame)) {
         return;
     }
-    
-    // Verify that the received number of sockets with events is within expected
-    // bounds.
-    ASSERT_LE_INT(numberOfSocketsWithEvents, OS_NETWORK_MAXIMUM_SOCKET_NO);
-    ASSERT_GT_INT(numberOfSocketsWithEvents, -1);
 
-    for (int i = 0; i < numberOfSocketsWithEvents; i++) {
-        OS_Socket_Evt_t event;
-        memcpy(&event, &eventBuffer[i], sizeof(OS_Socket_Evt_t));
+    collect_frame(r, frame);
+    if (!r->route) {
+        return;
+    }
 
-        if ((err = SharedResourceMutex_lock())) {
-            Debug_LOG_ERROR("Mutex lock failed, code %d", err);
-            return;
+    // several destinations, every one gets its own gather buffer
+    mavlink_link_mask_t dst = mavlink_router_route(r->route, frame, r->dst);
+    for (int i = 0; dst; i++, dst >>= 1) {
+        if (dst & 1) {
+            memcpy(&out_buf[i][r->out_len[i]], frame->data, frame->len);
+            r->out_len[i] += frame->len;
         }
+    }
+}
+
 
-        if (!(event.socketHandle >= 0 && 
-              event.socketHandle < OS_NETWORK_MAXIMUM_SOCKET_NO)) {
-            Debug_LOG_ERROR("Found invalid socket handle %d for event %d", 
-                            event.socketHandle, i);
-            goto reset_PX4;
+static void learn_frame(const mavlink_frame_t * frame, void * ctx) {
+    learn_t * l = ctx;
+
+    mavlink_router_learn(l->learn, frame->sysid, frame->compid, l->src);
+    if (l->from_px4) {
+        vehicle_state_handle_frame(frame);
+        param_cache_handle_frame(frame);
+        mavlink_filter_handle_px4_frame(frame);
+        if (MAVLINK_CMD_TRACE_ENABLED && frame->msgid == MAVLINK_MSG_ID_COMMAND_ACK) {
+            mavlink_link_mask_t dst = l->route ? mavlink_router_route(l->route, frame, l->dst) : l->dst;
+            cmd_trace_handle_frame(frame, dst, l->t_read);
         }
+    }
+}
 
-        uint8_t eventMask = event.eventMask;
-        if (eventMask & OS_SOCK_EV_ERROR || eventMask & OS_SOCK_EV_FIN) {
-            Debug_LOG_TRACE("event: OS_SOCK_EV_ERROR or OS_SOCK_EV_FIN");
 
-            if ((err = OS_Socket_close(socket_from->handle))) {
-                Debug_LOG_ERROR("OS_Socket_close() failed, code %d", err);
-            }
-            socket_from->conn_init = false;
-        } 
-        
-        if (eventMask & OS_SOCK_EV_CONN_EST) {
-            socket_from->conn_init = true;
-            Debug_LOG_TRACE("PX4 socket connection established");
-        
-        } else if (eventMask & OS_SOCK_EV_READ) {
-            char buf[MTU] = { 0 };
-            size_t len_requested = sizeof(buf);
-            size_t len_actual = 0;
-
-            if ((err = OS_Socket_read(socket_from->handle,
-                                      buf,
-                                      len_requested,
-                                      &len_actual))) {
-                Debug_LOG_ERROR("OS_Socket_read() failed, code %d", err);
-                goto reset_PX4;
+/*
+ * Sends data from link src to the links in dst. Only complete frames are
+ * sent, so a guest link can be reordered by its egress scheduler; a frame cut
+ * off at the end of the read waits for the rest in the scanner. With a single
+ * destination all frames go there, otherwise every frame goes to the links
+ * owning its target. Routes are learned after sending. Returns false if a
+ * destination dropped frames.
+ */
+static bool relay(uint8_t src, mavlink_scanner_t * scanner, const char * buf, size_t len,
+                  mavlink_router_t * learn, const mavlink_router_t * route,
+                  mavlink_link_mask_t dst, bool from_px4, uint64_t t_read) {
+    relay_t r = {
+        .src = src,
+        .from_px4 = from_px4,
+        .route = (dst & (dst - 1)) ? route : NULL,
+        .dst = dst,
+        .in = (const uint8_t *)buf,
+        .in_len = len,
+    };
+    learn_t l = {
+        .src = src,
+        .learn = learn,
+        .from_px4 = from_px4,
+        .t_read = t_read,
+        .route = r.route,
+        .dst = dst,
+    };
+
+    bool sent = true;
+
+    mavlink_scan(scanner, (const uint8_t *)buf, len, relay_frame, &r);
+
+    if (!r.route) {
+        if (dst && r.frames_len) {
+            sent = link_send(__builtin_ctz(dst), (const char *)r.frames, r.frames_len);
+        }
+    } else {
+        for (int i = 0; i < NUM_LINKS; i++) {
+            if (r.out_len[i] && !link_send(i, out_buf[i], r.out_len[i])) {
+                sent = false;
             }
+        }
+    }
 
-            // Check if partner socket is ready to send
-            if (!socket_to->conn_init) {
-                Debug_LOG_TRACE("Connection to the vm is not initiated, data will be dropped");
-                goto reset_PX4;
-            }
-            
-            if ((err = OS_Socket_write(socket_to->client_handle,
-                                       buf,
-                                       len_requested,
-                                       &len_actual))) {
-                Debug_LOG_ERROR("OS_Socket_write() failed, code %d", err);
-            }
+    mavlink_scan(&frames_scanner, r.frames, r.frames_len, learn_frame, &l);
+    return sent;
+}
+
+
+
+//----------------------------------------------------------------------
+// Connection handling
+//----------------------------------------------------------------------
+
+
+// Earliest timestamp_ticks() of the next connect per PX4 link
+static uint64_t px4_next_connect[PX4_LINKS];
+
+/*
+ * The links are connected once the PX4 stack is up and a guest connected, see
+ * start_px4_side(). A link PX4 closed is reconnected from link_closed(), a
+ * retry within PX4_RECONNECT_INTERVAL_MS waits for the next guest read, so a
+ * PX4 refusing connections is not hammered.
+ */
+static void connect_px4_links(void) {
+    uint64_t now = timestamp_ticks();
+    OS_Error_t err;
+
+    if (!side_px4.started) {
+        return;
+    }
+
+    for (int i = 0; i < PX4_LINKS; i++) {
+        if (engine.links[LINK_PX4(i)].in_use || now < px4_next_connect[i]) {
+            continue;
         }
+        px4_next_connect[i] = now + timestamp_frequency() * PX4_RECONNECT_INTERVAL_MS / 1000;
 
-reset_PX4:
-        memset(&eventBuffer[event.socketHandle], 0, sizeof(OS_Socket_Evt_t));
-        
-        if ((err = SharedResourceMutex_unlock())) {
-            Debug_LOG_ERROR("Mutex unlock failed, code %d", err);
-            return;
+        if ((err = relay_engine_connect(&side_px4, LINK_PX4(i), &px4_peers[i]))) {
+            Debug_LOG_ERROR("Connecting to PX4 %s:%d failed. code: %d",
+                            px4_peers[i].addr, px4_peers[i].port, err);
+            continue;
         }
+        mavlink_scanner_reset(&scanners[LINK_PX4(i)]);
+        Debug_LOG_INFO("PX4 socket %d succesfully initialized.", i);
     }
+}
+
+
+static void vm_open(int i, void * ctx) {
+    mavlink_scanner_reset(&scanners[i]);
+    mavlink_filter_reset_link(i);
+    egress_reset(&egress[i]);
+
+    // VM is now connected -> connect to PX4
+    connect_px4_links();
+
+    printf("Set VM IP address to: IP: %s PORT: %d\n",
+            engine.links[i].addr_partner.addr,
+            ntohs(engine.links[i].addr_partner.port));
+}
 
-    //register socket callback
-    if ((err = OS_Socket_regCallback(&socket_from->socket,
-                                     socket_from->callback,
-                                     socket_from->callback_ctx))) {
-        Debug_LOG_ERROR("OS_Socket_regCallback() failed, code %d", err);
+
+static void link_closed(int i, void * ctx) {
+    if (i < VM_LINKS) {
+        mavlink_router_forget_link(&routes_vm, i);
+        egress_reset(&egress[i]);
+    } else {
+        mavlink_router_forget_link(&routes_px4, i);
+    }
+    link_monitor_reset(i);
+
+    if (i >= VM_LINKS && connected_links(0, VM_LINKS)) {
+        connect_px4_links();
+    }
+}
+
+
+
+// Set by the control thread every LINK_MONITOR_INTERVAL_MS, the probes are
+// sent by the next relay callback, which holds the lock anyway
+static atomic_bool probes_due;
+
+// Sends a latency probe on every connected link, the answers are taken out
+// of the relayed traffic by the callbacks. Called with the lock held.
+static void send_probes(void) {
+    static uint8_t buf[LINK_MONITOR_PROBE_LEN];
+
+    if (!atomic_exchange(&probes_due, false)) {
+        return;
+    }
+    for (int i = 0; i < NUM_LINKS; i++) {
+        if (relay_engine_connected(&engine, i)) {
+            size_t len = link_monitor_probe(i, buf, i >= VM_LINKS);
+            link_send(i, (const char *)buf, len);
+        }
+    }
+}
+
+
+// Relay mode, see update_relay_mode()
+static bool busy_poll;
+static counter_t * c_busy_poll;
+static counter_t * c_mode_switches;
+static counter_t * c_spin_events;
+static counter_t * c_spin_idle;
+static counter_t * c_spin_capped;
+
+// While a vehicle is armed the relay keeps polling the PX4 socket for
+// RELAY_BUSY_POLL_US after each event before it waits for a notification
+// again, in flight the latency matters more than the CPU. Called from
+// px4_read() right after the vehicle state was updated.
+static void update_relay_mode(void) {
+    bool armed = RELAY_BUSY_POLL_US && vehicle_state_any_armed();
+
+    if (armed != busy_poll) {
+        busy_poll = armed;
+        socket_loop_set_spin(&engine.loop, busy_poll ? RELAY_BUSY_POLL_US : 0);
+        counter_set(c_busy_poll, busy_poll);
+        counter_add(c_mode_switches, 1);
+        LOG_RING_INFO("Relay switched to busy polling: %d", busy_poll);
     }
 }
 
 
 
 //----------------------------------------------------------------------
-// Callback VM
+// Processing PX4 -> VM
 //----------------------------------------------------------------------
 
 
-void socket_VM_event_callback(void* ctx) {
-    Debug_ASSERT(NULL != ctx);
-    Debug_ASSERT(ctx != &socket_PX4);
+static bool px4_foreign_event(const OS_Socket_Evt_t * event, void * ctx) {
+    return trace_server_handle_event(&trace_server, event);
+}
 
-    socket_ctx_t * socket_from  = ctx; 
-    socket_ctx_t * socket_to    = &socket_PX4;
 
-    OS_Socket_Evt_t eventBuffer[OS_NETWORK_MAXIMUM_SOCKET_NO] = { 0 };
-    int numberOfSocketsWithEvents = 0;
+// During a log download or FTP read the stack holds more than one read,
+// collect it so the guest gets one large write
+static size_t px4_read_budget(void * ctx) {
+    return mavlink_filter_bulk_active() ? RELAY_READ_LEN : MTU;
+}
 
-    OS_Error_t err;
 
-    if ((err = OS_Socket_getPendingEvents(&socket_from->socket,
-                                          eventBuffer,
-                                          sizeof(eventBuffer),
-                                          &numberOfSocketsWithEvents))) {
-        Debug_LOG_ERROR("failed to retrieve pending events. Error: %i", err);
-        return;
+static void px4_read(int src, char * buf, size_t len, void * ctx) {
+    uint64_t t_px4_read = MAVLINK_CMD_TRACE_ENABLED ? timestamp_ticks() : 0;
+
+    // Check if a partner socket is ready to send
+    mavlink_link_mask_t dst = connected_links(0, VM_LINKS);
+    if (!dst) {
+        LOG_RING_TRACE("Connection to the vm is not initiated, data will be dropped");
     }
 
-    // Verify that the received number of sockets with events is within expected
-    // bounds.
-    ASSERT_LE_INT(numberOfSocketsWithEvents, OS_NETWORK_MAXIMUM_SOCKET_NO);
-    ASSERT_GT_INT(numberOfSocketsWithEvents, -1);
+    // The vehicle state is decoded after forwarding, telemetry is not delayed
+    relay(src, &scanners[src], buf, len, &routes_px4, &routes_vm, dst, true, t_px4_read);
+    update_relay_mode();
 
-    for (int i = 0; i < numberOfSocketsWithEvents; i++) {
-        OS_Socket_Evt_t event;
-        memcpy(&event, &eventBuffer[i], sizeof(OS_Socket_Evt_t));
-        
-        if ((err = SharedResourceMutex_lock()))
-        {
-            Debug_LOG_ERROR("Mutex lock failed, code %d", err);
-            return;
-        }
-        
-        if (!(event.socketHandle >= 0 && 
-              event.socketHandle < OS_NETWORK_MAXIMUM_SOCKET_NO)) {
-            Debug_LOG_ERROR("Found invalid socket handle %d for event %d", 
-                            event.socketHandle, i);
-            goto reset_VM;
-        }        
-
-        uint8_t eventMask = event.eventMask;
-        if (eventMask & OS_SOCK_EV_ERROR || eventMask & OS_SOCK_EV_FIN) {
-            Debug_LOG_TRACE("event: OS_SOCK_EV_ERROR or OS_SOCK_EV_FIN");
-
-            //Find socket handle through socket id
-            if ((err = OS_Socket_close(
-                        socket_from->handle.handleID == event.socketHandle ? 
-                        socket_from->handle: 
-                        socket_from->client_handle))) {
-                Debug_LOG_ERROR("OS_Socket_close() failed, code %d", err);
+    // A COMMAND_ACK completed a traced command, its report follows the ack
+    if (MAVLINK_CMD_TRACE_ENABLED) {
+        for (int i = 0; i < VM_LINKS; i++) {
+            if (relay_engine_connected(&engine, i)) {
+                send_replies(i);
             }
-            socket_from->conn_init = false;
         }
+    }
+    send_probes();
+}
 
-        if (eventMask & OS_SOCK_EV_CONN_ACPT) {
-            Debug_LOG_ERROR("Conn accpt event");
-            err = OS_Socket_accept(socket_from->handle, 
-                                   &socket_from->client_handle, 
-                                   &socket_from->addr_partner);
-
-            if (err == OS_ERROR_TRY_AGAIN) {
-                Debug_LOG_ERROR("Socket accept failed OS_ERROR_TRY_AGAIN");
-                goto reset_VM;
-            } else if (err) {
-                Debug_LOG_ERROR("OS_Socket_accept() failed, error %d", err);
-
-                //Find socket handle through socket id
-                if ((err = OS_Socket_close(
-                            socket_from->handle.handleID == event.socketHandle ? 
-                            socket_from->handle: 
-                            socket_from->client_handle))) {
-                    Debug_LOG_ERROR("OS_Socket_close() failed, code %d", err);
-                }
-                goto reset_VM;
-            }
-            socket_from->conn_init = true;
 
-            // VM is now connected -> connect to PX4
-            if ((err = init_socket_nb_client(&socket_PX4))) {
-                Debug_LOG_ERROR("Initialization of the px4 socket failed. code: %d", err);
-                return;
-            }
-            Debug_LOG_ERROR("PX4 socket succesfully initialized.");
-
-            printf("Set VM IP address to: IP: %s PORT: %d\n",
-                    socket_from->addr_partner.addr, 
-                    ntohs(socket_from->addr_partner.port));
-
-        }  else if (eventMask & OS_SOCK_EV_READ) {
-            static char buf[MTU]     = { 0 };
-            static char ret_buf[MTU] = { 0 };
-            
-            size_t len_requested = sizeof(buf);
-            size_t ret_len = 0;
-            size_t len_actual = 0;
-            
-            if ((err = OS_Socket_read(socket_from->client_handle,
-                                      buf,
-                                      len_requested,
-                                      &len_actual))) {
-                Debug_LOG_ERROR("OS_Socket_read() failed, code %d", err);
-                goto reset_VM;
-            }
 
-            //Applying filter to data from VM -> PX4
-            filter_mavlink_message(buf, &len_actual, ret_buf, &ret_len);
+//----------------------------------------------------------------------
+// Processing VM -> PX4
+//----------------------------------------------------------------------
 
-            Debug_LOG_TRACE("Len of packet prior to filetering: %lu Len now: %lu\n",      
-                            len_actual, 
-                            ret_len);
 
-            // Check if partner socket is ready to send
-            if (!socket_to->conn_init) {
-                Debug_LOG_ERROR("Dropping Packet: Socket_VM notinitialized yet");
-                goto reset_VM;
-            }
-            
-            //Check if ret_len has data to send
-            if (ret_len) {
-                //send buffer with the filtered messages to PX4
-                if ((err = OS_Socket_write(socket_to->handle, 
-                                           ret_buf, 
-                                           ret_len, 
-                                           &len_actual))) {
-                    Debug_LOG_ERROR("OS_Socket_sendto() failed, code %d", err);
-                }
-            }
-        }
-        
-reset_VM:
-        memset(&eventBuffer[event.socketHandle], 0, sizeof(OS_Socket_Evt_t));
+static void vm_read(int src, char * buf, size_t len, void * ctx) {
+    static char ret_buf[MAVLINK_FILTER_OUT_BUF_SIZE(MTU)] = { 0 };
 
-        if ((err = SharedResourceMutex_unlock())) {
-            Debug_LOG_ERROR("Mutex unlock failed, code %d", err);
-            return;
-        }
+    size_t len_actual = len;
+    size_t ret_len = 0;
+
+    if (MAVLINK_CMD_TRACE_ENABLED) {
+        cmd_trace_ingress(timestamp_ticks());
     }
 
-    //register socket callback
-    if ((err = OS_Socket_regCallback(&socket_from->socket,
-                                     socket_from->callback,
-                                     socket_from->callback_ctx))) {
-        Debug_LOG_ERROR("OS_Socket_regCallback() failed, code %d", err);
+    //Applying filter to data from VM -> PX4
+    uint64_t t_filter = trace_now();
+    filter_mavlink_message(src, buf, &len_actual, ret_buf, &ret_len);
+    trace_span(TRACE_TRACK_VM, "filter", t_filter, "len", ret_len);
+
+    // Requests the filter answered itself, e.g. from the parameter cache
+    send_replies(src);
+
+    LOG_RING_TRACE("Len of packet prior to filetering: %u Len now: %u",
+                    len_actual,
+                    ret_len);
+
+    // Check if a partner socket is ready to send, retry the ones PX4 closed
+    connect_px4_links();
+    mavlink_link_mask_t dst = connected_links(LINK_PX4(0), PX4_LINKS);
+    if (!dst) {
+        LOG_RING_ERROR("Dropping Packet: Socket_PX4 not initialized yet");
+        return;
     }
+
+    //Check if ret_len has data to send
+    if (ret_len) {
+        //send the filtered messages to the PX4 instances they are addressed to
+        // and stamp their commands, those of a dropped read count as not forwarded
+        if (relay(src, &frames_scanner, ret_buf, ret_len, &routes_vm, &routes_px4, dst, false, 0) &&
+            MAVLINK_CMD_TRACE_ENABLED) {
+            cmd_trace_egress(timestamp_ticks());
+        }
+    }
+    send_probes();
+}
+
+
+// The guest drained its socket, send what queued up meanwhile
+static void vm_writable(int i, void * ctx) {
+    egress_flush(&egress[i]);
+    send_replies(i);
 }
 
 
@@ -322,11 +563,213 @@ reset_VM:
 // Init
 //----------------------------------------------------------------------
 
+// Start of the component, for the boot time of the network stacks
+static uint64_t t_boot;
+
+static OS_Error_t start_vm_side(void * ctx);
+static OS_Error_t start_px4_side(void * ctx);
+
 void post_init(void) {
+    t_boot = timestamp_ticks();
+
+    log_ring_init();
+    mavlink_filter_init();
+
+    trace_init(1, "SerialFilter");
+    trace_track_name(TRACE_TRACK_VM, "VM callback");
+    trace_track_name(TRACE_TRACK_PX4, "PX4 callback");
+    trace_track_name(MAVLINK_FILTER_TRACE_TRACK, "filter decisions");
+    trace_track_name(TRACE_TRACK_CONTROL, "control thread");
+
+    for (int i = 0; i < VM_LINKS; i++) {
+        link_monitor_init(i, "vm%d", i);
+    }
+    for (int i = 0; i < PX4_LINKS; i++) {
+        link_monitor_init(LINK_PX4(i), "px4_%d", i);
+    }
+
+    for (int i = 0; i < VM_LINKS; i++) {
+        egress_init(&egress[i], egress_write, (void *)(uintptr_t)i);
+    }
+
+    c_busy_poll = counter_register("relay.busy_poll");
+    c_mode_switches = counter_register("relay.mode_switches");
+    c_spin_events = counter_register("relay.spin_events");
+    c_spin_idle = counter_register("relay.spin_idle");
+    c_spin_capped = counter_register("relay.spin_capped");
+    socket_loop_set_spin_cap(&engine.loop, RELAY_BUSY_POLL_MAX_US, RELAY_BUSY_POLL_PERIOD_MS * 1000);
+
+    // the previous bring-up, for comparing the boot time
+    if (NW_STACK_WAIT_SPIN) {
+        wait_for_nw_stack_init_nb(&side_vm.sock.socket);
+        side_vm.wait.t_running = timestamp_ticks();
+        wait_for_nw_stack_init_nb(&side_px4.sock.socket);
+        side_px4.wait.t_running = timestamp_ticks();
+    }
+
+    // both stacks start from their notification or the control thread
+    if (relay_engine_wait(&side_vm, start_vm_side, NULL) ||
+        relay_engine_wait(&side_px4, start_px4_side, NULL)) {
+        Debug_LOG_ERROR("Network stack notifications not available");
+    }
+    Debug_LOG_DEBUG("Init done");
+}
+
+
+//----------------------------------------------------------------------
+// Bring-up: each side is started as soon as its stack runs, by the
+// notification of the stack or by the control thread
+//----------------------------------------------------------------------
+
+static OS_Error_t start_vm_side(void * ctx) {
     int backlog = 10;
-    if (init_socket_nb_server(&socket_VM, backlog)) {
+    OS_Error_t err, err_unlock;
+
+    // the other side may start meanwhile
+    if ((err = relay_engine_lock(&engine, TRACE_TRACK_CONTROL))) {
+        Debug_LOG_ERROR("Mutex lock failed, code %d", err);
+        return err;
+    }
+
+    if ((err = relay_engine_listen(&side_vm, backlog))) {
         Debug_LOG_ERROR("Initialization of the VM socket failed");
+    }
+
+    if ((err_unlock = relay_engine_unlock(&engine))) {
+        Debug_LOG_ERROR("Mutex unlock failed, code %d", err_unlock);
+    }
+    return err;
+}
+
+
+static OS_Error_t start_px4_side(void * ctx) {
+    OS_Error_t err, err_unlock;
+
+    // a guest may connect meanwhile
+    if ((err = relay_engine_lock(&engine, TRACE_TRACK_CONTROL))) {
+        Debug_LOG_ERROR("Mutex lock failed, code %d", err);
+        return err;
+    }
+
+    if ((err = relay_engine_start(&side_px4))) {
+        Debug_LOG_ERROR("Initialization of the px4 network stack failed. code: %d", err);
+    } else {
+        if (TRACE_ENABLED &&
+            (err = trace_server_init(&trace_server, &side_px4.sock.socket, &trace_addr))) {
+            Debug_LOG_ERROR("Trace export not available. code: %d", err);
+        }
+        if (connected_links(0, VM_LINKS)) {
+            connect_px4_links();
+        }
+    }
+
+    if ((err_unlock = relay_engine_unlock(&engine))) {
+        Debug_LOG_ERROR("Mutex unlock failed, code %d", err_unlock);
+    }
+    return err;
+}
+
+
+// Fallback for a stack reaching RUNNING without notifying, waits until both
+// sides started and prints the boot time of the stacks
+static OS_Error_t start_sides(void) {
+    nw_stack_wait_t * const stacks[] = { &side_vm.wait, &side_px4.wait };
+    int polls = 0;
+    int pending;
+    OS_Error_t err;
+
+    while ((pending = nw_stacks_poll(stacks, 2))) {
+        if (pending < 0) {
+            return pending;
+        }
+        polls++;
+
+        if ((err = TimeServer_sleep(&timer, TimeServer_PRECISION_MSEC,
+                                    NW_STACK_POLL_INTERVAL_MS))) {
+            Debug_LOG_ERROR("TimeServer_sleep() failed, code %d", err);
+            return err;
+        }
+    }
+
+    uint64_t frequency = timestamp_frequency();
+    uint64_t vm_us = timestamp_to_us(side_vm.wait.t_running - t_boot, frequency);
+    uint64_t px4_us = timestamp_to_us(side_px4.wait.t_running - t_boot, frequency);
+    counter_set(counter_register("boot.vm_stack_us"), vm_us);
+    counter_set(counter_register("boot.px4_stack_us"), px4_us);
+    printf("SerialFilter: network stacks up after %llu us (VM %llu us, PX4 %llu us), %s, %d fallback polls\n",
+           (unsigned long long)(vm_us > px4_us ? vm_us : px4_us),
+           (unsigned long long)vm_us, (unsigned long long)px4_us,
+           NW_STACK_WAIT_SPIN ? "spinning" : "notified", polls);
+    return OS_SUCCESS;
+}
+
+
+//----------------------------------------------------------------------
+// Control thread: waits for the bring-up, then prints the log entries of
+// the relay callbacks, probes the links and prints the counters
+//----------------------------------------------------------------------
+
+// Marks the probes due. Probes still due from the last interval found no
+// traffic to ride on, the control thread sends them itself; it runs above
+// the guest, so the lock is not held across a preemption by it.
+static void probe_links(void) {
+    OS_Error_t err;
+
+    if (!atomic_exchange(&probes_due, true)) {
         return;
     }
-    Debug_LOG_DEBUG("Init done");
+
+    if ((err = relay_engine_lock(&engine, TRACE_TRACK_CONTROL))) {
+        Debug_LOG_ERROR("Mutex lock failed, code %d", err);
+        return;
+    }
+    send_probes();
+    if ((err = relay_engine_unlock(&engine))) {
+        Debug_LOG_ERROR("Mutex unlock failed, code %d", err);
+    }
+}
+
+
+// Busy polling statistics of the socket loop
+static void update_relay_counters(void) {
+    counter_set(c_spin_events, atomic_load(&engine.loop.spin_events));
+    counter_set(c_spin_idle, atomic_load(&engine.loop.spin_idle));
+    counter_set(c_spin_capped, atomic_load(&engine.loop.spin_capped));
+}
+
+
+int run(void) {
+    OS_Error_t err;
+    uint64_t frequency = timestamp_frequency();
+    uint64_t next_probe = 0;
+    uint64_t next_counters = 0;
+
+    if ((err = start_sides())) {
+        Debug_LOG_ERROR("Network stacks not available, code %d", err);
+    }
+
+    for (;;) {
+        for (int i = 0; i < LOG_RING_DRAIN_BATCHES &&
+                        log_ring_drain(LOG_RING_DRAIN_BATCH) == LOG_RING_DRAIN_BATCH; i++) {
+            seL4_Yield();
+        }
+        update_relay_counters();
+
+        uint64_t now = timestamp_ticks();
+        if (LINK_MONITOR_INTERVAL_MS && now >= next_probe) {
+            probe_links();
+            next_probe = now + frequency * LINK_MONITOR_INTERVAL_MS / 1000;
+        }
+        if (COUNTERS_PRINT_INTERVAL_MS && now >= next_counters) {
+            counters_print("SerialFilter");
+            next_counters = now + frequency * COUNTERS_PRINT_INTERVAL_MS / 1000;
+        }
+
+        if ((err = TimeServer_sleep(&timer, TimeServer_PRECISION_MSEC,
+                                    LOG_RING_DRAIN_INTERVAL_MS))) {
+            Debug_LOG_ERROR("TimeServer_sleep() failed, code %d", err);
+            return err;
+        }
+    }
+    return 0;
 }
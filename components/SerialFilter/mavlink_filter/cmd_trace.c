@@ -0,0 +1,212 @@
+/*
+ * Copyright (C) 2023-2024, HENSOLDT Cyber GmbH
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * For commercial licensing, contact: info.cyber@hensoldt.net
+ */
+
+#include <string.h>
+
+#include "common/mavlink.h"
+#include "timestamp.h"
+#include "trace_buf.h"
+
+#include "cmd_trace.h"
+#include "mavlink_filter.h"
+
+typedef enum
+{
+	ENTRY_FREE = 0,
+	ENTRY_PENDING, // passed the filter, not written to PX4 yet
+	ENTRY_WAITING, // forwarded, no ack yet
+	ENTRY_DONE,	   // waiting to be reported
+} entry_state_t;
+
+typedef struct
+{
+	entry_state_t state;
+	uint32_t order; // entries are matched and reported oldest first
+	cmd_trace_entry_t e;
+} slot_t;
+
+static slot_t slots[CMD_TRACE_MAX_ENTRIES];
+static uint32_t next_order;
+static uint32_t read_first; // order of the first command of the current guest read
+static uint64_t t_ingress;
+
+static mavlink_message_t scratch;
+
+static uint64_t timeout_ticks(void)
+{
+	return (uint64_t)CMD_TRACE_TIMEOUT_US * timestamp_frequency() / 1000000;
+}
+
+// Gives up on commands PX4 did not answer in time, they are reported without ack
+static void expire(uint64_t now)
+{
+	uint64_t timeout = timeout_ticks();
+
+	for (int i = 0; i < CMD_TRACE_MAX_ENTRIES; i++)
+	{
+		if (slots[i].state == ENTRY_WAITING && now - slots[i].e.t_ingress > timeout)
+		{
+			slots[i].state = ENTRY_DONE;
+		}
+	}
+}
+
+// A free slot, or the oldest one if all are taken
+static slot_t *alloc_slot(void)
+{
+	slot_t *oldest = &slots[0];
+
+	for (int i = 0; i < CMD_TRACE_MAX_ENTRIES; i++)
+	{
+		if (slots[i].state == ENTRY_FREE)
+		{
+			return &slots[i];
+		}
+		if ((int32_t)(slots[i].order - oldest->order) < 0)
+		{
+			oldest = &slots[i];
+		}
+	}
+	return oldest;
+}
+
+void cmd_trace_ingress(uint64_t t_read)
+{
+	// commands of earlier reads never written to PX4, e.g. while no PX4 link was up
+	for (int i = 0; i < CMD_TRACE_MAX_ENTRIES; i++)
+	{
+		if (slots[i].state == ENTRY_PENDING)
+		{
+			slots[i].state = ENTRY_DONE;
+			slots[i].e.forwarded = false;
+		}
+	}
+	t_ingress = t_read;
+	read_first = next_order;
+}
+
+void cmd_trace_command(uint8_t link, uint8_t sysid, uint8_t compid, uint8_t seq, uint16_t command,
+					   uint8_t target_system, uint8_t target_component, bool forwarded)
+{
+	uint64_t now = timestamp_ticks();
+
+	expire(now);
+
+	slot_t *slot = alloc_slot();
+	slot->state = forwarded ? ENTRY_PENDING : ENTRY_DONE;
+	slot->order = next_order++;
+	slot->e = (cmd_trace_entry_t){
+		.link = link,
+		.sysid = sysid,
+		.compid = compid,
+		.seq = seq,
+		.command = command,
+		.target_system = target_system,
+		.target_component = target_component,
+		.forwarded = forwarded,
+		.result = CMD_TRACE_NO_ACK,
+		.t_ingress = t_ingress,
+		.t_decision = now};
+}
+
+void cmd_trace_egress(uint64_t t_write)
+{
+	for (int i = 0; i < CMD_TRACE_MAX_ENTRIES; i++)
+	{
+		if (slots[i].state == ENTRY_PENDING && (int32_t)(slots[i].order - read_first) >= 0)
+		{
+			slots[i].state = ENTRY_WAITING;
+			slots[i].e.t_egress = t_write;
+		}
+	}
+}
+
+void cmd_trace_handle_frame(const mavlink_frame_t *frame, mavlink_link_mask_t dst, uint64_t t_read)
+{
+	if (frame->msgid != MAVLINK_MSG_ID_COMMAND_ACK || !mavlink_frame_check_crc(frame))
+	{
+		return;
+	}
+
+	// decode functions zero-fill what the sender trimmed off the payload
+	scratch.msgid = frame->msgid;
+	scratch.len = frame->payload_len;
+	memcpy(_MAV_PAYLOAD_NON_CONST(&scratch), frame->payload, frame->payload_len);
+	mavlink_command_ack_t ack;
+	mavlink_msg_command_ack_decode(&scratch, &ack);
+
+	// the final ack follows
+	if (ack.result == MAV_RESULT_IN_PROGRESS)
+	{
+		return;
+	}
+
+	slot_t *match = NULL;
+	for (int i = 0; i < CMD_TRACE_MAX_ENTRIES; i++)
+	{
+		slot_t *s = &slots[i];
+		if (s->state != ENTRY_WAITING || s->e.command != ack.command ||
+			!(dst & MAVLINK_LINK_BIT(s->e.link)) ||
+			(s->e.target_system != 0 && s->e.target_system != frame->sysid) ||
+			(ack.target_system != 0 && ack.target_system != s->e.sysid) ||
+			(ack.target_component != 0 && ack.target_component != s->e.compid))
+		{
+			continue;
+		}
+		if (!match || (int32_t)(s->order - match->order) < 0)
+		{
+			match = s;
+		}
+	}
+	if (!match)
+	{
+		return;
+	}
+
+	match->state = ENTRY_DONE;
+	match->e.result = ack.result;
+	match->e.t_ack_in = t_read;
+	match->e.t_ack_out = timestamp_ticks();
+	trace_span(MAVLINK_FILTER_TRACE_TRACK, "command", match->e.t_ingress, "command", match->e.command);
+}
+
+bool cmd_trace_pop(uint8_t link, cmd_trace_entry_t *out)
+{
+	slot_t *oldest = NULL;
+
+	expire(timestamp_ticks());
+
+	for (int i = 0; i < CMD_TRACE_MAX_ENTRIES; i++)
+	{
+		slot_t *s = &slots[i];
+		if (s->state == ENTRY_DONE && s->e.link == link &&
+			(!oldest || (int32_t)(s->order - oldest->order) < 0))
+		{
+			oldest = s;
+		}
+	}
+	if (!oldest)
+	{
+		return false;
+	}
+
+	*out = oldest->e;
+	oldest->state = ENTRY_FREE;
+	return true;
+}
+
+void cmd_trace_reset_link(uint8_t link)
+{
+	for (int i = 0; i < CMD_TRACE_MAX_ENTRIES; i++)
+	{
+		if (slots[i].e.link == link)
+		{
+			slots[i].state = ENTRY_FREE;
+		}
+	}
+}
@@ -0,0 +1,106 @@
+/*
+ * Copyright (C) 2023-2024, HENSOLDT Cyber GmbH
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * For commercial licensing, contact: info.cyber@hensoldt.net
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "mavlink_router.h"
+#include "mavlink_scan.h"
+
+// Commands followed at a time, the oldest one is given up when a new one arrives
+#define CMD_TRACE_MAX_ENTRIES 32
+
+// A command without COMMAND_ACK after this time is reported without one
+#define CMD_TRACE_TIMEOUT_US 5000000
+
+// result of a command the filter dropped or PX4 never acknowledged
+#define CMD_TRACE_NO_ACK -1
+
+/*
+ * A round trip is reported to the guest as DEBUG_FLOAT_ARRAY named
+ * CMD_TRACE_REPORT_NAME, array_id is the command, time_usec the ingress
+ * time. Durations are in microseconds of the filter's clock, so the guest
+ * gets the time on the network by subtracting the filter's share
+ * (CMD_TRACE_REPORT_RESIDENCE_US) from the round trip it measured.
+ */
+#define CMD_TRACE_REPORT_NAME "CMDTRACE"
+
+enum {
+	CMD_TRACE_REPORT_SEQ,
+	CMD_TRACE_REPORT_SYSID,
+	CMD_TRACE_REPORT_COMPID,
+	CMD_TRACE_REPORT_RESULT,		// CMD_TRACE_NO_ACK or MAV_RESULT
+	CMD_TRACE_REPORT_FORWARDED,		// 0: dropped by the filter
+	CMD_TRACE_REPORT_DECISION_US,	// ingress -> decision
+	CMD_TRACE_REPORT_EGRESS_US,		// decision -> egress
+	CMD_TRACE_REPORT_PX4_US,		// egress -> ack in, PX4 and the network behind the filter
+	CMD_TRACE_REPORT_ACK_US,		// ack in -> ack out
+	CMD_TRACE_REPORT_RESIDENCE_US,	// ingress -> ack out
+	CMD_TRACE_REPORT_LEN
+};
+
+/*
+ * Round trip of one command through the filter. The guest tags a command
+ * with the sequence number in its MAVLink header, so an entry is keyed by
+ * (sysid, compid, seq) of the sender. Timestamps are timestamp_ticks():
+ *
+ *   t_ingress   the read from the guest returned
+ *   t_decision  the filter forwarded or dropped the command
+ *   t_egress    the write to PX4 returned
+ *   t_ack_in    the read from PX4 holding the COMMAND_ACK returned
+ *   t_ack_out   the COMMAND_ACK was handed to the guest link
+ */
+typedef struct {
+	uint8_t link; // VM link the command came from
+	uint8_t sysid;
+	uint8_t compid;
+	uint8_t seq;
+	uint16_t command;
+	uint8_t target_system;
+	uint8_t target_component;
+	bool forwarded;
+	int16_t result; // MAV_RESULT of the ack, CMD_TRACE_NO_ACK without one
+	uint64_t t_ingress;
+	uint64_t t_decision;
+	uint64_t t_egress;
+	uint64_t t_ack_in;
+	uint64_t t_ack_out;
+} cmd_trace_entry_t;
+
+/*
+ * Read time of the guest data passed to the filter next. Commands of the
+ * previous read that were never written to PX4 are reported as dropped.
+ */
+void cmd_trace_ingress(uint64_t t_read);
+
+/*
+ * Records the decision about a command of the current guest read. A dropped
+ * command is complete at once, a forwarded one waits for cmd_trace_egress()
+ * and then for its ack.
+ */
+void cmd_trace_command(uint8_t link, uint8_t sysid, uint8_t compid, uint8_t seq, uint16_t command,
+					   uint8_t target_system, uint8_t target_component, bool forwarded);
+
+/* Stamps the commands forwarded by the current guest read as written to PX4, only those */
+void cmd_trace_egress(uint64_t t_write);
+
+/*
+ * Matches a COMMAND_ACK of the PX4 -> VM traffic against the oldest command
+ * waiting for it on one of the VM links in dst, the links the ack was sent
+ * to. Other frames are ignored. Called after the frame was sent on, t_read
+ * is the time the read from PX4 returned.
+ */
+void cmd_trace_handle_frame(const mavlink_frame_t *frame, mavlink_link_mask_t dst, uint64_t t_read);
+
+/* Takes the oldest completed round trip of a link, false if there is none */
+bool cmd_trace_pop(uint8_t link, cmd_trace_entry_t *out);
+
+/* Drops the entries of a reconnected link */
+void cmd_trace_reset_link(uint8_t link);
@@ -0,0 +1,286 @@
+/*
+ * Copyright (C) 2023-2024, HENSOLDT Cyber GmbH
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * For commercial licensing, contact: info.cyber@hensoldt.net
+ */
+
+#include <string.h>
+
+#include "common/mavlink.h"
+
+#include "egress_sched.h"
+
+egress_class_t egress_classify(uint32_t msgid)
+{
+	switch (msgid)
+	{
+	case MAVLINK_MSG_ID_HEARTBEAT:
+	case MAVLINK_MSG_ID_PING:
+	case MAVLINK_MSG_ID_COMMAND_ACK:
+	case MAVLINK_MSG_ID_STATUSTEXT:
+	case MAVLINK_MSG_ID_TIMESYNC:
+	case MAVLINK_MSG_ID_MISSION_ACK:
+	case MAVLINK_MSG_ID_MISSION_COUNT:
+	case MAVLINK_MSG_ID_MISSION_REQUEST:
+	case MAVLINK_MSG_ID_MISSION_REQUEST_INT:
+		return EGRESS_CLASS_CONTROL;
+
+	case MAVLINK_MSG_ID_ATTITUDE:
+	case MAVLINK_MSG_ID_ATTITUDE_QUATERNION:
+	case MAVLINK_MSG_ID_ATTITUDE_TARGET:
+	case MAVLINK_MSG_ID_HIGHRES_IMU:
+	case MAVLINK_MSG_ID_SCALED_IMU:
+	case MAVLINK_MSG_ID_RAW_IMU:
+	case MAVLINK_MSG_ID_SCALED_PRESSURE:
+	case MAVLINK_MSG_ID_LOCAL_POSITION_NED:
+	case MAVLINK_MSG_ID_POSITION_TARGET_LOCAL_NED:
+	case MAVLINK_MSG_ID_GLOBAL_POSITION_INT:
+	case MAVLINK_MSG_ID_ODOMETRY:
+	case MAVLINK_MSG_ID_VFR_HUD:
+	case MAVLINK_MSG_ID_ALTITUDE:
+	case MAVLINK_MSG_ID_VIBRATION:
+		return EGRESS_CLASS_COALESCE;
+
+	default:
+		return EGRESS_CLASS_NORMAL;
+	}
+}
+
+static void fifo_init(egress_fifo_t *f, uint8_t *buf, size_t size)
+{
+	f->buf = buf;
+	f->size = size;
+	f->head = 0;
+	f->tail = 0;
+}
+
+static inline bool fifo_empty(const egress_fifo_t *f)
+{
+	return f->head == f->tail;
+}
+
+static bool fifo_push(egress_fifo_t *f, const uint8_t *data, size_t len)
+{
+	if (f->size - f->tail < len)
+	{
+		memmove(f->buf, &f->buf[f->head], f->tail - f->head);
+		f->tail -= f->head;
+		f->head = 0;
+
+		if (f->size - f->tail < len)
+		{
+			return false;
+		}
+	}
+
+	memcpy(&f->buf[f->tail], data, len);
+	f->tail += len;
+	return true;
+}
+
+/* Moves whole frames to the tx buffer as long as they fit */
+static void fifo_pop(egress_fifo_t *f, egress_sched_t *q)
+{
+	while (!fifo_empty(f))
+	{
+		size_t len = mavlink_frame_length(&f->buf[f->head], f->tail - f->head);
+		if (EGRESS_TX_LEN - q->tx_tail < len)
+		{
+			return;
+		}
+
+		memcpy(&q->tx[q->tx_tail], &f->buf[f->head], len);
+		q->tx_tail += len;
+		f->head += len;
+	}
+	f->head = 0;
+	f->tail = 0;
+}
+
+static bool coalesce(egress_sched_t *q, const mavlink_frame_t *frame)
+{
+	egress_slot_t *free_slot = NULL;
+
+	for (unsigned int i = 0; i < EGRESS_COALESCE_SLOTS; i++)
+	{
+		egress_slot_t *slot = &q->slots[i];
+		if (slot->len == 0)
+		{
+			if (!free_slot)
+			{
+				free_slot = slot;
+			}
+			continue;
+		}
+		if (slot->msgid == frame->msgid && slot->sysid == frame->sysid && slot->compid == frame->compid)
+		{
+			memcpy(slot->data, frame->data, frame->len);
+			slot->len = frame->len;
+			q->stats.coalesced++;
+			return true;
+		}
+	}
+
+	if (!free_slot)
+	{
+		return false;
+	}
+
+	free_slot->msgid = frame->msgid;
+	free_slot->sysid = frame->sysid;
+	free_slot->compid = frame->compid;
+	memcpy(free_slot->data, frame->data, frame->len);
+	free_slot->len = frame->len;
+	q->num_slots_used++;
+	return true;
+}
+
+static void enqueue(egress_sched_t *q, const mavlink_frame_t *frame)
+{
+	egress_class_t cls = egress_classify(frame->msgid);
+
+	if (cls == EGRESS_CLASS_COALESCE)
+	{
+		if (coalesce(q, frame))
+		{
+			q->stats.queued[cls]++;
+			return;
+		}
+		// all slots taken, keep the sample in order with the rest
+		cls = EGRESS_CLASS_NORMAL;
+	}
+
+	egress_fifo_t *f = (cls == EGRESS_CLASS_CONTROL) ? &q->control : &q->normal;
+	if (!fifo_push(f, frame->data, frame->len))
+	{
+		q->stats.dropped++;
+		return;
+	}
+	q->stats.queued[cls]++;
+}
+
+/* Refills the empty tx buffer in class order */
+static void fill_tx(egress_sched_t *q)
+{
+	q->tx_head = 0;
+	q->tx_tail = 0;
+
+	fifo_pop(&q->control, q);
+	if (!fifo_empty(&q->control))
+	{
+		return;
+	}
+
+	fifo_pop(&q->normal, q);
+	if (!fifo_empty(&q->normal))
+	{
+		return;
+	}
+
+	for (unsigned int i = 0; i < EGRESS_COALESCE_SLOTS && q->num_slots_used > 0; i++)
+	{
+		egress_slot_t *slot = &q->slots[i];
+		if (slot->len == 0 || EGRESS_TX_LEN - q->tx_tail < slot->len)
+		{
+			continue;
+		}
+		memcpy(&q->tx[q->tx_tail], slot->data, slot->len);
+		q->tx_tail += slot->len;
+		slot->len = 0;
+		q->num_slots_used--;
+	}
+}
+
+void egress_init(egress_sched_t *q, egress_write_fn_t write, void *write_ctx)
+{
+	memset(q, 0, sizeof(*q));
+	q->write = write;
+	q->write_ctx = write_ctx;
+	fifo_init(&q->control, q->control_buf, sizeof(q->control_buf));
+	fifo_init(&q->normal, q->normal_buf, sizeof(q->normal_buf));
+}
+
+void egress_reset(egress_sched_t *q)
+{
+	q->tx_head = 0;
+	q->tx_tail = 0;
+	fifo_init(&q->control, q->control_buf, sizeof(q->control_buf));
+	fifo_init(&q->normal, q->normal_buf, sizeof(q->normal_buf));
+	for (unsigned int i = 0; i < EGRESS_COALESCE_SLOTS; i++)
+	{
+		q->slots[i].len = 0;
+	}
+	q->num_slots_used = 0;
+}
+
+void egress_flush(egress_sched_t *q)
+{
+	for (;;)
+	{
+		if (q->tx_head == q->tx_tail)
+		{
+			fill_tx(q);
+			if (q->tx_tail == 0)
+			{
+				return;
+			}
+		}
+
+		size_t n = q->write(q->write_ctx, &q->tx[q->tx_head], q->tx_tail - q->tx_head);
+		q->tx_head += n;
+		if (q->tx_head < q->tx_tail)
+		{
+			q->stats.partial_writes++;
+			return;
+		}
+	}
+}
+
+void egress_send(egress_sched_t *q, const uint8_t *frames, size_t len)
+{
+	size_t written = 0;
+	bool direct = egress_idle(q);
+
+	// nothing is waiting, so the frames go out without being copied
+	if (direct)
+	{
+		written = q->write(q->write_ctx, frames, len);
+		q->stats.direct_writes++;
+		if (written == len)
+		{
+			return;
+		}
+		q->stats.partial_writes++;
+	}
+
+	size_t pos = 0;
+	mavlink_frame_t frame;
+	while (pos < len && mavlink_frame_parse(&frames[pos], len - pos, &frame))
+	{
+		if (pos + frame.len <= written)
+		{
+			// already on the wire
+		}
+		else if (pos < written)
+		{
+			// the socket took the first part of this frame, the rest has to follow
+			size_t tail = pos + frame.len - written;
+			memcpy(q->tx, &frames[written], tail);
+			q->tx_head = 0;
+			q->tx_tail = tail;
+		}
+		else
+		{
+			enqueue(q, &frame);
+		}
+		pos += frame.len;
+	}
+
+	// the socket just came back short, wait for it to signal free space
+	if (!direct)
+	{
+		egress_flush(q);
+	}
+}
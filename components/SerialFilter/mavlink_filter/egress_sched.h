@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) 2023-2024, HENSOLDT Cyber GmbH
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * For commercial licensing, contact: info.cyber@hensoldt.net
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "mavlink_scan.h"
+
+// Bytes handed to the socket in one write, once handed over the order is fixed
+#define EGRESS_TX_LEN 1536
+
+#define EGRESS_CONTROL_LEN 2048
+#define EGRESS_NORMAL_LEN 8192
+
+// Latest-value slots for coalesced telemetry, keyed by (msgid, sysid, compid)
+#define EGRESS_COALESCE_SLOTS 16
+
+typedef enum {
+	EGRESS_CLASS_CONTROL,	// acks, heartbeats, status text: always sent first
+	EGRESS_CLASS_NORMAL,	// everything else, in order
+	EGRESS_CLASS_COALESCE,	// high rate telemetry, only the newest sample is kept
+	EGRESS_NUM_CLASSES
+} egress_class_t;
+
+/* Writes up to len bytes without blocking, returns the number of bytes taken */
+typedef size_t (*egress_write_fn_t)(void *ctx, const uint8_t *buf, size_t len);
+
+/* Complete frames back to back, compacted when the end is reached */
+typedef struct {
+	uint8_t *buf;
+	size_t size;
+	size_t head;
+	size_t tail;
+} egress_fifo_t;
+
+typedef struct {
+	uint32_t msgid;
+	uint8_t sysid;
+	uint8_t compid;
+	uint16_t len;	// 0: slot is empty
+	uint8_t data[MAVLINK_SCAN_MAX_FRAME_LEN];
+} egress_slot_t;
+
+typedef struct {
+	uint32_t direct_writes;
+	uint32_t partial_writes;
+	uint32_t queued[EGRESS_NUM_CLASSES];
+	uint32_t coalesced;
+	uint32_t dropped;
+} egress_stats_t;
+
+/*
+ * Egress scheduler of one link. As long as the socket keeps up, frames are
+ * written straight through. Once a write comes back short, the rest is queued
+ * by class and drained control first, then normal, then coalesced telemetry.
+ */
+typedef struct {
+	egress_write_fn_t write;
+	void *write_ctx;
+
+	// Bytes already committed to the stream, e.g. the tail of a cut frame
+	uint8_t tx[EGRESS_TX_LEN];
+	size_t tx_head;
+	size_t tx_tail;
+
+	egress_fifo_t control;
+	egress_fifo_t normal;
+	uint8_t control_buf[EGRESS_CONTROL_LEN];
+	uint8_t normal_buf[EGRESS_NORMAL_LEN];
+	egress_slot_t slots[EGRESS_COALESCE_SLOTS];
+	unsigned int num_slots_used;
+
+	egress_stats_t stats;
+} egress_sched_t;
+
+void egress_init(egress_sched_t *q, egress_write_fn_t write, void *write_ctx);
+
+/* Drops everything queued, e.g. when the link was closed */
+void egress_reset(egress_sched_t *q);
+
+egress_class_t egress_classify(uint32_t msgid);
+
+/* Sends a buffer of complete frames, queuing whatever the socket does not take */
+void egress_send(egress_sched_t *q, const uint8_t *frames, size_t len);
+
+/* Writes queued frames until the socket stops taking data */
+void egress_flush(egress_sched_t *q);
+
+static inline bool egress_idle(const egress_sched_t *q)
+{
+	return q->tx_head == q->tx_tail &&
+		   q->control.head == q->control.tail &&
+		   q->normal.head == q->normal.tail &&
+		   q->num_slots_used == 0;
+}
@@ -0,0 +1,251 @@
+/*
+ * Copyright (C) 2023-2024, HENSOLDT Cyber GmbH
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * For commercial licensing, contact: info.cyber@hensoldt.net
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "lib_debug/Debug.h"
+#include "system_config.h"
+
+#include "counters.h"
+#include "log_ring.h"
+#include "timestamp.h"
+
+#include "link_monitor.h"
+#include "mavlink_filter.h"
+
+typedef struct
+{
+	link_monitor_stats_t stats;
+
+	// probe waiting for its answers, ts1/time_usec carry the send time in us
+	uint64_t sent_us;
+	uint32_t ping_seq;
+	bool ping_pending;
+	bool timesync_pending;
+
+	counter_t *c_rtt;
+	counter_t *c_rttvar;
+	counter_t *c_offset;
+	counter_t *c_lost;
+	counter_t *c_degraded;
+} monitor_t;
+
+static monitor_t monitors[LINK_MONITOR_MAX_LINKS];
+
+static mavlink_message_t probe_msg;
+static mavlink_message_t scratch;
+
+static uint64_t now_us(void)
+{
+	return timestamp_to_us(timestamp_ticks(), timestamp_frequency());
+}
+
+static void update_degraded(uint8_t link, monitor_t *m)
+{
+	bool degraded = m->stats.lost_in_row >= LINK_MONITOR_DEGRADED_LOST ||
+					m->stats.rtt_us > LINK_MONITOR_DEGRADED_RTT_MS * 1000;
+
+	if (degraded != m->stats.degraded)
+	{
+		if (degraded)
+		{
+			LOG_RING_ERROR("Link %u degraded: rtt %u us, %u probes lost in a row",
+						   link, m->stats.rtt_us, m->stats.lost_in_row);
+		}
+		else
+		{
+			LOG_RING_INFO("Link %u recovered: rtt %u us", link, m->stats.rtt_us);
+		}
+		m->stats.degraded = degraded;
+		counter_set(m->c_degraded, degraded);
+	}
+}
+
+static void add_rtt_sample(uint8_t link, monitor_t *m, uint32_t rtt)
+{
+	link_monitor_stats_t *s = &m->stats;
+
+	s->answers++;
+	s->lost_in_row = 0;
+	s->last_rtt_us = rtt;
+	if (!s->rtt_us)
+	{
+		s->rtt_us = rtt;
+		s->rttvar_us = rtt / 2;
+	}
+	else
+	{
+		// rttvar += (|srtt - rtt| - rttvar) / 4, srtt += (rtt - srtt) / 8
+		uint32_t err = s->rtt_us > rtt ? s->rtt_us - rtt : rtt - s->rtt_us;
+		s->rttvar_us = s->rttvar_us - s->rttvar_us / 4 + err / 4;
+		s->rtt_us = s->rtt_us - s->rtt_us / 8 + rtt / 8;
+	}
+	counter_set(m->c_rtt, s->rtt_us);
+	counter_set(m->c_rttvar, s->rttvar_us);
+	update_degraded(link, m);
+}
+
+static bool handle_ping(uint8_t link, monitor_t *m, const mavlink_message_t *msg)
+{
+	mavlink_ping_t ping;
+	mavlink_msg_ping_decode(msg, &ping);
+
+	// a request from the peer, or an answer to someone else
+	if (ping.target_system != LINK_MONITOR_SYSID || ping.target_component != LINK_MONITOR_COMPID)
+	{
+		return false;
+	}
+
+	// the first answer of a probe gives the RTT sample, a TIMESYNC may have been faster
+	if (m->ping_pending && ping.seq == m->ping_seq && ping.time_usec == m->sent_us)
+	{
+		m->ping_pending = false;
+		add_rtt_sample(link, m, (uint32_t)(now_us() - m->sent_us));
+	}
+	return true;
+}
+
+static bool handle_timesync(uint8_t link, monitor_t *m, const mavlink_message_t *msg)
+{
+	mavlink_timesync_t ts;
+	mavlink_msg_timesync_decode(msg, &ts);
+
+	// PX4 before v1.14 does not fill in the target, the probe is known by ts1
+	bool ours = ts.target_system == LINK_MONITOR_SYSID ||
+				(ts.target_system == 0 && m->timesync_pending && ts.ts1 == (int64_t)m->sent_us * 1000);
+	if (ts.tc1 == 0 || !ours)
+	{
+		return false;
+	}
+
+	if (m->timesync_pending && ts.ts1 == (int64_t)m->sent_us * 1000)
+	{
+		uint64_t now = now_us();
+		m->timesync_pending = false;
+
+		// the peer's time is taken as the middle of the round trip
+		m->stats.offset_us = ts.tc1 / 1000 - (int64_t)(m->sent_us + now) / 2;
+		m->stats.offset_valid = true;
+		counter_set(m->c_offset, m->stats.offset_us);
+
+		if (m->ping_pending)
+		{
+			m->ping_pending = false;
+			add_rtt_sample(link, m, (uint32_t)(now - m->sent_us));
+		}
+	}
+	return true;
+}
+
+void link_monitor_init(uint8_t link, const char *fmt, int index)
+{
+	monitor_t *m = &monitors[link];
+	char name[COUNTERS_NAME_LEN];
+
+	snprintf(name, sizeof(name), fmt, index);
+	m->c_rtt = counter_register("%s.rtt_us", name);
+	m->c_rttvar = counter_register("%s.rttvar_us", name);
+	m->c_offset = counter_register("%s.offset_us", name);
+	m->c_lost = counter_register("%s.lost", name);
+	m->c_degraded = counter_register("%s.degraded", name);
+	link_monitor_reset(link);
+}
+
+void link_monitor_reset(uint8_t link)
+{
+	monitor_t *m = &monitors[link];
+
+	memset(&m->stats, 0, sizeof(m->stats));
+	m->ping_pending = false;
+	m->timesync_pending = false;
+	counter_set(m->c_rtt, 0);
+	counter_set(m->c_rttvar, 0);
+	counter_set(m->c_offset, 0);
+	counter_set(m->c_lost, 0);
+	counter_set(m->c_degraded, 0);
+}
+
+size_t link_monitor_probe(uint8_t link, uint8_t *buf, bool sign)
+{
+	monitor_t *m = &monitors[link];
+	size_t len = 0;
+
+	if (m->ping_pending && m->timesync_pending)
+	{
+		m->stats.lost++;
+		m->stats.lost_in_row++;
+		counter_set(m->c_lost, m->stats.lost);
+		update_degraded(link, m);
+	}
+
+	m->sent_us = now_us();
+	m->ping_seq = m->stats.probes++;
+	m->ping_pending = true;
+	m->timesync_pending = true;
+
+	// target 0 asks the peer to answer
+	mavlink_ping_t ping = {
+		.time_usec = m->sent_us,
+		.seq = m->ping_seq,
+		.target_system = 0,
+		.target_component = 0};
+	mavlink_msg_ping_encode_chan(LINK_MONITOR_SYSID, LINK_MONITOR_COMPID, MAVLINK_FILTER_TX_CHAN, &probe_msg, &ping);
+	len += mavlink_msg_to_send_buffer(&buf[len], &probe_msg);
+	if (sign)
+	{
+		len = mavlink_filter_sign_px4(buf, len);
+	}
+
+	size_t ofs = len;
+	mavlink_timesync_t ts = {
+		.tc1 = 0,
+		.ts1 = (int64_t)m->sent_us * 1000,
+		.target_system = 0,
+		.target_component = 0};
+	mavlink_msg_timesync_encode_chan(LINK_MONITOR_SYSID, LINK_MONITOR_COMPID, MAVLINK_FILTER_TX_CHAN, &probe_msg, &ts);
+	len += mavlink_msg_to_send_buffer(&buf[ofs], &probe_msg);
+	if (sign)
+	{
+		len = ofs + mavlink_filter_sign_px4(&buf[ofs], len - ofs);
+	}
+	return len;
+}
+
+bool link_monitor_handle_message(uint8_t link, const mavlink_message_t *msg)
+{
+	switch (msg->msgid)
+	{
+	case MAVLINK_MSG_ID_PING:
+		return handle_ping(link, &monitors[link], msg);
+	case MAVLINK_MSG_ID_TIMESYNC:
+		return handle_timesync(link, &monitors[link], msg);
+	default:
+		return false;
+	}
+}
+
+bool link_monitor_handle_frame(uint8_t link, const mavlink_frame_t *frame)
+{
+	if ((frame->msgid != MAVLINK_MSG_ID_PING && frame->msgid != MAVLINK_MSG_ID_TIMESYNC) ||
+		!mavlink_frame_check_crc(frame))
+	{
+		return false;
+	}
+
+	// decode functions zero-fill what the sender trimmed off the payload
+	scratch.msgid = frame->msgid;
+	scratch.len = frame->payload_len;
+	memcpy(_MAV_PAYLOAD_NON_CONST(&scratch), frame->payload, frame->payload_len);
+	return link_monitor_handle_message(link, &scratch);
+}
+
+const link_monitor_stats_t *link_monitor_stats(uint8_t link)
+{
+	return &monitors[link].stats;
+}
@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2023-2024, HENSOLDT Cyber GmbH
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * For commercial licensing, contact: info.cyber@hensoldt.net
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "common/mavlink.h"
+
+#include "mavlink_router.h"
+#include "mavlink_scan.h"
+
+#define LINK_MONITOR_MAX_LINKS MAVLINK_ROUTER_MAX_LINKS
+
+// Buffer for one probe: a PING and a TIMESYNC, each with room for a signature
+#define LINK_MONITOR_PROBE_LEN (2 * MAVLINK_SCAN_MAX_FRAME_LEN)
+
+/*
+ * Latency of a link, estimated from probes the filter sends itself. Every
+ * probe is a PING, answered by PX4 and MAVSDK, and a TIMESYNC, answered by
+ * PX4 only, which also gives the offset of the peer's clock. The RTT is
+ * smoothed like TCP does (RFC 6298).
+ */
+typedef struct {
+	uint32_t probes;
+	uint32_t answers;
+	uint32_t lost;		   // probes unanswered when the next one was sent
+	uint32_t lost_in_row;
+	uint32_t rtt_us;	   // smoothed, 0 until the first answer
+	uint32_t rttvar_us;
+	uint32_t last_rtt_us;
+	int64_t offset_us;	   // peer clock - filter clock
+	bool offset_valid;
+	bool degraded;
+} link_monitor_stats_t;
+
+/* Sets up a link and its counters, named like printf, e.g. "vm%d" */
+void link_monitor_init(uint8_t link, const char *fmt, int index);
+
+/* Forgets the estimate, e.g. when the link was reconnected */
+void link_monitor_reset(uint8_t link);
+
+/*
+ * Writes the next probe for a link to buf, at least LINK_MONITOR_PROBE_LEN
+ * bytes, signed like the filter's traffic to PX4 if sign is set. A previous
+ * probe without any answer counts as lost. Returns the number of bytes
+ * written.
+ */
+size_t link_monitor_probe(uint8_t link, uint8_t *buf, bool sign);
+
+/*
+ * Checks a frame received on the link for an answer to a probe. Returns true
+ * if the frame is addressed to the monitor and must not be forwarded.
+ */
+bool link_monitor_handle_frame(uint8_t link, const mavlink_frame_t *frame);
+
+/* Same for a message parsed by the filter */
+bool link_monitor_handle_message(uint8_t link, const mavlink_message_t *msg);
+
+const link_monitor_stats_t *link_monitor_stats(uint8_t link);
@@ -7,23 +7,146 @@
  */
 
 #include <stdio.h>
+#include <string.h>
 #include <sys/types.h>
 #include "lib_debug/Debug.h"
+#include "log_ring.h"
+#include "timestamp.h"
+#include "trace_buf.h"
 
 #include "common/mavlink.h"
 
+#include "cmd_trace.h"
+#include "link_monitor.h"
 #include "mavlink_filter.h"
+#include "mavlink_signing.h"
+#include "mavlink_signing_key.h" // generated, see MAVLINK_SIGNING_KEY_FILE
+#include "param_cache.h"
+#include "rate_governor.h"
 #include "geofence.h"
+#include "vehicle_state.h"
 
 mavlink_status_t status;
 mavlink_message_t msg;
-uint8_t chan = MAVLINK_COMM_0;
+uint8_t msg_link;
+bool msg_modified; // msg has to be serialized again before it is forwarded
+
+_Static_assert(MAVLINK_FILTER_TX_CHAN < MAVLINK_COMM_NUM_BUFFERS, "not enough MAVLink channels");
+
+// Pending PARAM_REQUEST_READ answers per link
+#define PARAM_READ_QUEUE_LEN 8
+
+// Pending COMMAND_ACKs for commands the filter rejected, per link
+#define ACK_QUEUE_LEN 4
+
+// Start of the signing clock in UNIX s until PX4 sends its time, see MAVLINK_SIGNING_CLOCK_START
+#ifndef MAVLINK_SIGNING_BUILD_TIME
+#define MAVLINK_SIGNING_BUILD_TIME 0
+#endif
+
+// Signature verification of VM -> PX4 traffic and signing towards PX4
+mavlink_signing_t signing_vm;
+mavlink_signing_t signing_px4;
+bool signing_key_valid; // without a key every frame fails verification and signing
+
+// End of the log download or FTP read of a VM link in timestamp_ticks(), 0 if
+// there is none. Renewed by every request and by the data PX4 sends, so a
+// guest that disappears without LOG_REQUEST_END or TERMINATE_SESSION only
+// keeps it for MAVLINK_BULK_IDLE_TIMEOUT_MS.
+uint64_t bulk_until[MAVLINK_FILTER_MAX_LINKS];
+
+static uint64_t bulk_deadline(void)
+{
+	return timestamp_ticks() + timestamp_frequency() * MAVLINK_BULK_IDLE_TIMEOUT_MS / 1000;
+}
+
+typedef struct
+{
+	uint16_t command;
+	uint8_t result;
+	uint8_t sysid; // sender of the command, the ack comes from its target
+	uint8_t compid;
+	uint8_t target_system;
+	uint8_t target_component;
+} ack_t;
+
+// MISSION_ACK for a mission upload the filter rejected
+typedef struct
+{
+	bool pending;
+	uint8_t type; // MAV_MISSION_RESULT
+	uint8_t mission_type;
+	uint8_t sysid; // sender of the upload, the ack comes from its target
+	uint8_t compid;
+	uint8_t target_system;
+	uint8_t target_component;
+} mission_ack_t;
+
+// Messages the filter answers itself instead of forwarding them to PX4
+typedef struct
+{
+	uint16_t list_next; // list_next == list_end: no PARAM_REQUEST_LIST answer pending
+	uint16_t list_end;
+	uint16_t reads[PARAM_READ_QUEUE_LEN];
+	uint8_t num_reads;
+	ack_t acks[ACK_QUEUE_LEN];
+	uint8_t num_acks;
+	mission_ack_t mission_ack; // one upload per link at a time
+	uint8_t tx_seq; // sequence of the answers on this link
+} replies_t;
+
+replies_t replies[MAVLINK_FILTER_MAX_LINKS];
+mavlink_message_t reply;
+
+// Message rates requested per VM link
+rate_governor_t rate_governors[MAVLINK_FILTER_MAX_LINKS];
+
+// MAVLink FTP opcodes, only the ones that do not modify the vehicle are forwarded
+enum
+{
+	FTP_OP_NONE = 0,
+	FTP_OP_TERMINATE_SESSION = 1,
+	FTP_OP_RESET_SESSIONS = 2,
+	FTP_OP_LIST_DIRECTORY = 3,
+	FTP_OP_OPEN_FILE_RO = 4,
+	FTP_OP_READ_FILE = 5,
+	FTP_OP_CALC_FILE_CRC32 = 14,
+	FTP_OP_BURST_READ_FILE = 15,
+};
+
+// Offset of the opcode in the FTP payload: seq_number (2), session (1)
+#define FTP_OPCODE_OFS 3
+
+bool check_signature(const uint8_t *frame, size_t len)
+{
+	if (!MAVLINK_SIGNING_VERIFY_VM)
+	{
+		return true;
+	}
+	if (!signing_key_valid)
+	{
+		return false;
+	}
+
+	switch (mavlink_signing_verify(&signing_vm, frame, len))
+	{
+	case MAVLINK_SIGNING_OK:
+		// keep our own signing timestamp ahead of what the VM uses
+		mavlink_signing_update_timestamp(&signing_px4, signing_vm.timestamp);
+		return true;
+	case MAVLINK_SIGNING_UNSIGNED:
+		return MAVLINK_SIGNING_ACCEPT_UNSIGNED;
+	default:
+		LOG_RING_TRACE("MAVLink: Signature check failed for message %d from %d/%d", msg.msgid, msg.sysid, msg.compid);
+		return false;
+	}
+}
 
 bool check_coordinates(coordinate_t *cord)
 {
 	if (isnan(cord->latitude) || isnan(cord->longitude))
 	{
-		Debug_LOG_TRACE("MAVLink: Invalid Coordinate: NaN, NaN\n");
+		LOG_RING_TRACE("MAVLink: Invalid Coordinate: NaN, NaN");
 		return false;
 	}
 
@@ -36,13 +159,122 @@ bool check_coordinates(coordinate_t *cord)
 	{
 		// Illegal move outside the fence -> land the drone
 
-		Debug_LOG_TRACE("MAVLink: Target coordinates outside of geofence!\n");
+		LOG_RING_TRACE("MAVLink: Target coordinates outside of geofence!");
 		// land
 		coordinate_t home_cord = HOME_POSITION;
 		memcpy(cord, &home_cord, sizeof(coordinate_t));
 		return true;
 	}
-	Debug_LOG_TRACE("MAVLink: Coordinate is valid!");
+	LOG_RING_TRACE("MAVLink: Coordinate is valid!");
+	return false;
+}
+
+// Sender of an answer on behalf of the target of a request. A broadcast
+// target is answered by the autopilot, as PX4 would do.
+void answer_sender(uint8_t *sysid, uint8_t *compid)
+{
+	vehicle_state_t vehicle;
+
+	if (*sysid != 0 && *compid != 0)
+	{
+		return;
+	}
+	if (vehicle_state_get(*sysid, &vehicle))
+	{
+		*sysid = vehicle.sysid;
+		*compid = *compid ? *compid : vehicle.compid;
+	}
+	else if (*compid == 0)
+	{
+		*compid = MAV_COMP_ID_AUTOPILOT1;
+	}
+}
+
+void reject_command(uint16_t command, uint8_t target_system, uint8_t target_component)
+{
+	replies_t *r = &replies[msg_link];
+	if (r->num_acks == ACK_QUEUE_LEN)
+	{
+		return;
+	}
+
+	answer_sender(&target_system, &target_component);
+	r->acks[r->num_acks++] = (ack_t){
+		.command = command,
+		.result = MAV_RESULT_DENIED,
+		.sysid = target_system,
+		.compid = target_component,
+		.target_system = msg.sysid,
+		.target_component = msg.compid};
+}
+
+void reject_mission(uint8_t type, uint8_t mission_type, uint8_t target_system, uint8_t target_component)
+{
+	answer_sender(&target_system, &target_component);
+	replies[msg_link].mission_ack = (mission_ack_t){
+		.pending = true,
+		.type = type,
+		.mission_type = mission_type,
+		.sysid = target_system,
+		.compid = target_component,
+		.target_system = msg.sysid,
+		.target_component = msg.compid};
+}
+
+/*
+ * Writes a changed payload back to msg, keeping message id, sender and
+ * sequence number. The signature of a signed message does not match
+ * afterwards, the caller checks can_update_message() first.
+ */
+void update_message(const void *payload, uint8_t min_len, uint8_t len, uint8_t crc_extra)
+{
+	mavlink_status_t tx_status = {0};
+
+	tx_status.current_tx_seq = msg.seq;
+	if (msg.magic == MAVLINK_STX_MAVLINK1)
+	{
+		tx_status.flags |= MAVLINK_STATUS_FLAG_OUT_MAVLINK1;
+	}
+
+	memcpy(_MAV_PAYLOAD_NON_CONST(&msg), payload, len);
+	mavlink_finalize_message_buffer(&msg, msg.sysid, msg.compid, &tx_status, min_len, len, crc_extra);
+	msg_modified = true;
+}
+
+// A signed message may only be changed if the filter signs it again for PX4
+bool can_update_message(void)
+{
+	return MAVLINK_SIGNING_SIGN_PX4 || !(msg.incompat_flags & MAVLINK_IFLAG_SIGNED);
+}
+
+/*
+ * MAV_CMD_SET_MESSAGE_INTERVAL as COMMAND_LONG or COMMAND_INT, both carry
+ * the message id in param1 and the interval in param2. Returns true if the
+ * request is denied, *changed if *interval was raised and msg has to be
+ * updated.
+ */
+bool handle_mavlink_set_message_interval(float msgid, float *interval, bool *changed,
+										 uint8_t target_system, uint8_t target_component)
+{
+	float requested = *interval;
+
+	if (!rate_governor_request(&rate_governors[msg_link], (uint32_t)msgid, interval))
+	{
+		reject_command(MAV_CMD_SET_MESSAGE_INTERVAL, target_system, target_component);
+		return true;
+	}
+
+	*changed = *interval != requested;
+	if (*changed && !can_update_message())
+	{
+		// the guest asks again with an interval the governor accepts as is
+		reject_command(MAV_CMD_SET_MESSAGE_INTERVAL, target_system, target_component);
+		return true;
+	}
+	if (*changed)
+	{
+		Debug_LOG_TRACE("MAVLink: Interval of message %u raised to %f\n", (unsigned int)msgid, *interval);
+	}
 	return false;
 }
 
@@ -55,44 +287,290 @@ bool handle_mavlink_command_long()
 	switch (cmd_long.command)
 	{
 	case 21: // MAV_CMD_NAV_LAND
-		Debug_LOG_TRACE("MAVLink: Land");
+		LOG_RING_TRACE("MAVLink: Land");
 		cord = (coordinate_t){
 			.latitude = cmd_long.param5,
 			.longitude = cmd_long.param6,
 			.altitude = cmd_long.param7};
 		return check_coordinates(&cord);
 	case 22: // MAV_CMD_NAV_TAKEOFF
-		Debug_LOG_TRACE("MAVLink: Takeoff");
+		LOG_RING_TRACE("MAVLink: Takeoff");
 		cord = (coordinate_t){
 			.latitude = cmd_long.param5,
 			.longitude = cmd_long.param6,
 			.altitude = cmd_long.param7};
 		return check_coordinates(&cord);
 	case 176: // MAV_CMD_DO_SET_MODE
-		Debug_LOG_TRACE("MAVLink: Do set mode");
+		LOG_RING_TRACE("MAVLink: Do set mode");
 		Debug_LOG_TRACE("MAVLink: Do set mode: 1: %f, 2: %f, 3: %f\n", cmd_long.param1, cmd_long.param2, cmd_long.param3);
 		break;
 	case 400: // MAV_CMD_COMPONENT_ARM_DISARM
-		Debug_LOG_TRACE("MAVLink: Arm Disarm\n");
+		LOG_RING_TRACE("MAVLink: Arm Disarm");
 		break;
 	case 511: // MAV_CMD_SET_MESSAGE_INTERVAL
-		Debug_LOG_TRACE("MAVLink: set message interval\n");
+	{
+		bool changed = false;
+		LOG_RING_TRACE("MAVLink: set message interval");
 		Debug_LOG_TRACE("MAVLink: Interval: %f\n", cmd_long.param2);
+		if (handle_mavlink_set_message_interval(cmd_long.param1, &cmd_long.param2, &changed,
+												cmd_long.target_system, cmd_long.target_component))
+		{
+			LOG_RING_TRACE("MAVLink: Message rate budget of link %u exceeded", msg_link);
+			return true;
+		}
+		if (changed)
+		{
+			update_message(&cmd_long, MAVLINK_MSG_ID_COMMAND_LONG_MIN_LEN,
+						   MAVLINK_MSG_ID_COMMAND_LONG_LEN, MAVLINK_MSG_ID_COMMAND_LONG_CRC);
+		}
 		break;
+	}
 	case 512: // MAV_CMD_REQUEST_MESSAGE
-		Debug_LOG_TRACE("MAVLink: request message\n");
+		LOG_RING_TRACE("MAVLink: request message");
 		break;
 	default:
-		Debug_LOG_TRACE("MAVLink: Unknown MAV CMD: %u\n", cmd_long.command);
+		LOG_RING_TRACE("MAVLink: Unknown MAV CMD: %u", cmd_long.command);
 		return true;
 	}
 	return false;
 }
 
+bool param_request_for_cache(uint8_t target_system, uint8_t target_component)
+{
+	const param_cache_info_t *cache = param_cache_info();
+
+	return MAVLINK_PARAM_CACHE_ENABLED && cache->sysid != 0 && target_system == cache->sysid &&
+		   (target_component == cache->compid || target_component == 0);
+}
+
+// returns true if the request is answered from the cache
+bool handle_mavlink_param_request_list()
+{
+	mavlink_param_request_list_t req;
+	mavlink_msg_param_request_list_decode(&msg, &req);
+
+	if (!param_request_for_cache(req.target_system, req.target_component) || !param_cache_complete())
+	{
+		LOG_RING_TRACE("MAVLink: Param request list forwarded");
+		return false;
+	}
+
+	replies_t *r = &replies[msg_link];
+	r->list_next = 0;
+	r->list_end = param_cache_info()->count;
+	return true;
+}
+
+// returns true if the request is answered from the cache
+bool handle_mavlink_param_request_read()
+{
+	mavlink_param_request_read_t req;
+	mavlink_msg_param_request_read_decode(&msg, &req);
+
+	if (!param_request_for_cache(req.target_system, req.target_component))
+	{
+		return false;
+	}
+
+	int index = req.param_index >= 0 ? req.param_index : param_cache_find(req.param_id);
+	replies_t *r = &replies[msg_link];
+	if (index < 0 || !param_cache_get(index) || r->num_reads == PARAM_READ_QUEUE_LEN)
+	{
+		return false;
+	}
+
+	r->reads[r->num_reads++] = index;
+	return true;
+}
+
+bool handle_mavlink_param_set()
+{
+	if (!MAVLINK_PARAM_SET_ALLOWED)
+	{
+		return true;
+	}
+
+	mavlink_param_set_t set;
+	mavlink_msg_param_set_decode(&msg, &set);
+
+	// stale until PX4 confirms the new value with a PARAM_VALUE
+	if (param_request_for_cache(set.target_system, set.target_component))
+	{
+		param_cache_invalidate(set.param_id);
+	}
+	return false;
+}
+
+bool handle_mavlink_log_request()
+{
+	if (!MAVLINK_BULK_TRANSFER_ENABLED)
+	{
+		return true;
+	}
+
+	switch (msg.msgid)
+	{
+	case MAVLINK_MSG_ID_LOG_REQUEST_DATA:
+		LOG_RING_TRACE("MAVLink: Log request data");
+		bulk_until[msg_link] = bulk_deadline();
+		break;
+	case MAVLINK_MSG_ID_LOG_REQUEST_END:
+		LOG_RING_TRACE("MAVLink: Log request end");
+		bulk_until[msg_link] = 0;
+		break;
+	default:
+		LOG_RING_TRACE("MAVLink: Log request list");
+		break;
+	}
+	return false;
+}
+
+bool handle_mavlink_ftp()
+{
+	if (!MAVLINK_BULK_TRANSFER_ENABLED)
+	{
+		return true;
+	}
+
+	uint8_t payload[MAVLINK_MSG_FILE_TRANSFER_PROTOCOL_FIELD_PAYLOAD_LEN];
+	mavlink_msg_file_transfer_protocol_get_payload(&msg, payload);
+
+	switch (payload[FTP_OPCODE_OFS])
+	{
+	case FTP_OP_OPEN_FILE_RO:
+	case FTP_OP_READ_FILE:
+	case FTP_OP_BURST_READ_FILE:
+	case FTP_OP_LIST_DIRECTORY:
+		bulk_until[msg_link] = bulk_deadline();
+		break;
+	case FTP_OP_TERMINATE_SESSION:
+	case FTP_OP_RESET_SESSIONS:
+		bulk_until[msg_link] = 0;
+		break;
+	case FTP_OP_NONE:
+	case FTP_OP_CALC_FILE_CRC32:
+		break;
+	default:
+		LOG_RING_TRACE("MAVLink: FTP opcode %u not allowed", payload[FTP_OPCODE_OFS]);
+		return true;
+	}
+	LOG_RING_TRACE("MAVLink: FTP opcode %u", payload[FTP_OPCODE_OFS]);
+	return false;
+}
+
+// returns MAV_MISSION_ACCEPTED if the item may be forwarded
+uint8_t check_mission_item(const mavlink_mission_item_int_t *item)
+{
+	if (item->mission_type != MAV_MISSION_TYPE_MISSION)
+	{
+		return MAV_MISSION_DENIED;
+	}
+
+	switch (item->command)
+	{
+	case 16: // MAV_CMD_NAV_WAYPOINT
+	case 17: // MAV_CMD_NAV_LOITER_UNLIM
+	case 19: // MAV_CMD_NAV_LOITER_TIME
+	case 21: // MAV_CMD_NAV_LAND
+	case 22: // MAV_CMD_NAV_TAKEOFF
+		break;
+	case 20:  // MAV_CMD_NAV_RETURN_TO_LAUNCH
+	case 93:  // MAV_CMD_NAV_DELAY
+	case 178: // MAV_CMD_DO_CHANGE_SPEED
+		return MAV_MISSION_ACCEPTED;
+	default:
+		LOG_RING_TRACE("MAVLink: Unknown mission item command: %u", item->command);
+		return MAV_MISSION_UNSUPPORTED;
+	}
+
+	switch (item->frame)
+	{
+	case MAV_FRAME_GLOBAL:
+	case MAV_FRAME_GLOBAL_RELATIVE_ALT:
+	case MAV_FRAME_GLOBAL_TERRAIN_ALT:
+	case MAV_FRAME_GLOBAL_INT:
+	case MAV_FRAME_GLOBAL_RELATIVE_ALT_INT:
+	case MAV_FRAME_GLOBAL_TERRAIN_ALT_INT:
+		break;
+	default:
+		return MAV_MISSION_UNSUPPORTED_FRAME;
+	}
+
+	coordinate_t cord = {
+		.latitude = ((double)item->x) * 0.0000001,
+		.longitude = ((double)item->y) * 0.0000001,
+		.altitude = item->z};
+	return check_coordinates(&cord) ? MAV_MISSION_INVALID_PARAM5_X : MAV_MISSION_ACCEPTED;
+}
+
+// returns true if the message is dropped
+bool handle_mavlink_mission()
+{
+	if (!MAVLINK_MISSION_ENABLED)
+	{
+		return true;
+	}
+
+	uint8_t mission_type;
+	switch (msg.msgid)
+	{
+	case MAVLINK_MSG_ID_MISSION_COUNT:
+		// geofence and rally points stay as configured on PX4
+		mission_type = mavlink_msg_mission_count_get_mission_type(&msg);
+		if (mission_type != MAV_MISSION_TYPE_MISSION)
+		{
+			reject_mission(MAV_MISSION_DENIED, mission_type,
+						   mavlink_msg_mission_count_get_target_system(&msg),
+						   mavlink_msg_mission_count_get_target_component(&msg));
+			return true;
+		}
+		LOG_RING_TRACE("MAVLink: Mission upload of %u items", mavlink_msg_mission_count_get_count(&msg));
+		return false;
+	case MAVLINK_MSG_ID_MISSION_CLEAR_ALL:
+		return mavlink_msg_mission_clear_all_get_mission_type(&msg) != MAV_MISSION_TYPE_MISSION;
+	case MAVLINK_MSG_ID_MISSION_ITEM_INT:
+	{
+		mavlink_mission_item_int_t item;
+		mavlink_msg_mission_item_int_decode(&msg, &item);
+		uint8_t result = check_mission_item(&item);
+		if (result != MAV_MISSION_ACCEPTED)
+		{
+			// PX4 drops the upload after its timeout, the VM learns at once
+			reject_mission(result, item.mission_type, item.target_system, item.target_component);
+			return true;
+		}
+		return false;
+	}
+	default:
+		// downloads, acks and MISSION_SET_CURRENT do not change the plan
+		return false;
+	}
+}
+
 bool handle_mavlink_command_int()
 {
 	mavlink_command_int_t cmd_int;
 	mavlink_msg_command_int_decode(&msg, &cmd_int);
+
+	// the rates are governed whichever command message asks for them
+	if (cmd_int.command == MAV_CMD_SET_MESSAGE_INTERVAL)
+	{
+		bool changed = false;
+		LOG_RING_TRACE("MAVLink: set message interval (int)");
+		if (handle_mavlink_set_message_interval(cmd_int.param1, &cmd_int.param2, &changed,
+												cmd_int.target_system, cmd_int.target_component))
+		{
+			LOG_RING_TRACE("MAVLink: Message rate budget of link %u exceeded", msg_link);
+			return true;
+		}
+		if (changed)
+		{
+			update_message(&cmd_int, MAVLINK_MSG_ID_COMMAND_INT_MIN_LEN,
+						   MAVLINK_MSG_ID_COMMAND_INT_LEN, MAVLINK_MSG_ID_COMMAND_INT_CRC);
+		}
+		return false;
+	}
+
 	coordinate_t cord = {
 		.latitude = ((double)cmd_int.x) * 0.0000001,
 		.longitude = ((double)cmd_int.y) * 0.0000001,
@@ -112,46 +590,404 @@ bool handle_mavlink_command_int()
 	*/
 }
 
+// Follows the round trip of a command, the guest's sequence number is its tag
+void trace_command(bool forwarded)
+{
+	switch (msg.msgid)
+	{
+	case MAVLINK_MSG_ID_COMMAND_LONG:
+		cmd_trace_command(msg_link, msg.sysid, msg.compid, msg.seq,
+						  mavlink_msg_command_long_get_command(&msg),
+						  mavlink_msg_command_long_get_target_system(&msg),
+						  mavlink_msg_command_long_get_target_component(&msg), forwarded);
+		break;
+	case MAVLINK_MSG_ID_COMMAND_INT:
+		cmd_trace_command(msg_link, msg.sysid, msg.compid, msg.seq,
+						  mavlink_msg_command_int_get_command(&msg),
+						  mavlink_msg_command_int_get_target_system(&msg),
+						  mavlink_msg_command_int_get_target_component(&msg), forwarded);
+		break;
+	default:
+		break;
+	}
+}
+
 void handle_mavlink_package(char *buf, size_t *len, char *ret_buf, size_t *ret_len)
 {
+	// serialize in place, the frame is only committed to ret_buf if it passes
+	uint8_t *frame = (uint8_t *)&ret_buf[*ret_len];
+	size_t frame_len = mavlink_msg_to_send_buffer(frame, &msg);
+
+	msg_modified = false;
+
+	if (!check_signature(frame, frame_len))
+	{
+		LOG_RING_ERROR("MAVLink error: Invalid signature, message %d dropped", msg.msgid);
+		return;
+	}
+
 	switch (msg.msgid)
 	{
 	case MAVLINK_MSG_ID_HEARTBEAT: // ID 0
-		Debug_LOG_TRACE("MAVLink: Heartbeat\n");
+		LOG_RING_TRACE("MAVLink: Heartbeat");
 		break;
 	case MAVLINK_MSG_ID_PING: // ID 4
-		Debug_LOG_TRACE("MAVLink: Ping\n");
+		LOG_RING_TRACE("MAVLink: Ping");
+		if (link_monitor_handle_message(msg_link, &msg))
+		{
+			// answer to the filter's own probe
+			return;
+		}
 		break;
+	case MAVLINK_MSG_ID_TIMESYNC:
+		// only answers to the filter's probes are expected, nothing goes to PX4
+		if (!link_monitor_handle_message(msg_link, &msg))
+		{
+			LOG_RING_ERROR("MAVLink error: Timesync from the VM dropped");
+		}
+		return;
 	case MAVLINK_MSG_ID_COMMAND_LONG:
-		Debug_LOG_TRACE("MAVLink: Command Long\n");
+		LOG_RING_TRACE("MAVLink: Command Long");
 		if (handle_mavlink_command_long())
 		{
-			Debug_LOG_ERROR("MAVLink error: Packet is malicous and will be dropped");
+			LOG_RING_ERROR("MAVLink error: Packet is malicous and will be dropped");
 			return;
 		}
 		break;
 	case MAVLINK_MSG_ID_COMMAND_INT:
-		Debug_LOG_TRACE("MAVLink: Command int");
+		LOG_RING_TRACE("MAVLink: Command int");
 		if (handle_mavlink_command_int())
 		{
-			Debug_LOG_ERROR("MAVLink error: Packet is malicous and will be dropped");
+			LOG_RING_ERROR("MAVLink error: Packet is malicous and will be dropped");
 			return;
 		}
 		break;
 	case MAVLINK_MSG_ID_PARAM_REQUEST_READ:
-		Debug_LOG_TRACE("MAVLink: Param request read\n");
+		LOG_RING_TRACE("MAVLink: Param request read");
+		if (handle_mavlink_param_request_read())
+		{
+			LOG_RING_TRACE("MAVLink: Param request read answered from cache");
+			return;
+		}
+		break;
+	case MAVLINK_MSG_ID_PARAM_REQUEST_LIST:
+		LOG_RING_TRACE("MAVLink: Param request list");
+		if (handle_mavlink_param_request_list())
+		{
+			LOG_RING_TRACE("MAVLink: Param request list answered from cache");
+			return;
+		}
+		if (!MAVLINK_PARAM_REQUEST_LIST_FORWARDED)
+		{
+			LOG_RING_ERROR("MAVLink error: Param request list not answered from cache, dropped");
+			return;
+		}
+		break;
+	case MAVLINK_MSG_ID_PARAM_SET:
+		LOG_RING_TRACE("MAVLink: Param set");
+		if (handle_mavlink_param_set())
+		{
+			LOG_RING_ERROR("MAVLink error: Param set not allowed, message dropped");
+			return;
+		}
+		break;
+	case MAVLINK_MSG_ID_LOG_REQUEST_LIST:
+	case MAVLINK_MSG_ID_LOG_REQUEST_DATA:
+	case MAVLINK_MSG_ID_LOG_REQUEST_END:
+		if (handle_mavlink_log_request())
+		{
+			LOG_RING_ERROR("MAVLink error: Log download disabled, message %d dropped", msg.msgid);
+			return;
+		}
+		break;
+	case MAVLINK_MSG_ID_MISSION_COUNT:
+	case MAVLINK_MSG_ID_MISSION_ITEM_INT:
+	case MAVLINK_MSG_ID_MISSION_REQUEST_LIST:
+	case MAVLINK_MSG_ID_MISSION_REQUEST_INT:
+	case MAVLINK_MSG_ID_MISSION_ACK:
+	case MAVLINK_MSG_ID_MISSION_SET_CURRENT:
+	case MAVLINK_MSG_ID_MISSION_CLEAR_ALL:
+		LOG_RING_TRACE("MAVLink: Mission protocol message %d", msg.msgid);
+		if (handle_mavlink_mission())
+		{
+			LOG_RING_ERROR("MAVLink error: Mission item rejected, message %d dropped", msg.msgid);
+			return;
+		}
+		break;
+	case MAVLINK_MSG_ID_FILE_TRANSFER_PROTOCOL:
+		if (handle_mavlink_ftp())
+		{
+			LOG_RING_ERROR("MAVLink error: FTP request rejected and will be dropped");
+			return;
+		}
 		break;
 	default:
-		Debug_LOG_ERROR("MAVLink error: Unknown MAVLINK MSG ID %i\n Message Dropped", msg.msgid);
+		LOG_RING_ERROR("MAVLink error: Unknown MAVLINK MSG ID %d, message dropped", msg.msgid);
+		return;
+	}
+
+	if (msg_modified)
+	{
+		frame_len = mavlink_msg_to_send_buffer(frame, &msg);
+	}
+
+	if (!(frame_len = mavlink_filter_sign_px4(frame, frame_len)))
+	{
+		LOG_RING_ERROR("MAVLink error: Message %d cannot be signed, dropped", msg.msgid);
 		return;
 	}
+	*ret_len += frame_len;
+}
 
-	size_t added_len = mavlink_msg_to_send_buffer((uint8_t *)&ret_buf[*ret_len], &msg);
-	*ret_len += added_len;
+static int hex_digit(char c)
+{
+	if (c >= '0' && c <= '9')
+	{
+		return c - '0';
+	}
+	if (c >= 'a' && c <= 'f')
+	{
+		return c - 'a' + 10;
+	}
+	if (c >= 'A' && c <= 'F')
+	{
+		return c - 'A' + 10;
+	}
+	return -1;
 }
 
-void filter_mavlink_message(char *message, size_t *nread, char *ret_buf, size_t *ret_len)
+static bool parse_key(const char *hex, uint8_t key[SHA256_KEY_LEN])
 {
+	for (int i = 0; i < SHA256_KEY_LEN; i++)
+	{
+		int hi = hex_digit(hex[2 * i]);
+		int lo = hi < 0 ? -1 : hex_digit(hex[2 * i + 1]);
+		if (lo < 0)
+		{
+			return false;
+		}
+		key[i] = (uint8_t)(hi << 4 | lo);
+	}
+	return hex[2 * SHA256_KEY_LEN] == '\0';
+}
+
+void mavlink_filter_init(void)
+{
+	uint8_t key[SHA256_KEY_LEN] = {0};
+
+	signing_key_valid = parse_key(MAVLINK_SIGNING_KEY, key);
+	if (!signing_key_valid && (MAVLINK_SIGNING_VERIFY_VM || MAVLINK_SIGNING_SIGN_PX4))
+	{
+		Debug_LOG_ERROR("MAVLink signing enabled without a valid MAVLINK_SIGNING_KEY_FILE, "
+						"all frames to PX4 are dropped");
+	}
+
+	mavlink_signing_init(&signing_vm, 0, key);
+	mavlink_signing_init(&signing_px4, MAVLINK_SIGNING_LINK_ID_PX4, key);
+	mavlink_signing_set_clock(&signing_px4, MAVLINK_SIGNING_BUILD_TIME * 1000000ULL);
+	memset(key, 0, sizeof(key));
+
+	for (int i = 0; i < MAVLINK_FILTER_MAX_LINKS; i++)
+	{
+		rate_governor_reset(&rate_governors[i]);
+	}
+}
+
+void mavlink_filter_handle_px4_frame(const mavlink_frame_t *frame)
+{
+	static mavlink_message_t scratch;
+	mavlink_system_time_t t;
+
+	if (frame->msgid == MAVLINK_MSG_ID_LOG_DATA || frame->msgid == MAVLINK_MSG_ID_FILE_TRANSFER_PROTOCOL)
+	{
+		// the transfer is still running, e.g. PX4 streams a log for a single request
+		uint64_t now = timestamp_ticks();
+		for (int i = 0; i < MAVLINK_FILTER_MAX_LINKS; i++)
+		{
+			if (bulk_until[i] > now)
+			{
+				bulk_until[i] = bulk_deadline();
+			}
+		}
+		return;
+	}
+
+	if (!MAVLINK_SIGNING_SIGN_PX4 || frame->msgid != MAVLINK_MSG_ID_SYSTEM_TIME ||
+		!mavlink_frame_check_crc(frame))
+	{
+		return;
+	}
+
+	// decode zero-fills what the sender trimmed off the payload
+	scratch.msgid = frame->msgid;
+	scratch.len = frame->payload_len;
+	memcpy(_MAV_PAYLOAD_NON_CONST(&scratch), frame->payload, frame->payload_len);
+	mavlink_msg_system_time_decode(&scratch, &t);
+
+	// 0 until PX4 has a time source, e.g. GPS
+	mavlink_signing_set_clock(&signing_px4, t.time_unix_usec);
+}
+
+void mavlink_filter_reset_link(uint8_t link)
+{
+	mavlink_reset_channel_status(MAVLINK_COMM_0 + link);
+	bulk_until[link] = 0;
+	replies[link].list_next = 0;
+	replies[link].list_end = 0;
+	replies[link].num_reads = 0;
+	replies[link].num_acks = 0;
+	replies[link].mission_ack.pending = false;
+	replies[link].tx_seq = 0;
+	// PX4 keeps sending the granted streams after the guest reconnected, so
+	// their budget stays taken until the link asks for other rates
+	cmd_trace_reset_link(link);
+}
+
+static size_t pack_param_value(uint8_t *buf, uint16_t index)
+{
+	const param_cache_info_t *cache = param_cache_info();
+	const param_entry_t *p = param_cache_get(index);
+	if (!p)
+	{
+		return 0;
+	}
+
+	// sent on behalf of the autopilot, as if it had answered itself
+	mavlink_msg_param_value_pack_chan(cache->sysid, cache->compid, MAVLINK_FILTER_TX_CHAN, &reply,
+									  p->id, p->value, p->type, cache->count, index);
+	return mavlink_msg_to_send_buffer(buf, &reply);
+}
+
+static size_t pack_command_ack(uint8_t *buf, const ack_t *ack)
+{
+	mavlink_msg_command_ack_pack_chan(ack->sysid, ack->compid, MAVLINK_FILTER_TX_CHAN, &reply,
+									  ack->command, ack->result, 0, 0,
+									  ack->target_system, ack->target_component);
+	return mavlink_msg_to_send_buffer(buf, &reply);
+}
+
+static size_t pack_mission_ack(uint8_t *buf, const mission_ack_t *ack)
+{
+	mavlink_mission_ack_t m = {
+		.target_system = ack->target_system,
+		.target_component = ack->target_component,
+		.type = ack->type,
+		.mission_type = ack->mission_type};
+
+	mavlink_msg_mission_ack_encode_chan(ack->sysid, ack->compid, MAVLINK_FILTER_TX_CHAN, &reply, &m);
+	return mavlink_msg_to_send_buffer(buf, &reply);
+}
+
+static size_t pack_cmd_trace(uint8_t *buf, const cmd_trace_entry_t *e)
+{
+	uint64_t f = timestamp_frequency();
+	float data[MAVLINK_MSG_DEBUG_FLOAT_ARRAY_FIELD_DATA_LEN] = {0};
+
+	_Static_assert(CMD_TRACE_REPORT_LEN <= MAVLINK_MSG_DEBUG_FLOAT_ARRAY_FIELD_DATA_LEN, "report too long");
+	data[CMD_TRACE_REPORT_SEQ] = e->seq;
+	data[CMD_TRACE_REPORT_SYSID] = e->sysid;
+	data[CMD_TRACE_REPORT_COMPID] = e->compid;
+	data[CMD_TRACE_REPORT_RESULT] = e->result;
+	data[CMD_TRACE_REPORT_FORWARDED] = e->forwarded;
+	data[CMD_TRACE_REPORT_DECISION_US] = timestamp_to_us(e->t_decision - e->t_ingress, f);
+	if (e->t_egress)
+	{
+		data[CMD_TRACE_REPORT_EGRESS_US] = timestamp_to_us(e->t_egress - e->t_decision, f);
+	}
+	if (e->t_ack_out)
+	{
+		data[CMD_TRACE_REPORT_PX4_US] = timestamp_to_us(e->t_ack_in - e->t_egress, f);
+		data[CMD_TRACE_REPORT_ACK_US] = timestamp_to_us(e->t_ack_out - e->t_ack_in, f);
+		data[CMD_TRACE_REPORT_RESIDENCE_US] = timestamp_to_us(e->t_ack_out - e->t_ingress, f);
+	}
+
+	// sent on behalf of the command's target, like the acks the filter generates
+	uint8_t sysid = e->target_system;
+	uint8_t compid = e->target_component;
+	answer_sender(&sysid, &compid);
+	mavlink_msg_debug_float_array_pack_chan(sysid, compid, MAVLINK_FILTER_TX_CHAN, &reply,
+											timestamp_to_us(e->t_ingress, f), CMD_TRACE_REPORT_NAME, e->command, data);
+	return mavlink_msg_to_send_buffer(buf, &reply);
+}
+
+size_t mavlink_filter_get_replies(uint8_t link, char *buf, size_t size)
+{
+	replies_t *r = &replies[link];
+	mavlink_status_t *tx = mavlink_get_channel_status(MAVLINK_FILTER_TX_CHAN);
+	cmd_trace_entry_t trace;
+	size_t len = 0;
+
+	// The answers are sent on behalf of the autopilot, each link gets its own
+	// gapless sequence for them instead of a share of the TX channel's
+	tx->current_tx_seq = r->tx_seq;
+
+	while (size - len >= MAVLINK_MAX_PACKET_LEN)
+	{
+		uint8_t *frame = (uint8_t *)&buf[len];
+
+		if (r->mission_ack.pending)
+		{
+			len += pack_mission_ack(frame, &r->mission_ack);
+			r->mission_ack.pending = false;
+		}
+		else if (r->num_acks > 0)
+		{
+			len += pack_command_ack(frame, &r->acks[0]);
+			memmove(&r->acks[0], &r->acks[1], --r->num_acks * sizeof(r->acks[0]));
+		}
+		else if (MAVLINK_CMD_TRACE_ENABLED && cmd_trace_pop(link, &trace))
+		{
+			len += pack_cmd_trace(frame, &trace);
+		}
+		else if (r->num_reads > 0)
+		{
+			len += pack_param_value(frame, r->reads[0]);
+			memmove(&r->reads[0], &r->reads[1], --r->num_reads * sizeof(r->reads[0]));
+		}
+		else if (r->list_next < r->list_end)
+		{
+			// an entry invalidated meanwhile is skipped, the guest asks for it again
+			len += pack_param_value(frame, r->list_next++);
+		}
+		else
+		{
+			break;
+		}
+	}
+	r->tx_seq = tx->current_tx_seq;
+	return len;
+}
+
+size_t mavlink_filter_sign_px4(uint8_t *frame, size_t len)
+{
+	if (!MAVLINK_SIGNING_SIGN_PX4)
+	{
+		return len;
+	}
+	// MAVLink 1 frames cannot be signed, PX4 expecting signed frames would drop them
+	return signing_key_valid ? mavlink_signing_sign(&signing_px4, frame, len) : 0;
+}
+
+bool mavlink_filter_bulk_active(void)
+{
+	uint64_t now = timestamp_ticks();
+
+	for (int i = 0; i < MAVLINK_FILTER_MAX_LINKS; i++)
+	{
+		if (bulk_until[i] > now)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+void filter_mavlink_message(uint8_t link, char *message, size_t *nread, char *ret_buf, size_t *ret_len)
+{
+	uint8_t chan = MAVLINK_COMM_0 + link;
+
+	msg_link = link;
+
 	for (int i = 0; i < *nread; i++)
 	{
 		uint8_t byte = message[i];
@@ -159,8 +995,14 @@ void filter_mavlink_message(char *message, size_t *nread, char *ret_buf, size_t
 		// this has state -> return 1 if package decoding is complete
 		if (mavlink_parse_char(chan, byte, &msg, &status))
 		{
-			Debug_LOG_TRACE("MAVLink: Received message with ID %d, sequence: %d from component %d of system %d\n", msg.msgid, msg.seq, msg.compid, msg.sysid);
+			LOG_RING_TRACE("MAVLink: Received message with ID %d, sequence: %d from component %d of system %d", msg.msgid, msg.seq, msg.compid, msg.sysid);
+			size_t len_before = *ret_len;
 			handle_mavlink_package(message, nread, ret_buf, ret_len);
+			trace_instant(MAVLINK_FILTER_TRACE_TRACK, *ret_len != len_before ? "forward" : "drop", "msgid", msg.msgid);
+			if (MAVLINK_CMD_TRACE_ENABLED)
+			{
+				trace_command(*ret_len != len_before);
+			}
 		}
 	}
 }
\ No newline at end of file
@@ -7,8 +7,11 @@
  */
 
 #pragma once
+#include <stdbool.h>
+#include <stdint.h>
 #include <sys/types.h>
 #include "OS_Error.h"
+#include "mavlink_scan.h"
 
 typedef struct {
 	float latitude;
@@ -17,4 +20,40 @@ typedef struct {
 } coordinate_t;
 
 
-void filter_mavlink_message(char *, size_t *, char * , size_t *);
+// Output buffer size for an input of in_size bytes. Frames may grow by their
+// signature and one frame can be carried over from the previous input.
+#define MAVLINK_FILTER_OUT_BUF_SIZE(in_size) (2 * (in_size) + 280)
+
+// Number of VM links that can be filtered in parallel
+#define MAVLINK_FILTER_MAX_LINKS 3
+
+// Each VM link is parsed on its own channel, one more is left for the
+// messages the filter sends itself
+#define MAVLINK_FILTER_TX_CHAN (MAVLINK_COMM_0 + MAVLINK_FILTER_MAX_LINKS)
+
+// Trace track the forward/drop decision of every message is recorded on
+#define MAVLINK_FILTER_TRACE_TRACK 3
+
+void mavlink_filter_init(void);
+
+// Drops a partially parsed message, e.g. when the link was reconnected
+void mavlink_filter_reset_link(uint8_t link);
+
+// Writes answers the filter generated for the link, e.g. from the parameter
+// cache, returns the number of bytes written to buf
+size_t mavlink_filter_get_replies(uint8_t link, char *buf, size_t size);
+
+// Signs a frame to PX4, if MAVLINK_SIGNING_SIGN_PX4 is set. buf needs room
+// for the signature, returns the new frame length or 0 if the frame must not
+// be sent: it is MAVLink 1 or no signing key is configured.
+size_t mavlink_filter_sign_px4(uint8_t *frame, size_t len);
+
+// Takes the time of PX4 for signing from its SYSTEM_TIME and keeps bulk
+// transfers alive, called with every frame of the PX4 -> VM traffic
+void mavlink_filter_handle_px4_frame(const mavlink_frame_t *frame);
+
+// True while a guest downloads a log or reads files through MAVLink FTP, at
+// most MAVLINK_BULK_IDLE_TIMEOUT_MS after the last request or data
+bool mavlink_filter_bulk_active(void);
+
+void filter_mavlink_message(uint8_t link, char *, size_t *, char * , size_t *);
@@ -0,0 +1,112 @@
+/*
+ * Copyright (C) 2023-2024, HENSOLDT Cyber GmbH
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * For commercial licensing, contact: info.cyber@hensoldt.net
+ */
+
+#include "common/mavlink.h"
+
+#include "mavlink_router.h"
+
+_Static_assert(MAVLINK_ROUTER_TABLE_SIZE <= 255, "entry index + 1 must fit into uint8_t");
+
+static void get_target(const mavlink_frame_t *frame, uint8_t *sysid, uint8_t *compid)
+{
+	const mavlink_msg_entry_t *entry = mavlink_get_msg_entry(frame->msgid);
+
+	*sysid = 0;
+	*compid = 0;
+	if (!entry)
+	{
+		return;
+	}
+
+	// trailing zeros may have been trimmed off the payload
+	if ((entry->flags & MAVLINK_MSG_ENTRY_FLAG_HAVE_TARGET_SYSTEM) &&
+		entry->target_system_ofs < frame->payload_len)
+	{
+		*sysid = frame->payload[entry->target_system_ofs];
+	}
+	if ((entry->flags & MAVLINK_MSG_ENTRY_FLAG_HAVE_TARGET_COMPONENT) &&
+		entry->target_component_ofs < frame->payload_len)
+	{
+		*compid = frame->payload[entry->target_component_ofs];
+	}
+}
+
+void mavlink_router_learn(mavlink_router_t *r, uint8_t sysid, uint8_t compid, uint8_t link)
+{
+	if (sysid == 0)
+	{
+		return;
+	}
+
+	for (unsigned int i = r->systems[sysid]; i; i = r->routes[i - 1].next)
+	{
+		mavlink_route_t *route = &r->routes[i - 1];
+		if (route->compid == compid)
+		{
+			route->link = link;
+			return;
+		}
+	}
+
+	if (r->num_routes >= MAVLINK_ROUTER_TABLE_SIZE)
+	{
+		r->table_full++;
+		return;
+	}
+	mavlink_route_t *route = &r->routes[r->num_routes++];
+	route->sysid = sysid;
+	route->compid = compid;
+	route->link = link;
+	route->next = r->systems[sysid];
+	r->systems[sysid] = r->num_routes;
+}
+
+void mavlink_router_forget_link(mavlink_router_t *r, uint8_t link)
+{
+	for (unsigned int i = 0; i < r->num_routes; i++)
+	{
+		if (r->routes[i].link == link)
+		{
+			r->routes[i].link = MAVLINK_ROUTER_NO_LINK;
+		}
+	}
+}
+
+mavlink_link_mask_t mavlink_router_route(const mavlink_router_t *r, const mavlink_frame_t *frame,
+										 mavlink_link_mask_t candidates)
+{
+	uint8_t target_sys, target_comp;
+
+	get_target(frame, &target_sys, &target_comp);
+	if (target_sys == 0)
+	{
+		return candidates;
+	}
+
+	mavlink_link_mask_t sys_links = 0;
+	mavlink_link_mask_t comp_links = 0;
+
+	for (unsigned int i = r->systems[target_sys]; i; i = r->routes[i - 1].next)
+	{
+		const mavlink_route_t *route = &r->routes[i - 1];
+		if (route->link == MAVLINK_ROUTER_NO_LINK)
+		{
+			continue;
+		}
+		sys_links |= MAVLINK_LINK_BIT(route->link);
+		if (route->compid == target_comp)
+		{
+			comp_links |= MAVLINK_LINK_BIT(route->link);
+		}
+	}
+
+	mavlink_link_mask_t links = (target_comp != 0 && comp_links) ? comp_links : sys_links;
+	links &= candidates;
+
+	return links ? links : candidates;
+}
@@ -0,0 +1,60 @@
+/*
+ * Copyright (C) 2023-2024, HENSOLDT Cyber GmbH
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * For commercial licensing, contact: info.cyber@hensoldt.net
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include "mavlink_scan.h"
+
+#define MAVLINK_ROUTER_MAX_LINKS 8
+#define MAVLINK_ROUTER_NO_LINK 0xFF
+
+// Number of (sysid, compid) entries, at most 255
+#define MAVLINK_ROUTER_TABLE_SIZE 128
+
+typedef uint8_t mavlink_link_mask_t;
+
+#define MAVLINK_LINK_BIT(link) ((mavlink_link_mask_t)(1u << (link)))
+
+/*
+ * Route to a (sysid, compid). Entries are never removed, a closed link only
+ * clears the link id.
+ */
+typedef struct {
+	uint8_t sysid;
+	uint8_t compid;
+	uint8_t link;
+	uint8_t next; // next entry of the same system + 1, 0 ends the list
+} mavlink_route_t;
+
+/*
+ * Entries are taken from a fixed pool and listed per system, the list of a
+ * sysid starts at systems[sysid]. A lookup only touches the components of
+ * the target system.
+ */
+typedef struct {
+	uint8_t systems[256]; // first entry + 1, 0 if the system is unknown
+	mavlink_route_t routes[MAVLINK_ROUTER_TABLE_SIZE];
+	uint16_t num_routes;
+	uint32_t table_full;
+} mavlink_router_t;
+
+/* Records that (sysid, compid) is reachable through link */
+void mavlink_router_learn(mavlink_router_t *r, uint8_t sysid, uint8_t compid, uint8_t link);
+
+/* Drops the link from all routes, e.g. after the connection was closed */
+void mavlink_router_forget_link(mavlink_router_t *r, uint8_t link);
+
+/*
+ * Returns the links out of candidates the frame has to be sent to. Targeted
+ * messages go to the links owning the target only, untargeted messages and
+ * messages to unknown targets go to all candidates.
+ */
+mavlink_link_mask_t mavlink_router_route(const mavlink_router_t *r, const mavlink_frame_t *frame,
+										 mavlink_link_mask_t candidates);
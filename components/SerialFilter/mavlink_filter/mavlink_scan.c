@@ -0,0 +1,150 @@
+/*
+ * Copyright (C) 2023-2024, HENSOLDT Cyber GmbH
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * For commercial licensing, contact: info.cyber@hensoldt.net
+ */
+
+#include <string.h>
+
+#include "common/mavlink.h"
+
+#include "mavlink_scan.h"
+
+#define HDR_LEN_V1 6
+#define HDR_LEN_V2 MAVLINK_NUM_HEADER_BYTES
+
+size_t mavlink_frame_length(const uint8_t *p, size_t avail)
+{
+	if (p[0] == MAVLINK_STX)
+	{
+		if (avail < 3)
+		{
+			return 0;
+		}
+		return HDR_LEN_V2 + p[1] + MAVLINK_NUM_CHECKSUM_BYTES +
+			   ((p[2] & MAVLINK_IFLAG_SIGNED) ? MAVLINK_SIGNATURE_BLOCK_LEN : 0);
+	}
+	if (avail < 2)
+	{
+		return 0;
+	}
+	return HDR_LEN_V1 + p[1] + MAVLINK_NUM_CHECKSUM_BYTES;
+}
+
+bool mavlink_frame_parse(const uint8_t *p, size_t avail, mavlink_frame_t *frame)
+{
+	size_t len = mavlink_frame_length(p, avail);
+	if (len == 0 || len > avail)
+	{
+		return false;
+	}
+
+	frame->data = p;
+	frame->len = len;
+	frame->payload_len = p[1];
+	frame->v2 = (p[0] == MAVLINK_STX);
+
+	if (frame->v2)
+	{
+		frame->payload = &p[HDR_LEN_V2];
+		frame->seq = p[4];
+		frame->sysid = p[5];
+		frame->compid = p[6];
+		frame->msgid = p[7] | (p[8] << 8) | ((uint32_t)p[9] << 16);
+	}
+	else
+	{
+		frame->payload = &p[HDR_LEN_V1];
+		frame->seq = p[2];
+		frame->sysid = p[3];
+		frame->compid = p[4];
+		frame->msgid = p[5];
+	}
+	return true;
+}
+
+static void emit_frame(mavlink_scanner_t *sc, const uint8_t *p, size_t len, mavlink_frame_cb_t cb, void *ctx)
+{
+	mavlink_frame_t frame;
+
+	mavlink_frame_parse(p, len, &frame);
+	sc->frames++;
+	cb(&frame, ctx);
+}
+
+void mavlink_scanner_reset(mavlink_scanner_t *sc)
+{
+	sc->partial_len = 0;
+}
+
+void mavlink_scan(mavlink_scanner_t *sc, const uint8_t *data, size_t len, mavlink_frame_cb_t cb, void *ctx)
+{
+	size_t pos = 0;
+
+	// complete the frame carried over from the previous call first
+	while (sc->partial_len > 0 && pos < len)
+	{
+		size_t need = mavlink_frame_length(sc->partial, sc->partial_len);
+		if (need == 0)
+		{
+			sc->partial[sc->partial_len++] = data[pos++];
+			continue;
+		}
+
+		size_t n = need - sc->partial_len;
+		if (n > len - pos)
+		{
+			n = len - pos;
+		}
+		memcpy(&sc->partial[sc->partial_len], &data[pos], n);
+		sc->partial_len += n;
+		pos += n;
+
+		if (sc->partial_len == need)
+		{
+			emit_frame(sc, sc->partial, need, cb, ctx);
+			sc->partial_len = 0;
+		}
+	}
+
+	while (pos < len)
+	{
+		const uint8_t *p = &data[pos];
+		if (*p != MAVLINK_STX && *p != MAVLINK_STX_MAVLINK1)
+		{
+			sc->skipped_bytes++;
+			pos++;
+			continue;
+		}
+
+		size_t avail = len - pos;
+		size_t need = mavlink_frame_length(p, avail);
+		if (need == 0 || need > avail)
+		{
+			memcpy(sc->partial, p, avail);
+			sc->partial_len = avail;
+			return;
+		}
+
+		emit_frame(sc, p, need, cb, ctx);
+		pos += need;
+	}
+}
+
+bool mavlink_frame_check_crc(const mavlink_frame_t *frame)
+{
+	const mavlink_msg_entry_t *entry = mavlink_get_msg_entry(frame->msgid);
+	if (!entry)
+	{
+		return false;
+	}
+
+	size_t crc_ofs = (frame->v2 ? HDR_LEN_V2 : HDR_LEN_V1) + frame->payload_len;
+	uint16_t crc = crc_calculate(&frame->data[1], crc_ofs - 1);
+	crc_accumulate(entry->crc_extra, &crc);
+
+	return frame->data[crc_ofs] == (uint8_t)(crc & 0xFF) &&
+		   frame->data[crc_ofs + 1] == (uint8_t)(crc >> 8);
+}
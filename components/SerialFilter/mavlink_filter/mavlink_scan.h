@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) 2023-2024, HENSOLDT Cyber GmbH
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * For commercial licensing, contact: info.cyber@hensoldt.net
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+// Largest MAVLink 2 frame: header (10), payload (255), CRC (2), signature (13)
+#define MAVLINK_SCAN_MAX_FRAME_LEN 280
+
+/*
+ * A complete frame found in the byte stream. Only the header is looked at,
+ * neither the CRC is checked nor the payload decoded.
+ */
+typedef struct {
+	const uint8_t *data;
+	size_t len;
+	const uint8_t *payload;
+	uint8_t payload_len;
+	uint32_t msgid;
+	uint8_t seq;
+	uint8_t sysid;
+	uint8_t compid;
+	bool v2;
+} mavlink_frame_t;
+
+typedef void (*mavlink_frame_cb_t)(const mavlink_frame_t *frame, void *ctx);
+
+/* Stream scanner state, a frame split across two reads is carried over */
+typedef struct {
+	uint8_t partial[MAVLINK_SCAN_MAX_FRAME_LEN];
+	size_t partial_len;
+	uint32_t frames;
+	uint32_t skipped_bytes;
+} mavlink_scanner_t;
+
+void mavlink_scanner_reset(mavlink_scanner_t *sc);
+
+/* Total length of the frame starting at p, 0 if the header is incomplete */
+size_t mavlink_frame_length(const uint8_t *p, size_t avail);
+
+/* Fills in the header fields of the frame starting at p, false if incomplete */
+bool mavlink_frame_parse(const uint8_t *p, size_t avail, mavlink_frame_t *frame);
+
+/* Splits data into frames and calls cb for each complete frame */
+void mavlink_scan(mavlink_scanner_t *sc, const uint8_t *data, size_t len, mavlink_frame_cb_t cb, void *ctx);
+
+/* Checks the CRC of a frame, including the CRC_EXTRA of the message */
+bool mavlink_frame_check_crc(const mavlink_frame_t *frame);
@@ -0,0 +1,182 @@
+/*
+ * Copyright (C) 2023-2024, HENSOLDT Cyber GmbH
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * For commercial licensing, contact: info.cyber@hensoldt.net
+ */
+
+#include <string.h>
+
+#include "common/mavlink.h"
+
+#include "mavlink_signing.h"
+#include "timestamp.h"
+
+// Offset of the payload in a MAVLink 2 frame
+#define FRAME_HDR_LEN MAVLINK_NUM_HEADER_BYTES
+
+static uint64_t load_le48(const uint8_t *p)
+{
+	uint64_t v = 0;
+	for (int i = 5; i >= 0; i--)
+	{
+		v = (v << 8) | p[i];
+	}
+	return v;
+}
+
+static void store_le48(uint8_t *p, uint64_t v)
+{
+	for (int i = 0; i < 6; i++)
+	{
+		p[i] = (uint8_t)v;
+		v >>= 8;
+	}
+}
+
+static mavlink_signing_stream_t *find_stream(mavlink_signing_t *s, uint8_t link_id, uint8_t sysid, uint8_t compid)
+{
+	for (int i = 0; i < s->num_streams; i++)
+	{
+		mavlink_signing_stream_t *st = &s->streams[i];
+		if (st->link_id == link_id && st->sysid == sysid && st->compid == compid)
+		{
+			return st;
+		}
+	}
+	return NULL;
+}
+
+void mavlink_signing_init(mavlink_signing_t *s, uint8_t link_id, const uint8_t key[SHA256_KEY_LEN])
+{
+	memset(s, 0, sizeof(*s));
+	sha256_keyed_init(&s->key, key);
+	s->link_id = link_id;
+}
+
+void mavlink_signing_update_timestamp(mavlink_signing_t *s, uint64_t timestamp)
+{
+	if (timestamp > s->timestamp)
+	{
+		s->timestamp = timestamp;
+	}
+}
+
+bool mavlink_signing_set_clock(mavlink_signing_t *s, uint64_t unix_usec)
+{
+	if (unix_usec <= MAVLINK_SIGNING_EPOCH_UNIX_US)
+	{
+		return false;
+	}
+	s->clock = (unix_usec - MAVLINK_SIGNING_EPOCH_UNIX_US) / 10;
+	s->clock_ticks = timestamp_ticks();
+	return true;
+}
+
+// Signing time of the clock now, 0 without a clock
+static uint64_t clock_now(const mavlink_signing_t *s)
+{
+	if (!s->clock)
+	{
+		return 0;
+	}
+	return s->clock + timestamp_to_us(timestamp_ticks() - s->clock_ticks, timestamp_frequency()) / 10;
+}
+
+mavlink_signing_result_t mavlink_signing_verify(mavlink_signing_t *s, const uint8_t *frame, size_t len)
+{
+	if (len < FRAME_HDR_LEN || frame[0] != MAVLINK_STX || !(frame[2] & MAVLINK_IFLAG_SIGNED))
+	{
+		s->stats.unsigned_frames++;
+		return MAVLINK_SIGNING_UNSIGNED;
+	}
+	if (len != FRAME_HDR_LEN + frame[1] + MAVLINK_NUM_CHECKSUM_BYTES + MAVLINK_SIGNING_BLOCK_LEN)
+	{
+		s->stats.bad_signature++;
+		return MAVLINK_SIGNING_BAD_SIGNATURE;
+	}
+
+	const uint8_t *sig = &frame[len - MAVLINK_SIGNING_BLOCK_LEN];
+	uint8_t calc[6];
+	uint8_t diff = 0;
+
+	// signature covers everything up to and including the timestamp
+	sha256_keyed_mac48(&s->key, frame, len - sizeof(calc), calc);
+	for (int i = 0; i < sizeof(calc); i++)
+	{
+		diff |= calc[i] ^ sig[7 + i];
+	}
+	if (diff)
+	{
+		s->stats.bad_signature++;
+		return MAVLINK_SIGNING_BAD_SIGNATURE;
+	}
+
+	uint64_t timestamp = load_le48(&sig[1]);
+	mavlink_signing_stream_t *st = find_stream(s, sig[0], frame[5], frame[6]);
+	if (st)
+	{
+		if (timestamp <= st->timestamp)
+		{
+			s->stats.replayed++;
+			return MAVLINK_SIGNING_REPLAY;
+		}
+	}
+	else
+	{
+		if (timestamp + MAVLINK_SIGNING_NEW_STREAM_WINDOW < s->timestamp)
+		{
+			s->stats.replayed++;
+			return MAVLINK_SIGNING_REPLAY;
+		}
+		if (s->num_streams >= MAVLINK_SIGNING_MAX_STREAMS)
+		{
+			return MAVLINK_SIGNING_NO_STREAM;
+		}
+		st = &s->streams[s->num_streams++];
+		st->link_id = sig[0];
+		st->sysid = frame[5];
+		st->compid = frame[6];
+	}
+	st->timestamp = timestamp;
+
+	mavlink_signing_update_timestamp(s, timestamp);
+	s->stats.verified++;
+	return MAVLINK_SIGNING_OK;
+}
+
+size_t mavlink_signing_sign(mavlink_signing_t *s, uint8_t *frame, size_t len)
+{
+	if (len < FRAME_HDR_LEN || frame[0] != MAVLINK_STX)
+	{
+		s->stats.unsignable++;
+		return 0;
+	}
+
+	uint32_t msgid = frame[7] | (frame[8] << 8) | ((uint32_t)frame[9] << 16);
+	const mavlink_msg_entry_t *entry = mavlink_get_msg_entry(msgid);
+	if (!entry)
+	{
+		s->stats.unsignable++;
+		return 0;
+	}
+
+	// the new incompat flag invalidates the CRC, recompute it over header and payload
+	size_t crc_ofs = FRAME_HDR_LEN + frame[1];
+	frame[2] |= MAVLINK_IFLAG_SIGNED;
+	uint16_t crc = crc_calculate(&frame[1], crc_ofs - 1);
+	crc_accumulate(entry->crc_extra, &crc);
+	frame[crc_ofs] = (uint8_t)(crc & 0xFF);
+	frame[crc_ofs + 1] = (uint8_t)(crc >> 8);
+
+	uint8_t *sig = &frame[crc_ofs + MAVLINK_NUM_CHECKSUM_BYTES];
+	uint64_t now = clock_now(s);
+	s->timestamp = now > s->timestamp ? now : s->timestamp + 1;
+	sig[0] = s->link_id;
+	store_le48(&sig[1], s->timestamp);
+	sha256_keyed_mac48(&s->key, frame, crc_ofs + MAVLINK_NUM_CHECKSUM_BYTES + 7, &sig[7]);
+
+	s->stats.signed_frames++;
+	return crc_ofs + MAVLINK_NUM_CHECKSUM_BYTES + MAVLINK_SIGNING_BLOCK_LEN;
+}
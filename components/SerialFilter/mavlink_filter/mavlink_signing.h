@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2023-2024, HENSOLDT Cyber GmbH
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * For commercial licensing, contact: info.cyber@hensoldt.net
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "sha256.h"
+
+// Signature block: link id (1), timestamp (6), signature (6)
+#define MAVLINK_SIGNING_BLOCK_LEN 13
+
+// Streams (link id, sysid, compid) tracked for replay protection per link
+#define MAVLINK_SIGNING_MAX_STREAMS 16
+
+// A new stream may be at most one minute behind (timestamp unit is 10us)
+#define MAVLINK_SIGNING_NEW_STREAM_WINDOW (60 * 100 * 1000ULL)
+
+// Timestamps count 10us units since 1st January 2015 GMT
+#define MAVLINK_SIGNING_EPOCH_UNIX_US 1420070400000000ULL
+
+typedef enum {
+	MAVLINK_SIGNING_OK = 0,
+	MAVLINK_SIGNING_UNSIGNED,
+	MAVLINK_SIGNING_BAD_SIGNATURE,
+	MAVLINK_SIGNING_REPLAY,
+	MAVLINK_SIGNING_NO_STREAM,
+} mavlink_signing_result_t;
+
+typedef struct {
+	uint8_t link_id;
+	uint8_t sysid;
+	uint8_t compid;
+	uint64_t timestamp;
+} mavlink_signing_stream_t;
+
+typedef struct {
+	uint32_t verified;
+	uint32_t unsigned_frames;
+	uint32_t bad_signature;
+	uint32_t replayed;
+	uint32_t signed_frames;
+	uint32_t unsignable; // MAVLink 1 or unknown message, not signed
+} mavlink_signing_stats_t;
+
+/*
+ * Signing state of one link. The timestamp is the last one sent on this link
+ * and is advanced by verified incoming frames, so it never runs behind the
+ * peers we talk to. Once a clock is set, frames are signed with the clock
+ * time unless the last timestamp is already ahead of it.
+ */
+typedef struct {
+	sha256_keyed_t key;
+	uint8_t link_id;
+	uint64_t timestamp;
+	uint64_t clock;       // signing time at clock_ticks, 0 without a clock
+	uint64_t clock_ticks; // timestamp_ticks() when the clock was set
+	mavlink_signing_stream_t streams[MAVLINK_SIGNING_MAX_STREAMS];
+	uint8_t num_streams;
+	mavlink_signing_stats_t stats;
+} mavlink_signing_t;
+
+void mavlink_signing_init(mavlink_signing_t *s, uint8_t link_id, const uint8_t key[SHA256_KEY_LEN]);
+
+/* Verifies the signature of a serialized MAVLink 2 frame */
+mavlink_signing_result_t mavlink_signing_verify(mavlink_signing_t *s, const uint8_t *frame, size_t len);
+
+/*
+ * Signs a serialized MAVLink 2 frame in place. An existing signature is
+ * replaced. The buffer must have room for MAVLINK_SIGNING_BLOCK_LEN more
+ * bytes. Returns the new frame length or 0 if the frame cannot be signed.
+ */
+size_t mavlink_signing_sign(mavlink_signing_t *s, uint8_t *frame, size_t len);
+
+/* Advances the link timestamp, e.g. from a timestamp verified on another link */
+void mavlink_signing_update_timestamp(mavlink_signing_t *s, uint64_t timestamp);
+
+/*
+ * Sets the clock of the link from a UNIX time in us, e.g. the SYSTEM_TIME of
+ * the autopilot. Times before the signing epoch are ignored and return false.
+ * The link timestamp never goes back, a clock behind it only stops counting
+ * until it catches up.
+ */
+bool mavlink_signing_set_clock(mavlink_signing_t *s, uint64_t unix_usec);
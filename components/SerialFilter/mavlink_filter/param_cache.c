@@ -0,0 +1,167 @@
+/*
+ * Copyright (C) 2023-2024, HENSOLDT Cyber GmbH
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * For commercial licensing, contact: info.cyber@hensoldt.net
+ */
+
+#include <string.h>
+
+#include "common/mavlink.h"
+
+#include "param_cache.h"
+
+// Slots of the id -> index table, must be a power of two
+#define NAME_TABLE_SIZE 2048
+#define NAME_TABLE_MASK (NAME_TABLE_SIZE - 1)
+
+static param_entry_t params[PARAM_CACHE_MAX_PARAMS];
+static param_cache_info_t info;
+
+// index + 1 of the parameter, 0 marks a free slot
+static uint16_t by_name[NAME_TABLE_SIZE];
+
+static mavlink_message_t scratch;
+
+static unsigned int hash_id(const char *id)
+{
+	// FNV-1a over the id, which ends at the first NUL or after 16 chars
+	uint32_t h = 2166136261u;
+	for (int i = 0; i < PARAM_CACHE_ID_LEN && id[i]; i++)
+	{
+		h = (h ^ (uint8_t)id[i]) * 16777619u;
+	}
+	return h & NAME_TABLE_MASK;
+}
+
+static void reset(uint8_t sysid, uint8_t compid, uint16_t count)
+{
+	memset(params, 0, sizeof(params));
+	memset(by_name, 0, sizeof(by_name));
+	info.sysid = sysid;
+	info.compid = compid;
+	info.count = count;
+	info.num_valid = 0;
+}
+
+int param_cache_find(const char *id)
+{
+	unsigned int slot = hash_id(id);
+	for (unsigned int n = 0; n < NAME_TABLE_SIZE; n++, slot = (slot + 1) & NAME_TABLE_MASK)
+	{
+		uint16_t index = by_name[slot];
+		if (index == 0)
+		{
+			return -1;
+		}
+		if (strncmp(params[index - 1].id, id, PARAM_CACHE_ID_LEN) == 0)
+		{
+			return index - 1;
+		}
+	}
+	return -1;
+}
+
+static void store(uint16_t index, const mavlink_param_value_t *pv)
+{
+	param_entry_t *p = &params[index];
+
+	if (!p->valid && p->id[0] == '\0')
+	{
+		unsigned int slot = hash_id(pv->param_id);
+		while (by_name[slot] != 0)
+		{
+			slot = (slot + 1) & NAME_TABLE_MASK;
+		}
+		by_name[slot] = index + 1;
+	}
+	else if (strncmp(p->id, pv->param_id, PARAM_CACHE_ID_LEN) != 0)
+	{
+		// the autopilot reordered its parameters, start over
+		reset(info.sysid, info.compid, info.count);
+		store(index, pv);
+		return;
+	}
+
+	memcpy(p->id, pv->param_id, PARAM_CACHE_ID_LEN);
+	p->value = pv->param_value;
+	p->type = pv->param_type;
+	if (!p->valid)
+	{
+		p->valid = true;
+		info.num_valid++;
+	}
+}
+
+void param_cache_handle_frame(const mavlink_frame_t *frame)
+{
+	if (frame->msgid != MAVLINK_MSG_ID_PARAM_VALUE || !mavlink_frame_check_crc(frame))
+	{
+		return;
+	}
+	if (info.sysid != 0 && (frame->sysid != info.sysid || frame->compid != info.compid))
+	{
+		return;
+	}
+
+	// decode functions zero-fill what the sender trimmed off the payload
+	scratch.msgid = frame->msgid;
+	scratch.len = frame->payload_len;
+	memcpy(_MAV_PAYLOAD_NON_CONST(&scratch), frame->payload, frame->payload_len);
+
+	mavlink_param_value_t pv;
+	mavlink_msg_param_value_decode(&scratch, &pv);
+	if (pv.param_count == 0 || pv.param_count > PARAM_CACHE_MAX_PARAMS)
+	{
+		return;
+	}
+	if (info.sysid == 0 || pv.param_count != info.count)
+	{
+		reset(frame->sysid, frame->compid, pv.param_count);
+	}
+
+	if (pv.param_index < info.count)
+	{
+		store(pv.param_index, &pv);
+		return;
+	}
+
+	// answers to PARAM_SET may come without an index
+	int index = param_cache_find(pv.param_id);
+	if (index >= 0)
+	{
+		store(index, &pv);
+	}
+}
+
+void param_cache_invalidate(const char *id)
+{
+	int index = param_cache_find(id);
+	if (index < 0 || !params[index].valid)
+	{
+		return;
+	}
+	params[index].valid = false;
+	info.num_valid--;
+	info.invalidated++;
+}
+
+bool param_cache_complete(void)
+{
+	return info.sysid != 0 && info.num_valid == info.count;
+}
+
+const param_cache_info_t *param_cache_info(void)
+{
+	return &info;
+}
+
+const param_entry_t *param_cache_get(uint16_t index)
+{
+	if (index >= info.count || !params[index].valid)
+	{
+		return NULL;
+	}
+	return &params[index];
+}
@@ -0,0 +1,55 @@
+/*
+ * Copyright (C) 2023-2024, HENSOLDT Cyber GmbH
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * For commercial licensing, contact: info.cyber@hensoldt.net
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "mavlink_scan.h"
+
+// PX4 has about 1000 parameters, a larger set is not cached
+#define PARAM_CACHE_MAX_PARAMS 1280
+
+#define PARAM_CACHE_ID_LEN 16
+
+typedef struct {
+	char id[PARAM_CACHE_ID_LEN]; // not terminated if all 16 chars are used
+	float value;
+	uint8_t type;
+	bool valid;
+} param_entry_t;
+
+/*
+ * Parameters of the first autopilot seen, filled from the PARAM_VALUE
+ * messages PX4 sends to the guests.
+ */
+typedef struct {
+	uint8_t sysid;		// 0: no autopilot seen yet
+	uint8_t compid;
+	uint16_t count;		// param_count reported by the autopilot
+	uint16_t num_valid;
+	uint32_t invalidated;
+} param_cache_info_t;
+
+/* Updates the cache from a PARAM_VALUE frame, other frames are ignored */
+void param_cache_handle_frame(const mavlink_frame_t *frame);
+
+/* Marks a parameter stale until the autopilot confirms its new value */
+void param_cache_invalidate(const char *id);
+
+/* True if every parameter of the autopilot is cached */
+bool param_cache_complete(void);
+
+const param_cache_info_t *param_cache_info(void);
+
+/* Index of the parameter with the given id, -1 if unknown */
+int param_cache_find(const char *id);
+
+/* Valid entry at index, NULL if not cached */
+const param_entry_t *param_cache_get(uint16_t index);
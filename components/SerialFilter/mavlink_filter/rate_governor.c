@@ -0,0 +1,101 @@
+/*
+ * Copyright (C) 2023-2024, HENSOLDT Cyber GmbH
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * For commercial licensing, contact: info.cyber@hensoldt.net
+ */
+
+#include <string.h>
+
+#include "common/mavlink.h"
+
+#include "system_config.h"
+#include "rate_governor.h"
+
+typedef struct {
+	uint32_t msgid;
+	uint32_t interval_us;
+} min_interval_t;
+
+static const min_interval_t min_intervals[] = MAVLINK_RATE_MIN_INTERVALS;
+
+static uint32_t min_interval(uint32_t msgid)
+{
+	for (unsigned int i = 0; i < sizeof(min_intervals) / sizeof(min_intervals[0]); i++)
+	{
+		if (min_intervals[i].msgid == msgid)
+		{
+			return min_intervals[i].interval_us;
+		}
+	}
+	return MAVLINK_RATE_MIN_INTERVAL_US;
+}
+
+static uint32_t frame_size(uint32_t msgid)
+{
+	const mavlink_msg_entry_t *entry = mavlink_get_msg_entry(msgid);
+	uint32_t payload = entry ? entry->max_msg_len : MAVLINK_MAX_PAYLOAD_LEN;
+
+	return MAVLINK_NUM_HEADER_BYTES + payload + MAVLINK_NUM_CHECKSUM_BYTES;
+}
+
+static rate_stream_t *find_stream(rate_governor_t *g, uint32_t msgid)
+{
+	for (unsigned int i = 0; i < g->num_streams; i++)
+	{
+		if (g->streams[i].msgid == msgid)
+		{
+			return &g->streams[i];
+		}
+	}
+	return NULL;
+}
+
+void rate_governor_reset(rate_governor_t *g)
+{
+	memset(g->streams, 0, sizeof(g->streams));
+	g->num_streams = 0;
+	g->bytes_per_s = 0;
+}
+
+bool rate_governor_request(rate_governor_t *g, uint32_t msgid, float *interval_us)
+{
+	rate_stream_t *stream = find_stream(g, msgid);
+	uint32_t old_rate = stream ? stream->bytes_per_s : 0;
+
+	// stopping a stream or going back to the default rate frees its budget
+	if (!(*interval_us > 0))
+	{
+		if (stream)
+		{
+			g->bytes_per_s -= old_rate;
+			*stream = g->streams[--g->num_streams];
+		}
+		return true;
+	}
+
+	uint32_t min = min_interval(msgid);
+	if (*interval_us < min)
+	{
+		*interval_us = min;
+		g->clamped++;
+	}
+
+	uint32_t rate = (uint32_t)(frame_size(msgid) * 1e6f / *interval_us);
+	if (g->bytes_per_s - old_rate + rate > MAVLINK_RATE_LINK_BUDGET ||
+		(!stream && g->num_streams == RATE_GOVERNOR_MAX_STREAMS))
+	{
+		g->denied++;
+		return false;
+	}
+
+	if (!stream)
+	{
+		stream = &g->streams[g->num_streams++];
+		stream->msgid = msgid;
+	}
+	stream->bytes_per_s = rate;
+	g->bytes_per_s += rate - old_rate;
+	return true;
+}
@@ -0,0 +1,43 @@
+/*
+ * Copyright (C) 2023-2024, HENSOLDT Cyber GmbH
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * For commercial licensing, contact: info.cyber@hensoldt.net
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Streams with an explicitly requested rate tracked per link
+#define RATE_GOVERNOR_MAX_STREAMS 32
+
+typedef struct {
+	uint32_t msgid;
+	uint32_t bytes_per_s;
+} rate_stream_t;
+
+/*
+ * Message rates a VM link requested with MAV_CMD_SET_MESSAGE_INTERVAL and
+ * the bandwidth they add up to. Kept when the guest reconnects, PX4 keeps
+ * sending at the granted rates.
+ */
+typedef struct {
+	rate_stream_t streams[RATE_GOVERNOR_MAX_STREAMS];
+	uint8_t num_streams;
+	uint32_t bytes_per_s;
+	uint32_t clamped;
+	uint32_t denied;
+} rate_governor_t;
+
+void rate_governor_reset(rate_governor_t *g);
+
+/*
+ * Checks a request for msgid to be sent every interval_us microseconds
+ * (-1: stop, 0: default rate). Intervals below the minimum of the message
+ * are raised to it. Returns false if the request would exceed the budget of
+ * the link and has to be denied.
+ */
+bool rate_governor_request(rate_governor_t *g, uint32_t msgid, float *interval_us);
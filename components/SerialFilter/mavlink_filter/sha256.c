@@ -0,0 +1,196 @@
+/*
+ * Copyright (C) 2023-2024, HENSOLDT Cyber GmbH
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * For commercial licensing, contact: info.cyber@hensoldt.net
+ */
+
+#include <string.h>
+
+#include "sha256.h"
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+#define CH(x, y, z) (((x) & (y)) ^ (~(x) & (z)))
+#define MAJ(x, y, z) (((x) & (y)) ^ ((x) & (z)) ^ ((y) & (z)))
+#define EP0(x) (ROTR(x, 2) ^ ROTR(x, 13) ^ ROTR(x, 22))
+#define EP1(x) (ROTR(x, 6) ^ ROTR(x, 11) ^ ROTR(x, 25))
+#define SIG0(x) (ROTR(x, 7) ^ ROTR(x, 18) ^ ((x) >> 3))
+#define SIG1(x) (ROTR(x, 17) ^ ROTR(x, 19) ^ ((x) >> 10))
+
+static const uint32_t sha256_iv[8] = {
+	0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+	0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+
+static const uint32_t sha256_k[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+static inline uint32_t load_be32(const uint8_t *p)
+{
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+static inline void store_be64(uint8_t *p, uint64_t v)
+{
+	for (int i = 7; i >= 0; i--)
+	{
+		p[i] = (uint8_t)v;
+		v >>= 8;
+	}
+}
+
+/* Expands the message schedule from W[first] onwards */
+static inline void sha256_schedule(uint32_t w[64], unsigned first)
+{
+	for (unsigned t = first; t < 64; t++)
+	{
+		w[t] = SIG1(w[t - 2]) + w[t - 7] + SIG0(w[t - 15]) + w[t - 16];
+	}
+}
+
+/* Runs rounds [first, last) on the working variables v */
+static inline void sha256_rounds(uint32_t v[8], const uint32_t w[64], unsigned first, unsigned last)
+{
+	uint32_t a = v[0], b = v[1], c = v[2], d = v[3];
+	uint32_t e = v[4], f = v[5], g = v[6], h = v[7];
+
+	for (unsigned t = first; t < last; t++)
+	{
+		uint32_t t1 = h + EP1(e) + CH(e, f, g) + sha256_k[t] + w[t];
+		uint32_t t2 = EP0(a) + MAJ(a, b, c);
+		h = g;
+		g = f;
+		f = e;
+		e = d + t1;
+		d = c;
+		c = b;
+		b = a;
+		a = t1 + t2;
+	}
+
+	v[0] = a; v[1] = b; v[2] = c; v[3] = d;
+	v[4] = e; v[5] = f; v[6] = g; v[7] = h;
+}
+
+static void sha256_compress(uint32_t state[8], const uint8_t block[64])
+{
+	uint32_t w[64];
+	uint32_t v[8];
+
+	for (unsigned t = 0; t < 16; t++)
+	{
+		w[t] = load_be32(&block[t * 4]);
+	}
+	sha256_schedule(w, 16);
+
+	memcpy(v, state, sizeof(v));
+	sha256_rounds(v, w, 0, 64);
+	for (unsigned i = 0; i < 8; i++)
+	{
+		state[i] += v[i];
+	}
+}
+
+/* First block: cached key half, 32 bytes of data in the second half */
+static void sha256_compress_keyed(const sha256_keyed_t *ctx, uint32_t state[8], const uint8_t data[32])
+{
+	uint32_t w[64];
+	uint32_t v[8];
+
+	memcpy(w, ctx->w_key, sizeof(ctx->w_key));
+	for (unsigned t = 8; t < 16; t++)
+	{
+		w[t] = load_be32(&data[(t - 8) * 4]);
+	}
+	for (unsigned t = 16; t < 23; t++)
+	{
+		w[t] = SIG1(w[t - 2]) + w[t - 7] + ctx->sched_key[t - 16];
+	}
+	sha256_schedule(w, 23);
+
+	memcpy(v, ctx->mid, sizeof(v));
+	sha256_rounds(v, w, 8, 64);
+	for (unsigned i = 0; i < 8; i++)
+	{
+		state[i] = sha256_iv[i] + v[i];
+	}
+}
+
+/* Copies the tail and appends the padding so that offset + result is block aligned */
+static size_t sha256_pad(uint8_t *out, const uint8_t *data, size_t len, size_t offset, uint64_t bits)
+{
+	size_t total = ((offset + len + 9 + 63) & ~(size_t)63) - offset;
+
+	memcpy(out, data, len);
+	out[len] = 0x80;
+	memset(&out[len + 1], 0, total - len - 9);
+	store_be64(&out[total - 8], bits);
+	return total;
+}
+
+void sha256_keyed_init(sha256_keyed_t *ctx, const uint8_t key[SHA256_KEY_LEN])
+{
+	uint32_t w[64];
+
+	for (unsigned t = 0; t < 8; t++)
+	{
+		w[t] = load_be32(&key[t * 4]);
+		ctx->w_key[t] = w[t];
+	}
+	for (unsigned t = 16; t < 23; t++)
+	{
+		ctx->sched_key[t - 16] = w[t - 16] + SIG0(w[t - 15]);
+	}
+
+	memcpy(ctx->mid, sha256_iv, sizeof(ctx->mid));
+	sha256_rounds(ctx->mid, w, 0, 8);
+}
+
+void sha256_keyed_mac48(const sha256_keyed_t *ctx, const uint8_t *data, size_t len, uint8_t out[6])
+{
+	const uint64_t bits = (uint64_t)(SHA256_KEY_LEN + len) * 8;
+	uint8_t tail[128];
+	uint32_t state[8];
+	size_t tail_len;
+
+	if (len >= 32)
+	{
+		sha256_compress_keyed(ctx, state, data);
+		data += 32;
+		len -= 32;
+		for (; len >= 64; data += 64, len -= 64)
+		{
+			sha256_compress(state, data);
+		}
+		tail_len = sha256_pad(tail, data, len, 0, bits);
+		sha256_compress(state, tail);
+		if (tail_len > 64)
+		{
+			sha256_compress(state, &tail[64]);
+		}
+	}
+	else
+	{
+		// short input: data and padding start in the second half of block 0
+		tail_len = sha256_pad(tail, data, len, SHA256_KEY_LEN, bits);
+		sha256_compress_keyed(ctx, state, tail);
+		if (tail_len > 32)
+		{
+			sha256_compress(state, &tail[32]);
+		}
+	}
+
+	out[0] = (uint8_t)(state[0] >> 24);
+	out[1] = (uint8_t)(state[0] >> 16);
+	out[2] = (uint8_t)(state[0] >> 8);
+	out[3] = (uint8_t)state[0];
+	out[4] = (uint8_t)(state[1] >> 24);
+	out[5] = (uint8_t)(state[1] >> 16);
+}
@@ -0,0 +1,36 @@
+/*
+ * Copyright (C) 2023-2024, HENSOLDT Cyber GmbH
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * For commercial licensing, contact: info.cyber@hensoldt.net
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define SHA256_KEY_LEN 32
+
+/*
+ * SHA-256 context with a fixed 32 byte prefix (the MAVLink signing key).
+ *
+ * The key only fills the first half of the first block, so the hash state
+ * cannot be advanced past it. Instead the first 8 rounds of the first block,
+ * which only depend on the key words, and the key dependent parts of the
+ * message schedule are computed once in sha256_keyed_init().
+ */
+typedef struct {
+	uint32_t w_key[8];     // key as big-endian message words W[0..7]
+	uint32_t sched_key[7]; // W[t-16] + sigma0(W[t-15]) for t = 16..22
+	uint32_t mid[8];       // working variables after round 7 of block 0
+} sha256_keyed_t;
+
+void sha256_keyed_init(sha256_keyed_t *ctx, const uint8_t key[SHA256_KEY_LEN]);
+
+/*
+ * Computes SHA-256(key || data) and returns the first 48 bits of the digest,
+ * as used by the MAVLink 2 signature.
+ */
+void sha256_keyed_mac48(const sha256_keyed_t *ctx, const uint8_t *data, size_t len, uint8_t out[6]);
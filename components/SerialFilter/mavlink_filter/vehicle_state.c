@@ -0,0 +1,217 @@
+/*
+ * Copyright (C) 2023-2024, HENSOLDT Cyber GmbH
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * For commercial licensing, contact: info.cyber@hensoldt.net
+ */
+
+#include <stdatomic.h>
+#include <string.h>
+
+#include "common/mavlink.h"
+
+#include "vehicle_state.h"
+
+// Reader retries before giving up, a retry needs an update racing the copy
+#define VEHICLE_STATE_READ_TRIES 4
+
+// A snapshot as atomic words, so a reader racing the writer is no data race
+#define VEHICLE_STATE_WORDS ((sizeof(vehicle_state_t) + sizeof(uint32_t) - 1) / sizeof(uint32_t))
+
+/*
+ * Seqlock with two copies: readers use copy[seq & 1] while the writer
+ * updates the other one, so a reader never waits for a writer in progress.
+ * Each copy is written between a seq step and a release fence, like the
+ * single copy of a plain seqlock: a reader that saw any new word of it
+ * sees the step on its recheck.
+ */
+typedef struct {
+	uint8_t sysid;
+	atomic_uint seq;
+	_Atomic uint32_t copy[2][VEHICLE_STATE_WORDS];
+	vehicle_state_t shadow; // writer-owned working copy
+} vehicle_slot_t;
+
+static vehicle_slot_t vehicles[VEHICLE_STATE_MAX_VEHICLES];
+static atomic_uint num_vehicles;
+
+static mavlink_message_t scratch;
+
+static void store_copy(_Atomic uint32_t *copy, const vehicle_state_t *state)
+{
+	uint32_t words[VEHICLE_STATE_WORDS] = {0};
+
+	memcpy(words, state, sizeof(*state));
+	for (size_t i = 0; i < VEHICLE_STATE_WORDS; i++)
+	{
+		atomic_store_explicit(&copy[i], words[i], memory_order_relaxed);
+	}
+}
+
+static void publish(vehicle_slot_t *slot)
+{
+	// seq is even at rest: readers move to copy[1] while copy[0] is updated.
+	// The release store keeps the last update of copy[1] before it.
+	unsigned int seq = atomic_load_explicit(&slot->seq, memory_order_relaxed);
+
+	atomic_store_explicit(&slot->seq, seq + 1, memory_order_release);
+	atomic_thread_fence(memory_order_release);
+	store_copy(slot->copy[0], &slot->shadow);
+
+	// readers move back to copy[0] while copy[1] is updated
+	atomic_store_explicit(&slot->seq, seq + 2, memory_order_release);
+	atomic_thread_fence(memory_order_release);
+	store_copy(slot->copy[1], &slot->shadow);
+}
+
+static vehicle_slot_t *find_slot(uint8_t sysid)
+{
+	unsigned int n = atomic_load_explicit(&num_vehicles, memory_order_acquire);
+
+	for (unsigned int i = 0; i < n; i++)
+	{
+		if (sysid == 0 || vehicles[i].sysid == sysid)
+		{
+			return &vehicles[i];
+		}
+	}
+	return NULL;
+}
+
+static vehicle_slot_t *add_slot(uint8_t sysid, uint8_t compid)
+{
+	unsigned int n = atomic_load_explicit(&num_vehicles, memory_order_relaxed);
+	if (n >= VEHICLE_STATE_MAX_VEHICLES)
+	{
+		return NULL;
+	}
+
+	vehicle_slot_t *slot = &vehicles[n];
+	slot->sysid = sysid;
+	memset(&slot->shadow, 0, sizeof(slot->shadow));
+	slot->shadow.sysid = sysid;
+	slot->shadow.compid = compid;
+	store_copy(slot->copy[0], &slot->shadow);
+	store_copy(slot->copy[1], &slot->shadow);
+
+	atomic_store_explicit(&num_vehicles, n + 1, memory_order_release);
+	return slot;
+}
+
+static const mavlink_message_t *to_message(const mavlink_frame_t *frame)
+{
+	// decode functions zero-fill what the sender trimmed off the payload
+	scratch.msgid = frame->msgid;
+	scratch.len = frame->payload_len;
+	memcpy(_MAV_PAYLOAD_NON_CONST(&scratch), frame->payload, frame->payload_len);
+	return &scratch;
+}
+
+void vehicle_state_handle_frame(const mavlink_frame_t *frame)
+{
+	vehicle_slot_t *slot;
+
+	switch (frame->msgid)
+	{
+	case MAVLINK_MSG_ID_HEARTBEAT:
+	{
+		if (!mavlink_frame_check_crc(frame))
+		{
+			return;
+		}
+		mavlink_heartbeat_t hb;
+		mavlink_msg_heartbeat_decode(to_message(frame), &hb);
+		if (hb.autopilot == MAV_AUTOPILOT_INVALID || hb.type == MAV_TYPE_GCS)
+		{
+			return;
+		}
+
+		slot = find_slot(frame->sysid);
+		if (!slot && !(slot = add_slot(frame->sysid, frame->compid)))
+		{
+			return;
+		}
+		slot->shadow.armed = hb.base_mode & MAV_MODE_FLAG_SAFETY_ARMED;
+		slot->shadow.base_mode = hb.base_mode;
+		slot->shadow.custom_mode = hb.custom_mode;
+		slot->shadow.system_status = hb.system_status;
+		slot->shadow.heartbeats++;
+		break;
+	}
+	case MAVLINK_MSG_ID_GLOBAL_POSITION_INT:
+	{
+		slot = find_slot(frame->sysid);
+		if (!slot || slot->shadow.compid != frame->compid || !mavlink_frame_check_crc(frame))
+		{
+			return;
+		}
+		mavlink_global_position_int_t pos;
+		mavlink_msg_global_position_int_decode(to_message(frame), &pos);
+		slot->shadow.position_valid = true;
+		slot->shadow.time_boot_ms = pos.time_boot_ms;
+		slot->shadow.lat = pos.lat;
+		slot->shadow.lon = pos.lon;
+		slot->shadow.alt = pos.alt;
+		slot->shadow.relative_alt = pos.relative_alt;
+		break;
+	}
+	case MAVLINK_MSG_ID_EXTENDED_SYS_STATE:
+	{
+		slot = find_slot(frame->sysid);
+		if (!slot || slot->shadow.compid != frame->compid || !mavlink_frame_check_crc(frame))
+		{
+			return;
+		}
+		mavlink_extended_sys_state_t ext;
+		mavlink_msg_extended_sys_state_decode(to_message(frame), &ext);
+		slot->shadow.landed_state = ext.landed_state;
+		break;
+	}
+	default:
+		return;
+	}
+
+	publish(slot);
+}
+
+bool vehicle_state_get(uint8_t sysid, vehicle_state_t *out)
+{
+	vehicle_slot_t *slot = find_slot(sysid);
+	if (!slot)
+	{
+		return false;
+	}
+
+	for (int i = 0; i < VEHICLE_STATE_READ_TRIES; i++)
+	{
+		uint32_t words[VEHICLE_STATE_WORDS];
+		unsigned int seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+		for (size_t w = 0; w < VEHICLE_STATE_WORDS; w++)
+		{
+			words[w] = atomic_load_explicit(&slot->copy[seq & 1][w], memory_order_relaxed);
+		}
+		atomic_thread_fence(memory_order_acquire);
+		if (atomic_load_explicit(&slot->seq, memory_order_relaxed) == seq)
+		{
+			memcpy(out, words, sizeof(*out));
+			return true;
+		}
+	}
+	return false;
+}
+
+bool vehicle_state_any_armed(void)
+{
+	unsigned int n = atomic_load_explicit(&num_vehicles, memory_order_acquire);
+	vehicle_state_t state;
+
+	for (unsigned int i = 0; i < n; i++)
+	{
+		if (vehicle_state_get(vehicles[i].sysid, &state) && state.armed)
+		{
+			return true;
+		}
+	}
+	return false;
+}
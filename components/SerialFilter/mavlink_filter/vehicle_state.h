@@ -0,0 +1,60 @@
+/*
+ * Copyright (C) 2023-2024, HENSOLDT Cyber GmbH
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * For commercial licensing, contact: info.cyber@hensoldt.net
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "mavlink_scan.h"
+
+#define VEHICLE_STATE_MAX_VEHICLES 4
+
+/* Vehicle state as last reported by the autopilot */
+typedef struct {
+	uint8_t sysid;
+	uint8_t compid;
+
+	// HEARTBEAT
+	bool armed;
+	uint8_t base_mode;
+	uint32_t custom_mode;
+	uint8_t system_status;
+	uint32_t heartbeats;
+
+	// EXTENDED_SYS_STATE
+	uint8_t landed_state;
+
+	// GLOBAL_POSITION_INT
+	bool position_valid;
+	uint32_t time_boot_ms;
+	int32_t lat;          // degE7
+	int32_t lon;          // degE7
+	int32_t alt;          // mm, MSL
+	int32_t relative_alt; // mm, above home
+} vehicle_state_t;
+
+/*
+ * Feeds a frame of the PX4 -> VM traffic into the decoder. Only HEARTBEAT,
+ * GLOBAL_POSITION_INT and EXTENDED_SYS_STATE are decoded, every other frame
+ * is skipped after looking at its header.
+ *
+ * Must only be called from one thread.
+ */
+void vehicle_state_handle_frame(const mavlink_frame_t *frame);
+
+/*
+ * Copies the snapshot of a vehicle, sysid 0 selects the first vehicle seen.
+ * Never blocks and may be called from any thread. Returns false if the
+ * vehicle is unknown.
+ */
+bool vehicle_state_get(uint8_t sysid, vehicle_state_t *out);
+
+/* True if any known vehicle reported itself armed in its last HEARTBEAT */
+bool vehicle_state_any_armed(void);
@@ -16,293 +16,239 @@
 #include "lib_macros/Test.h"
 #include <arpa/inet.h>
 
+#include "TimeServer.h"
+
 #include <camkes.h>
 
+#include "libs/util/relay_engine.h"
 #include "libs/util/socket_helper.h"
+#include "libs/util/trace_server.h"
 
 //----------------------------------------------------------------------
 // Context
 //----------------------------------------------------------------------
 
-void socket_PX4_event_callback(void *ctx);
-void socket_VM_event_callback(void *ctx);
-
-// VM       <--> TRENTOS
-socket_ctx_t socket_VM = {
-    .socket = IF_OS_SOCKET_ASSIGN(socket_VM_nws),
-    .addr = {
-        .addr = VM_TRENTOS_ADDR,
-        .port = VM_TRENTOS_PORT_SIMCOUPLER},
-    .callback = socket_VM_event_callback,
-    .callback_ctx = &socket_VM,
-    .conn_init = false,
+static const if_OS_Timer_t timer =
+    IF_OS_TIMER_ASSIGN(
+        timeServer_rpc,
+        timeServer_notify);
+
+// Trace export on the PX4 side
+static trace_server_t trace_server;
+
+static const OS_Socket_Addr_t trace_addr = {
+    .addr = PX4_TRENTOS_ADDR,
+    .port = PX4_TRENTOS_PORT_SIMCOUPLER_TRACE};
+
+enum
+{
+    TRACE_TRACK_PX4 = 1,
+    TRACE_TRACK_VM,
+};
+
+// One connection per side, sensor data only flows PX4 -> VM
+enum
+{
+    LINK_VM,
+    LINK_PX4,
+};
+
+static relay_engine_t engine = {
+    .lock = SharedResourceMutex_lock,
+    .unlock = SharedResourceMutex_unlock,
+};
+
+static void px4_read(int link, char *buf, size_t len, void *ctx);
+static bool px4_foreign_event(const OS_Socket_Evt_t *event, void *ctx);
+
+// VM       <--> TRENTOS, the guest does not send anything we relay
+static relay_side_t side_VM = {
+    .sock = {
+        .socket = IF_OS_SOCKET_ASSIGN(socket_VM_nws),
+        .addr = {
+            .addr = VM_TRENTOS_ADDR,
+            .port = VM_TRENTOS_PORT_SIMCOUPLER},
+    },
+    .engine = &engine,
+    .first_link = LINK_VM,
+    .num_links = 1,
+    .trace_track = TRACE_TRACK_VM,
+    .trace_name = "vm_callback",
 };
 
 // TRENTOS  <--> PX4(Linux Host)
-socket_ctx_t socket_PX4 = {
-    .socket = IF_OS_SOCKET_ASSIGN(socket_PX4_nws),
-    .addr = {
-        .addr = PX4_TRENTOS_ADDR,
-        .port = PX4_TRENTOS_PORT_SIMCOUPLER},
-    .callback = socket_PX4_event_callback,
-    .callback_ctx = &socket_PX4,
-    .conn_init = false,
+static relay_side_t side_PX4 = {
+    .sock = {
+        .socket = IF_OS_SOCKET_ASSIGN(socket_PX4_nws),
+        .addr = {
+            .addr = PX4_TRENTOS_ADDR,
+            .port = PX4_TRENTOS_PORT_SIMCOUPLER},
+    },
+    .engine = &engine,
+    .first_link = LINK_PX4,
+    .num_links = 1,
+    .trace_track = TRACE_TRACK_PX4,
+    .trace_name = "px4_callback",
+    .ops = {
+        .on_read = px4_read,
+        .on_foreign_event = px4_foreign_event,
+    },
 };
 
 //----------------------------------------------------------------------
-// Callback PX4
+// Processing PX4 -> VM
 //----------------------------------------------------------------------
 
-void socket_PX4_event_callback(void *ctx)
+static bool px4_foreign_event(const OS_Socket_Evt_t *event, void *ctx)
 {
-    Debug_ASSERT(NULL != ctx);
-    Debug_ASSERT(ctx != &socket_VM);
-
-    socket_ctx_t *socket_from = ctx;
-    socket_ctx_t *socket_to = &socket_VM;
+    return trace_server_handle_event(&trace_server, event);
+}
 
-    OS_Socket_Evt_t eventBuffer[OS_NETWORK_MAXIMUM_SOCKET_NO] = {0};
-    int numberOfSocketsWithEvents = 0;
+// Records of the sensor stream end with this byte, see RecordFramer
+#define RECORD_DELIMITER '\x07'
 
-    OS_Error_t err;
+// The guest backed up and a record was cut, data is dropped up to the next record
+static bool resync;
 
-    if ((err = OS_Socket_getPendingEvents(&socket_from->socket,
-                                          eventBuffer,
-                                          sizeof(eventBuffer),
-                                          &numberOfSocketsWithEvents)))
+static void px4_read(int link, char *buf, size_t len, void *ctx)
+{
+    // Check if the connection to the vm is established
+    if (!relay_engine_connected(&engine, LINK_VM))
     {
-        Debug_LOG_ERROR("failed to retrieve pending events. Error: %i", err);
+        Debug_LOG_TRACE("Connection to the vm is not initiated, data will be dropped");
+        resync = true;
         return;
     }
 
-    // Verify that the received number of sockets with events is within expected
-    // bounds.
-    ASSERT_LE_INT(numberOfSocketsWithEvents, OS_NETWORK_MAXIMUM_SOCKET_NO);
-    ASSERT_GT_INT(numberOfSocketsWithEvents, -1);
-
-    for (int i = 0; i < numberOfSocketsWithEvents; i++)
+    if (resync)
     {
-        OS_Socket_Evt_t event;
-        memcpy(&event, &eventBuffer[i], sizeof(OS_Socket_Evt_t));
-
-        if ((err = SharedResourceMutex_lock()))
+        const char *end = memchr(buf, RECORD_DELIMITER, len);
+        if (!end)
         {
-            Debug_LOG_ERROR("Mutex lock failed, code %d", err);
             return;
         }
+        len -= end + 1 - buf;
+        buf = (char *)end + 1;
+        resync = false;
+    }
 
-        if (!(event.socketHandle >= 0 &&
-              event.socketHandle < OS_NETWORK_MAXIMUM_SOCKET_NO))
-        {
-            Debug_LOG_ERROR("Found invalid socket handle %d for event %d",
-                            event.socketHandle, i);
-            goto reset_PX4;
-        }
-
-        uint8_t eventMask = event.eventMask;
-        if (eventMask & OS_SOCK_EV_ERROR || eventMask & OS_SOCK_EV_FIN)
-        {
-            Debug_LOG_TRACE("event: OS_SOCK_EV_ERROR or OS_SOCK_EV_FIN");
-
-            if ((err = OS_Socket_close(socket_from->handle)))
-            {
-                Debug_LOG_ERROR("OS_Socket_close() failed, code %d", err);
-            }
-            socket_from->conn_init = false;
-        }
-
-        if (eventMask & OS_SOCK_EV_CONN_ACPT)
-        {
-            Debug_LOG_TRACE("PX4 socket connection established");
-            err = OS_Socket_accept(socket_from->handle,
-                                   &socket_from->client_handle,
-                                   &socket_from->addr_partner);
-
-            if (err == OS_ERROR_TRY_AGAIN)
-            {
-                Debug_LOG_ERROR("Socket accept failed OS_ERROR_TRY_AGAIN");
-
-                goto reset_PX4;
-            }
-            else if (err)
-            {
-                Debug_LOG_ERROR("OS_Socket_accept() failed, error %d", err);
-                OS_Socket_close(socket_from->client_handle);
-                goto reset_PX4;
-            }
-            socket_from->conn_init = true;
-        }
-        else if (eventMask & OS_SOCK_EV_READ)
-        {
-            static char buf[MTU] = {0};
-
-            size_t len_requested = sizeof(buf);
-            size_t len_actual = 0;
-
-            if ((err = OS_Socket_read(socket_from->client_handle,
-                                      buf,
-                                      len_requested,
-                                      &len_actual)))
-            {
-                Debug_LOG_ERROR("OS_Socket_read() failed, code %d", err);
-                goto reset_PX4;
-            }
-
-            // Check if the connection to the vm is established
-            if (!socket_to->conn_init)
-            {
-                Debug_LOG_TRACE("Connection to the vm is not initiated, data will be dropped");
-                goto reset_PX4;
-            }
-
-            if ((err = OS_Socket_write(socket_to->client_handle,
-                                       buf,
-                                       len_actual,
-                                       &len_actual)))
-            {
-                Debug_LOG_ERROR("OS_Socket_sendto() failed, code %d", err);
-            }
-        }
-
-    reset_PX4:
-        memset(&eventBuffer[event.socketHandle], 0, sizeof(OS_Socket_Evt_t));
-
-        if ((err = SharedResourceMutex_unlock()))
-        {
-            Debug_LOG_ERROR("Mutex unlock failed, code %d", err);
-            return;
-        }
+    if (!len || relay_engine_send(&engine, LINK_VM, buf, len))
+    {
+        return;
     }
 
-    // register socket callback
-    if ((err = OS_Socket_regCallback(&socket_from->socket,
-                                     socket_from->callback,
-                                     socket_from->callback_ctx)))
+    // No room for the read: complete the record the guest is in, drop the rest
+    const char *end = memchr(buf, RECORD_DELIMITER, len);
+    if (!end || !relay_engine_send(&engine, LINK_VM, buf, end + 1 - buf))
     {
-        Debug_LOG_ERROR("OS_Socket_regCallback() failed, code %d", err);
+        // the record stays cut, the guest drops it at the next delimiter
+        Debug_LOG_WARNING("VM link backed up, sensor record cut");
     }
+    resync = true;
 }
 
 //----------------------------------------------------------------------
-// Callback VM
+// Bring-up: each side listens as soon as its stack runs, started by the
+// notification of the stack or by the control thread
 //----------------------------------------------------------------------
 
-void socket_VM_event_callback(void *ctx)
+static OS_Error_t start_side(void *ctx)
 {
-    Debug_ASSERT(NULL != ctx);
-    socket_ctx_t *socket_from = ctx; // socket_VM
-
-    OS_Socket_Evt_t eventBuffer[OS_NETWORK_MAXIMUM_SOCKET_NO] = {0};
-    int numberOfSocketsWithEvents = 0;
-
-    OS_Error_t err;
+    relay_side_t *side = ctx;
+    int backlog = 10;
+    OS_Error_t err, err_unlock;
 
-    if ((err = OS_Socket_getPendingEvents(&socket_from->socket,
-                                          eventBuffer,
-                                          sizeof(eventBuffer),
-                                          &numberOfSocketsWithEvents)))
+    // the other side may start meanwhile
+    if ((err = relay_engine_lock(&engine, side->trace_track)))
     {
-        Debug_LOG_ERROR("failed to retrieve pending events. Error: %i", err);
-        return;
+        Debug_LOG_ERROR("Mutex lock failed, code %d", err);
+        return err;
     }
 
-    // Verify that the received number of sockets with events is within expected
-    // bounds.
-    ASSERT_LE_INT(numberOfSocketsWithEvents, OS_NETWORK_MAXIMUM_SOCKET_NO);
-    ASSERT_GT_INT(numberOfSocketsWithEvents, -1);
-
-    for (int i = 0; i < numberOfSocketsWithEvents; i++)
+    if ((err = relay_engine_listen(side, backlog)))
+    {
+        Debug_LOG_ERROR("Failure during socket initalization");
+    }
+    else if (side == &side_PX4 && TRACE_ENABLED &&
+             (err = trace_server_init(&trace_server, &side_PX4.sock.socket, &trace_addr)))
     {
-        OS_Socket_Evt_t event;
-        memcpy(&event, &eventBuffer[i], sizeof(OS_Socket_Evt_t));
+        Debug_LOG_ERROR("Trace export not available, code %d", err);
+        err = OS_SUCCESS;
+    }
 
-        if ((err = SharedResourceMutex_lock()))
-        {
-            Debug_LOG_ERROR("Mutex lock failed, code %d", err);
-            return;
-        }
+    if ((err_unlock = relay_engine_unlock(&engine)))
+    {
+        Debug_LOG_ERROR("Mutex unlock failed, code %d", err_unlock);
+    }
+    return err;
+}
 
-        if (!(event.socketHandle >= 0 &&
-              event.socketHandle < OS_NETWORK_MAXIMUM_SOCKET_NO))
-        {
-            Debug_LOG_ERROR("Found invalid socket handle %d for event %d",
-                            event.socketHandle, i);
-            goto reset_VM;
-        }
+//----------------------------------------------------------------------
+// Init
+//----------------------------------------------------------------------
 
-        uint8_t eventMask = event.eventMask;
-        if (eventMask & OS_SOCK_EV_ERROR || eventMask & OS_SOCK_EV_FIN)
-        {
-            Debug_LOG_TRACE("event: OS_SOCK_EV_ERROR or OS_SOCK_EV_FIN");
-
-            // Find socket handle through socket id
-            if ((err = OS_Socket_close(
-                     socket_from->handle.handleID == event.socketHandle ? socket_from->handle : socket_from->client_handle)))
-            {
-                Debug_LOG_ERROR("OS_Socket_close() failed, code %d", err);
-            }
-            socket_from->conn_init = false;
-        }
+// Start of the component, for the boot time of the network stacks
+static uint64_t t_boot;
 
-        if (eventMask & OS_SOCK_EV_CONN_ACPT)
-        {
-            Debug_LOG_ERROR("Conn accpt event");
-            err = OS_Socket_accept(socket_from->handle,
-                                   &socket_from->client_handle,
-                                   &socket_from->addr_partner);
-
-            if (err == OS_ERROR_TRY_AGAIN)
-            {
-                Debug_LOG_ERROR("Socket accept failed OS_ERROR_TRY_AGAIN");
-                goto reset_VM;
-            }
-            else if (err)
-            {
-                Debug_LOG_ERROR("OS_Socket_accept() failed, error %d", err);
-
-                // Find socket handle through socket id
-                if ((err = OS_Socket_close(
-                         socket_from->handle.handleID == event.socketHandle ? socket_from->handle : socket_from->client_handle)))
-                {
-                    Debug_LOG_ERROR("OS_Socket_close() failed, code %d", err);
-                }
-                goto reset_VM;
-            }
-            socket_from->conn_init = true;
-        }
+void post_init(void)
+{
+    t_boot = timestamp_ticks();
 
-    reset_VM:
-        memset(&eventBuffer[event.socketHandle], 0, sizeof(OS_Socket_Evt_t));
+    trace_init(2, "SimCoupler");
+    trace_track_name(TRACE_TRACK_PX4, "PX4 callback");
+    trace_track_name(TRACE_TRACK_VM, "VM callback");
 
-        if ((err = SharedResourceMutex_unlock()))
-        {
-            Debug_LOG_ERROR("Mutex unlock failed, code %d", err);
-            return;
-        }
+    // the previous bring-up, for comparing the boot time
+    if (NW_STACK_WAIT_SPIN)
+    {
+        wait_for_nw_stack_init_nb(&side_VM.sock.socket);
+        side_VM.wait.t_running = timestamp_ticks();
+        wait_for_nw_stack_init_nb(&side_PX4.sock.socket);
+        side_PX4.wait.t_running = timestamp_ticks();
     }
 
-    // register socket callback
-    if ((err = OS_Socket_regCallback(&socket_from->socket,
-                                     socket_from->callback,
-                                     socket_from->callback_ctx)))
+    if (relay_engine_wait(&side_VM, start_side, &side_VM) ||
+        relay_engine_wait(&side_PX4, start_side, &side_PX4))
     {
-        Debug_LOG_ERROR("OS_Socket_regCallback() failed, code %d", err);
+        Debug_LOG_ERROR("Network stack notifications not available");
     }
 }
 
 //----------------------------------------------------------------------
-// Init
+// Control thread: fallback for a stack reaching RUNNING without notifying
 //----------------------------------------------------------------------
 
-void post_init(void)
+// Waits until both sides listen and prints the boot time of the stacks
+int run(void)
 {
-    int backlog = 10;
+    nw_stack_wait_t *const stacks[] = {&side_VM.wait, &side_PX4.wait};
+    int polls = 0;
+    int pending;
+    OS_Error_t err;
 
-    if (init_socket_nb_server(&socket_VM, backlog) ||
-        init_socket_nb_server(&socket_PX4, backlog))
+    while ((pending = nw_stacks_poll(stacks, 2)))
     {
-        Debug_LOG_ERROR("Failure during socket initalization");
-        return;
+        if (pending < 0)
+        {
+            Debug_LOG_ERROR("Failure during network stack initalization");
+            return pending;
+        }
+        polls++;
+
+        if ((err = TimeServer_sleep(&timer, TimeServer_PRECISION_MSEC,
+                                    NW_STACK_POLL_INTERVAL_MS)))
+        {
+            Debug_LOG_ERROR("TimeServer_sleep() failed, code %d", err);
+            return err;
+        }
     }
-    Debug_LOG_ERROR("Both network stacks are initialized.");
+
+    uint64_t frequency = timestamp_frequency();
+    uint64_t vm_us = timestamp_to_us(side_VM.wait.t_running - t_boot, frequency);
+    uint64_t px4_us = timestamp_to_us(side_PX4.wait.t_running - t_boot, frequency);
+    printf("SimCoupler: network stacks up after %llu us (VM %llu us, PX4 %llu us), %s, %d fallback polls\n",
+           (unsigned long long)(vm_us > px4_us ? vm_us : px4_us),
+           (unsigned long long)vm_us, (unsigned long long)px4_us,
+           NW_STACK_WAIT_SPIN ? "spinning" : "notified", polls);
+    return 0;
 }
@@ -0,0 +1,53 @@
+/*
+ * Copyright (C) 2023-2024, HENSOLDT Cyber GmbH
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * For commercial licensing, contact: info.cyber@hensoldt.net
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+
+#include "counters.h"
+
+// Printed line length before wrapping
+#define COUNTERS_LINE_LEN 100
+
+static counter_t counters[COUNTERS_MAX];
+static atomic_uint num_counters;
+
+
+counter_t * counter_register(const char * fmt, ...) {
+    unsigned int n = atomic_load_explicit(&num_counters, memory_order_relaxed);
+    if (n == COUNTERS_MAX) {
+        return NULL;
+    }
+
+    counter_t * c = &counters[n];
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(c->name, sizeof(c->name), fmt, args);
+    va_end(args);
+    atomic_init(&c->value, 0);
+
+    // the printing thread only looks at counters published here
+    atomic_store_explicit(&num_counters, n + 1, memory_order_release);
+    return c;
+}
+
+
+void counters_print(const char * component) {
+    unsigned int n = atomic_load_explicit(&num_counters, memory_order_acquire);
+    char line[COUNTERS_LINE_LEN + COUNTERS_NAME_LEN + 24];
+    int len = 0;
+
+    for (unsigned int i = 0; i < n; i++) {
+        len += snprintf(&line[len], sizeof(line) - len, " %s=%lld", counters[i].name,
+                        (long long)counter_get(&counters[i]));
+        if (len >= COUNTERS_LINE_LEN || i == n - 1) {
+            printf("%s:%s\n", component, line);
+            len = 0;
+        }
+    }
+}
@@ -0,0 +1,52 @@
+/*
+ * Copyright (C) 2023-2024, HENSOLDT Cyber GmbH
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * For commercial licensing, contact: info.cyber@hensoldt.net
+ */
+
+#pragma once
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#define COUNTERS_MAX 64
+#define COUNTERS_NAME_LEN 24
+
+/*
+ * Named values of a component, e.g. link latencies or the relay mode. The
+ * relay path only stores a value, the control thread prints all of them
+ * with counters_print().
+ */
+typedef struct {
+    char                    name[COUNTERS_NAME_LEN];
+    _Atomic int64_t         value;
+} counter_t;
+
+
+/*
+ * Adds a counter, the name is formatted like printf. Counters are added at
+ * init, before the relay path runs. Returns NULL if the table is full, the
+ * counter_* functions ignore a NULL counter.
+ */
+counter_t * counter_register(const char * fmt, ...) __attribute__((format(printf, 1, 2)));
+
+static inline void counter_set(counter_t * c, int64_t value) {
+    if (c) {
+        atomic_store_explicit(&c->value, value, memory_order_relaxed);
+    }
+}
+
+static inline void counter_add(counter_t * c, int64_t delta) {
+    if (c) {
+        atomic_fetch_add_explicit(&c->value, delta, memory_order_relaxed);
+    }
+}
+
+static inline int64_t counter_get(const counter_t * c) {
+    return c ? atomic_load_explicit(&c->value, memory_order_relaxed) : 0;
+}
+
+/* Prints every counter as name=value, several per line */
+void counters_print(const char * component);
@@ -0,0 +1,202 @@
+/*
+ * Copyright (C) 2023-2024, HENSOLDT Cyber GmbH
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * For commercial licensing, contact: info.cyber@hensoldt.net
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "system_config.h"
+
+#include "log_ring.h"
+
+#define RING_MASK (LOG_RING_ENTRIES - 1)
+
+_Static_assert((LOG_RING_ENTRIES & RING_MASK) == 0, "LOG_RING_ENTRIES must be a power of two");
+
+/*
+ * Bounded MPSC queue: a producer claims a slot by advancing head, the slot's
+ * seq tells whether it is free (seq == pos) or filled (seq == pos + 1).
+ */
+typedef struct {
+    atomic_uint             seq;
+    const log_site_t *      site;
+    uint64_t                timestamp;
+    uint32_t                repeats;
+    uint8_t                 num_args;
+    int32_t                 args[LOG_RING_MAX_ARGS];
+} log_entry_t;
+
+static log_entry_t ring[LOG_RING_ENTRIES];
+static atomic_uint head;
+static unsigned int tail; // consumer only
+
+static log_ring_stats_t stats;
+
+// Sites with suppressed entries not reported yet, pushed by the writers,
+// taken as a whole by the drain
+static _Atomic(log_site_t *) suppressing;
+
+static uint64_t ticks_per_sec;
+static uint64_t site_interval;
+
+
+void log_ring_init(void) {
+    for (unsigned int i = 0; i < LOG_RING_ENTRIES; i++) {
+        atomic_init(&ring[i].seq, i);
+    }
+    ticks_per_sec = timestamp_frequency();
+    site_interval = ticks_per_sec * LOG_RING_SITE_INTERVAL_US / 1000000;
+}
+
+
+// Puts a site on the suppressing list, unless it is on it already
+static void list_site(log_site_t * site) {
+    if (atomic_exchange_explicit(&site->listed, true, memory_order_acq_rel)) {
+        return;
+    }
+    log_site_t * first = atomic_load_explicit(&suppressing, memory_order_relaxed);
+    do {
+        site->next = first;
+    } while (!atomic_compare_exchange_weak_explicit(&suppressing, &first, site,
+                                                    memory_order_release,
+                                                    memory_order_relaxed));
+}
+
+
+void log_ring_write(log_site_t * site, const int32_t * args, size_t num_args) {
+    uint64_t now = timestamp_ticks();
+
+    // repeats within the interval are only counted
+    uint64_t last = atomic_load_explicit(&site->last, memory_order_relaxed);
+    if (last && now - last < site_interval) {
+        atomic_fetch_add_explicit(&site->suppressed, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&stats.suppressed, 1, memory_order_relaxed);
+        list_site(site);
+        return;
+    }
+    atomic_store_explicit(&site->last, now ? now : 1, memory_order_relaxed);
+
+    unsigned int pos = atomic_load_explicit(&head, memory_order_relaxed);
+    log_entry_t * e;
+    for (;;) {
+        e = &ring[pos & RING_MASK];
+        int diff = (int)(atomic_load_explicit(&e->seq, memory_order_acquire) - pos);
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&head, &pos, pos + 1,
+                                                      memory_order_relaxed,
+                                                      memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            atomic_fetch_add_explicit(&stats.overflows, 1, memory_order_relaxed);
+            return;
+        } else {
+            pos = atomic_load_explicit(&head, memory_order_relaxed);
+        }
+    }
+
+    if (num_args > LOG_RING_MAX_ARGS) {
+        num_args = LOG_RING_MAX_ARGS;
+    }
+    e->site = site;
+    e->timestamp = now;
+    e->repeats = atomic_exchange_explicit(&site->suppressed, 0, memory_order_relaxed);
+    e->num_args = num_args;
+    memcpy(e->args, args, num_args * sizeof(args[0]));
+
+    atomic_store_explicit(&e->seq, pos + 1, memory_order_release);
+    atomic_fetch_add_explicit(&stats.written, 1, memory_order_relaxed);
+}
+
+
+static const char * level_name(int level) {
+    switch (level) {
+    case Debug_LOG_LEVEL_ERROR:     return "ERROR";
+    case Debug_LOG_LEVEL_WARNING:   return "WARNING";
+    case Debug_LOG_LEVEL_INFO:      return "INFO";
+    case Debug_LOG_LEVEL_DEBUG:     return "DEBUG";
+    default:                        return "TRACE";
+    }
+}
+
+
+static void print_entry(const log_entry_t * e) {
+    const log_site_t * site = e->site;
+    uint64_t us = timestamp_to_us(e->timestamp, ticks_per_sec);
+    int32_t a[LOG_RING_MAX_ARGS] = { 0 };
+
+    memcpy(a, e->args, e->num_args * sizeof(a[0]));
+
+    printf("[%llu.%06llu] %s %s:%d: ",
+           (unsigned long long)(us / 1000000),
+           (unsigned long long)(us % 1000000),
+           level_name(site->level), site->file, site->line);
+    printf(site->format, a[0], a[1], a[2], a[3]);
+    if (e->repeats) {
+        printf(" (%u more suppressed)", (unsigned int)e->repeats);
+    }
+    printf("\n");
+}
+
+
+// Reports the suppressed entries of the sites quiet for the rate limit
+// interval, a flood that stopped would show its count only in the stats
+static void flush_sites(void) {
+    log_site_t * site = atomic_exchange_explicit(&suppressing, NULL, memory_order_acquire);
+    uint64_t now = timestamp_ticks();
+
+    while (site) {
+        log_site_t * next = site->next;
+
+        // a writer suppressing meanwhile lists the site again
+        atomic_store_explicit(&site->listed, false, memory_order_release);
+        uint64_t last = atomic_load_explicit(&site->last, memory_order_relaxed);
+        if (now - last < site_interval) {
+            // still flooding, the next entry of the site may carry the count
+            if (atomic_load_explicit(&site->suppressed, memory_order_relaxed)) {
+                list_site(site);
+            }
+        } else {
+            unsigned int repeats = atomic_exchange_explicit(&site->suppressed, 0,
+                                                            memory_order_relaxed);
+            if (repeats) {
+                uint64_t us = timestamp_to_us(now, ticks_per_sec);
+                printf("[%llu.%06llu] %s %s:%d: (%u more suppressed)\n",
+                       (unsigned long long)(us / 1000000),
+                       (unsigned long long)(us % 1000000),
+                       level_name(site->level), site->file, site->line, repeats);
+            }
+        }
+        site = next;
+    }
+}
+
+
+size_t log_ring_drain(size_t max) {
+    size_t n = 0;
+
+    while (n < max) {
+        log_entry_t * e = &ring[tail & RING_MASK];
+        if (atomic_load_explicit(&e->seq, memory_order_acquire) != tail + 1) {
+            break;
+        }
+
+        print_entry(e);
+        atomic_store_explicit(&e->seq, tail + LOG_RING_ENTRIES, memory_order_release);
+        tail++;
+        n++;
+    }
+    if (n < max) {
+        flush_sites();
+    }
+    return n;
+}
+
+
+const log_ring_stats_t * log_ring_stats(void) {
+    return &stats;
+}
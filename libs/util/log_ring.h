@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2023-2024, HENSOLDT Cyber GmbH
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * For commercial licensing, contact: info.cyber@hensoldt.net
+ */
+
+#pragma once
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "lib_debug/Debug.h"
+
+#include "timestamp.h"
+
+// Arguments stored per entry, all of them are 32 bit integers (%d, %u, %x)
+#define LOG_RING_MAX_ARGS 4
+
+/*
+ * A log statement in the code. The format is only looked at when the entry
+ * is drained, the hot path just stores the site and the raw arguments.
+ */
+typedef struct log_site {
+    const char *            format;
+    const char *            file;
+    int                     line;
+    int                     level;
+    _Atomic uint64_t        last;       // timestamp of the last stored entry
+    atomic_uint             suppressed; // entries dropped by the rate limit since
+    atomic_bool             listed;     // on the list of sites with suppressed entries
+    struct log_site *       next;
+} log_site_t;
+
+typedef struct {
+    atomic_uint             written;
+    atomic_uint             overflows;  // ring was full, entry lost
+    atomic_uint             suppressed; // folded into a later entry of the site
+} log_ring_stats_t;
+
+
+void log_ring_init(void);
+
+void log_ring_write(log_site_t * site, const int32_t * args, size_t num_args);
+
+/*
+ * Formats and prints up to max stored entries, returns the number printed.
+ * Once the ring is empty, the suppressed entries of sites that stayed quiet
+ * for the rate limit interval are reported as well.
+ */
+size_t log_ring_drain(size_t max);
+
+const log_ring_stats_t * log_ring_stats(void);
+
+
+#define LOG_RING_LOG(lvl, fmt, ...) do {                                    \
+    if ((lvl) <= Debug_Config_LOG_LEVEL) {                                  \
+        static log_site_t log_site_ = {                                     \
+            .format = (fmt),                                                \
+            .file = __FILE__,                                               \
+            .line = __LINE__,                                               \
+            .level = (lvl),                                                 \
+        };                                                                  \
+        const int32_t log_args_[] = { 0, ##__VA_ARGS__ };                   \
+        log_ring_write(&log_site_, &log_args_[1],                           \
+                       sizeof(log_args_) / sizeof(log_args_[0]) - 1);       \
+    }                                                                       \
+} while (0)
+
+#define LOG_RING_ERROR(...)     LOG_RING_LOG(Debug_LOG_LEVEL_ERROR, __VA_ARGS__)
+#define LOG_RING_WARNING(...)   LOG_RING_LOG(Debug_LOG_LEVEL_WARNING, __VA_ARGS__)
+#define LOG_RING_INFO(...)      LOG_RING_LOG(Debug_LOG_LEVEL_INFO, __VA_ARGS__)
+#define LOG_RING_DEBUG(...)     LOG_RING_LOG(Debug_LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define LOG_RING_TRACE(...)     LOG_RING_LOG(Debug_LOG_LEVEL_TRACE, __VA_ARGS__)
@@ -0,0 +1,378 @@
+/*
+ * Copyright (C) 2023-2024, HENSOLDT Cyber GmbH
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * For commercial licensing, contact: info.cyber@hensoldt.net
+ */
+
+#include <string.h>
+
+#include "lib_debug/Debug.h"
+#include "OS_Dataport.h"
+
+#include "relay_engine.h"
+#include "trace_buf.h"
+
+// Components with a log ring defer the relay path logging to it, the others
+// log directly (-DRELAY_ENGINE_LOG_RING)
+#if defined(RELAY_ENGINE_LOG_RING)
+#include "log_ring.h"
+#define RELAY_LOG_ERROR LOG_RING_ERROR
+#define RELAY_LOG_TRACE LOG_RING_TRACE
+#else
+#define RELAY_LOG_ERROR Debug_LOG_ERROR
+#define RELAY_LOG_TRACE Debug_LOG_TRACE
+#endif
+
+
+static int find_link(const relay_side_t * side, int socketHandle) {
+    const relay_engine_t * engine = side->engine;
+
+    for (int i = side->first_link; i < side->first_link + side->num_links; i++) {
+        if (engine->links[i].in_use && engine->links[i].handle.handleID == socketHandle) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+
+static void accept_link(relay_side_t * side) {
+    relay_engine_t * engine = side->engine;
+    OS_Socket_Handle_t handle;
+    OS_Socket_Addr_t addr_partner;
+    OS_Error_t err;
+
+    err = OS_Socket_accept(side->sock.handle, &handle, &addr_partner);
+    if (err == OS_ERROR_TRY_AGAIN) {
+        RELAY_LOG_ERROR("Socket accept failed OS_ERROR_TRY_AGAIN");
+        return;
+    } else if (err) {
+        RELAY_LOG_ERROR("OS_Socket_accept() failed, error %d", err);
+        return;
+    }
+
+    int i = side->first_link;
+    while (i < side->first_link + side->num_links && engine->links[i].in_use) {
+        i++;
+    }
+    if (i == side->first_link + side->num_links) {
+        RELAY_LOG_ERROR("All %d links in use, connection rejected", side->num_links);
+        OS_Socket_close(handle);
+        return;
+    }
+
+    relay_link_t * link = &engine->links[i];
+    memset(link, 0, sizeof(*link));
+    link->handle = handle;
+    link->addr_partner = addr_partner;
+    link->in_use = true;
+    link->conn_init = true;
+    if (side->ops.on_open) {
+        side->ops.on_open(i, side->ops.ctx);
+    }
+}
+
+
+static void read_link(relay_side_t * side, int i) {
+    static char buf[RELAY_ENGINE_READ_LEN];
+    relay_link_t * link = &side->engine->links[i];
+    size_t len_requested = side->ops.read_budget ? side->ops.read_budget(side->ops.ctx) : MTU;
+    size_t len = 0;
+    size_t len_actual = 0;
+    OS_Error_t err;
+
+    if (len_requested > sizeof(buf)) {
+        len_requested = sizeof(buf);
+    }
+
+    // A stack holding more than one read is emptied up to the budget, so the
+    // stage gets one large buffer
+    do {
+        size_t chunk = len_requested - len < MTU ? len_requested - len : MTU;
+        uint64_t t_read = trace_now();
+        if ((err = OS_Socket_read(link->handle, &buf[len], chunk, &len_actual))) {
+            break;
+        }
+        trace_span(side->trace_track, "read", t_read, "len", len_actual);
+        link->stats.reads++;
+        len += len_actual;
+    } while (len_actual == MTU && len < len_requested);
+
+    if (err && !len) {
+        if (err != OS_ERROR_TRY_AGAIN) {
+            RELAY_LOG_ERROR("OS_Socket_read() failed on link %d, code %d", i, err);
+            link->stats.errors++;
+        }
+        return;
+    }
+    link->stats.rx_bytes += len;
+
+    if (side->ops.on_read) {
+        side->ops.on_read(i, buf, len, side->ops.ctx);
+    }
+}
+
+
+// Writes the data relay_engine_send() kept
+static void flush_link(relay_engine_t * engine, int i) {
+    relay_link_t * link = &engine->links[i];
+    size_t written = relay_engine_write(engine, i, link->tx, link->tx_len);
+
+    memmove(link->tx, &link->tx[written], link->tx_len - written);
+    link->tx_len -= written;
+}
+
+
+static void handle_event(relay_side_t * side, const OS_Socket_Evt_t * event) {
+    relay_engine_t * engine = side->engine;
+    OS_Error_t err;
+
+    if (!(event->socketHandle >= 0 &&
+          event->socketHandle < OS_NETWORK_MAXIMUM_SOCKET_NO)) {
+        RELAY_LOG_ERROR("Found invalid socket handle %d", event->socketHandle);
+        return;
+    }
+
+    if (side->ops.on_foreign_event && side->ops.on_foreign_event(event, side->ops.ctx)) {
+        return;
+    }
+
+    int i = find_link(side, event->socketHandle);
+    bool listener = side->listening && side->sock.handle.handleID == event->socketHandle;
+    uint8_t eventMask = event->eventMask;
+
+    if (i < 0 && !listener) {
+        RELAY_LOG_TRACE("Event %x for unknown socket handle %d", eventMask, event->socketHandle);
+        return;
+    }
+    if (i >= 0) {
+        engine->links[i].stats.events++;
+    }
+
+    if (eventMask & OS_SOCK_EV_ERROR || eventMask & OS_SOCK_EV_FIN) {
+        RELAY_LOG_TRACE("event: OS_SOCK_EV_ERROR or OS_SOCK_EV_FIN");
+        if (i >= 0) {
+            // the last data of the peer, e.g. an ack sent before closing
+            if ((eventMask & OS_SOCK_EV_READ) && engine->links[i].conn_init) {
+                read_link(side, i);
+            }
+            // on_read may have closed the link
+            if (engine->links[i].in_use) {
+                relay_engine_close(side, i);
+            }
+            return;
+        }
+        if ((err = OS_Socket_close(side->sock.handle))) {
+            RELAY_LOG_ERROR("OS_Socket_close() failed, code %d", err);
+        }
+        side->listening = false;
+        if ((err = relay_engine_listen(side, side->backlog))) {
+            RELAY_LOG_ERROR("Reopening the listening socket failed, code %d", err);
+        }
+        return;
+    }
+
+    if (listener) {
+        if (eventMask & OS_SOCK_EV_CONN_ACPT) {
+            accept_link(side);
+        }
+        return;
+    }
+
+    relay_link_t * link = &engine->links[i];
+    if ((eventMask & OS_SOCK_EV_CONN_EST) && !link->conn_init) {
+        link->conn_init = true;
+        RELAY_LOG_TRACE("Connection of link %d established", i);
+        if (side->ops.on_open) {
+            side->ops.on_open(i, side->ops.ctx);
+        }
+    }
+
+    if (eventMask & OS_SOCK_EV_READ) {
+        read_link(side, i);
+    }
+
+    // on_read may have closed the link
+    if ((eventMask & OS_SOCK_EV_WRITE) && link->in_use) {
+        if (link->tx_len) {
+            flush_link(engine, i);
+        }
+        if (side->ops.on_writable) {
+            side->ops.on_writable(i, side->ops.ctx);
+        }
+    }
+}
+
+
+// Handler of the socket loop, ctx is the relay_side_t
+static void dispatch(const OS_Socket_Evt_t * events, int num, void * ctx) {
+    relay_side_t * side = ctx;
+    relay_engine_t * engine = side->engine;
+    OS_Error_t err;
+    uint64_t t_batch = trace_now();
+
+    // one lock for the whole batch
+    if ((err = relay_engine_lock(engine, side->trace_track))) {
+        RELAY_LOG_ERROR("Mutex lock failed, code %d", err);
+        return;
+    }
+    for (int i = 0; i < num; i++) {
+        uint64_t t_event = trace_now();
+        handle_event(side, &events[i]);
+        trace_span(side->trace_track, "event", t_event, "mask", events[i].eventMask);
+    }
+    if ((err = relay_engine_unlock(engine))) {
+        RELAY_LOG_ERROR("Mutex unlock failed, code %d", err);
+    }
+    trace_span(side->trace_track, side->trace_name, t_batch, "events", num);
+}
+
+
+OS_Error_t relay_engine_wait(relay_side_t * side, nw_stack_start_t start, void * ctx) {
+    side->wait.sock = &side->sock;
+    side->wait.start = start;
+    side->wait.ctx = ctx;
+    return nw_stack_wait_arm(&side->wait);
+}
+
+
+OS_Error_t relay_engine_start(relay_side_t * side) {
+    OS_Error_t err;
+
+    if (side->started) {
+        return OS_SUCCESS;
+    }
+    side->source.spin = side->spin;
+    if ((err = socket_loop_add(&side->engine->loop, &side->source, &side->sock, dispatch, side))) {
+        return err;
+    }
+    if (!side->wait.start && (err = init_nw_stack_nb(&side->sock))) {
+        return err;
+    }
+    side->started = true;
+    return OS_SUCCESS;
+}
+
+
+OS_Error_t relay_engine_listen(relay_side_t * side, int backlog) {
+    OS_Error_t err;
+
+    if (side->listening) {
+        return OS_SUCCESS;
+    }
+    if ((err = relay_engine_start(side))) {
+        return err;
+    }
+    if ((err = listen_socket_nb(&side->sock.socket, &side->sock.handle, &side->sock.addr, backlog))) {
+        return err;
+    }
+    side->backlog = backlog;
+    side->listening = true;
+    return OS_SUCCESS;
+}
+
+
+OS_Error_t relay_engine_connect(relay_side_t * side, int i, const OS_Socket_Addr_t * addr) {
+    relay_link_t * link = &side->engine->links[i];
+    OS_Error_t err;
+
+    if ((err = connect_socket_nb(&side->sock.socket, &link->handle, addr))) {
+        return err;
+    }
+    memset(&link->stats, 0, sizeof(link->stats));
+    link->tx_len = 0;
+    link->addr_partner = *addr;
+    link->in_use = true;
+    link->conn_init = false;
+    return OS_SUCCESS;
+}
+
+
+void relay_engine_close(relay_side_t * side, int i) {
+    relay_link_t * link = &side->engine->links[i];
+    OS_Error_t err;
+
+    if ((err = OS_Socket_close(link->handle))) {
+        RELAY_LOG_ERROR("OS_Socket_close() failed, code %d", err);
+    }
+    link->in_use = false;
+    link->conn_init = false;
+    link->tx_len = 0;
+    if (side->ops.on_close) {
+        side->ops.on_close(i, side->ops.ctx);
+    }
+}
+
+
+size_t relay_engine_write(relay_engine_t * engine, int i, const char * buf, size_t len) {
+    relay_link_t * link = &engine->links[i];
+    OS_Error_t err;
+    size_t written = 0;
+
+    // A single write is limited by the dataport shared with the network stack
+    while (written < len) {
+        size_t chunk = len - written;
+        if (chunk > OS_DATAPORT_DEFAULT_SIZE) {
+            chunk = OS_DATAPORT_DEFAULT_SIZE;
+        }
+
+        size_t len_actual = 0;
+        uint64_t t_write = trace_now();
+        err = OS_Socket_write(link->handle, &buf[written], chunk, &len_actual);
+        trace_span(engine->trace_track, "write", t_write, "len", len_actual);
+        if (err) {
+            if (err != OS_ERROR_TRY_AGAIN) {
+                RELAY_LOG_ERROR("OS_Socket_write() failed on link %d, code %d", i, err);
+                link->stats.errors++;
+            }
+            break;
+        }
+        link->stats.writes++;
+        written += len_actual;
+        if (len_actual < chunk) {
+            link->stats.partial_writes++;
+            break;
+        }
+    }
+    link->stats.tx_bytes += written;
+    return written;
+}
+
+
+bool relay_engine_send(relay_engine_t * engine, int i, const char * buf, size_t len) {
+    relay_link_t * link = &engine->links[i];
+    size_t written = 0;
+
+    // even if the stack takes none of it, buf has to fit
+    if (len > sizeof(link->tx) - link->tx_len) {
+        link->stats.dropped++;
+        return false;
+    }
+
+    // queued data goes first, buf is only written once none is left
+    if (link->tx_len) {
+        flush_link(engine, i);
+    }
+    if (!link->tx_len) {
+        written = relay_engine_write(engine, i, buf, len);
+    }
+    memcpy(&link->tx[link->tx_len], &buf[written], len - written);
+    link->tx_len += len - written;
+    return true;
+}
+
+
+int relay_engine_lock(relay_engine_t * engine, uint8_t trace_track) {
+    int err = engine->lock();
+    if (!err) {
+        engine->trace_track = trace_track;
+    }
+    return err;
+}
+
+
+int relay_engine_unlock(relay_engine_t * engine) {
+    return engine->unlock();
+}
@@ -0,0 +1,164 @@
+/*
+ * Copyright (C) 2023-2024, HENSOLDT Cyber GmbH
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * For commercial licensing, contact: info.cyber@hensoldt.net
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "OS_Socket.h"
+#include "interfaces/if_OS_Socket.h"
+
+#include "socket_helper.h"
+
+/*
+ * Socket relay shared by the SerialFilter and the SimCoupler.
+ *
+ * An engine serves the links of up to two network stacks, one side each.
+ * The engine polls the events of a side, accepts and closes its links,
+ * reads and writes, and keeps per-link statistics. What happens to the data
+ * is up to the component: every side has its own processing stage, e.g.
+ * the MAVLink filter for data from the guest. A component only describes
+ * its sides and links.
+ *
+ * All callbacks of a side run with the engine's lock held, taken once per
+ * event batch. The stacks of all sides are served by one socket_loop_t, see
+ * socket_helper.h.
+ */
+
+#define RELAY_ENGINE_MAX_LINKS 8
+
+// Largest read of one event, collected in MTU sized reads
+#define RELAY_ENGINE_READ_LEN (4 * MTU)
+
+// Unwritten data of relay_engine_send() per link, room for two full reads
+#define RELAY_ENGINE_TX_LEN (2 * RELAY_ENGINE_READ_LEN)
+
+typedef struct {
+    uint32_t                events;
+    uint32_t                reads;
+    uint64_t                rx_bytes;
+    uint32_t                writes;
+    uint32_t                partial_writes; // the stack took less than offered
+    uint32_t                dropped;    // relay_engine_send() buffers without room
+    uint64_t                tx_bytes;
+    uint32_t                errors;
+} relay_link_stats_t;
+
+typedef struct {
+    OS_Socket_Handle_t      handle;
+    OS_Socket_Addr_t        addr_partner;
+    bool                    in_use;     // socket open
+    bool                    conn_init;  // connected, data can be sent
+    relay_link_stats_t      stats;
+    char                    tx[RELAY_ENGINE_TX_LEN]; // written on the next write event
+    size_t                  tx_len;
+} relay_link_t;
+
+typedef struct relay_engine relay_engine_t;
+
+/* Processing stage and hooks of a side, NULL hooks are skipped */
+typedef struct {
+    // Data read from a link of the side, buf may be modified until the return
+    void (*on_read)(int link, char * buf, size_t len, void * ctx);
+    // A link was accepted or its connection established
+    void (*on_open)(int link, void * ctx);
+    // A link was closed after an error or by the peer
+    void (*on_close)(int link, void * ctx);
+    // The socket of a link has room again
+    void (*on_writable)(int link, void * ctx);
+    // Event of a socket the engine does not own, true if it was handled
+    bool (*on_foreign_event)(const OS_Socket_Evt_t * event, void * ctx);
+    // Bytes to read for one read event, MTU if NULL
+    size_t (*read_budget)(void * ctx);
+    void *                  ctx;
+} relay_ops_t;
+
+/*
+ * One network stack, its callback is set up by the engine. A side with a
+ * listening socket accepts into its free links, the links of a client side
+ * are opened with relay_engine_connect().
+ */
+typedef struct {
+    socket_ctx_t            sock;
+    socket_loop_source_t    source;
+    relay_engine_t *        engine;
+    uint8_t                 first_link;
+    uint8_t                 num_links;
+    uint8_t                 trace_track;
+    const char *            trace_name; // span of one event batch
+    relay_ops_t             ops;
+    nw_stack_wait_t         wait;       // bring-up, see relay_engine_wait()
+    bool                    spin;       // polled while the socket loop spins
+    bool                    started;
+    bool                    listening;  // sock.handle accepts connections
+    int                     backlog;
+} relay_side_t;
+
+struct relay_engine {
+    relay_link_t            links[RELAY_ENGINE_MAX_LINKS];
+    int                     (*lock)(void);
+    int                     (*unlock)(void);
+    uint8_t                 trace_track; // track of the lock holder
+    socket_loop_t           loop;
+};
+
+
+/*
+ * Registers the readiness check of the stack of a side, see nw_stack_wait_t.
+ * start is called once the stack runs and starts the side with
+ * relay_engine_start() or relay_engine_listen().
+ */
+OS_Error_t relay_engine_wait(relay_side_t * side, nw_stack_start_t start, void * ctx);
+
+/*
+ * Waits for the stack of a side and registers its callback, once. After
+ * relay_engine_wait() the stack runs already and the readiness check hands
+ * its callback on.
+ */
+OS_Error_t relay_engine_start(relay_side_t * side);
+
+/*
+ * Starts a side and listens on sock.addr, connections are accepted into its
+ * links. Does nothing while the side listens, a listener the stack closed is
+ * reopened.
+ */
+OS_Error_t relay_engine_listen(relay_side_t * side, int backlog);
+
+/* Opens a link of a started side, on_open follows once it is established */
+OS_Error_t relay_engine_connect(relay_side_t * side, int link, const OS_Socket_Addr_t * addr);
+
+/* Closes a link and calls on_close of its side */
+void relay_engine_close(relay_side_t * side, int link);
+
+/*
+ * Writes as much of buf as the stack takes without blocking, in chunks of
+ * the dataport size. Returns the number of bytes written.
+ */
+size_t relay_engine_write(relay_engine_t * engine, int link, const char * buf, size_t len);
+
+/*
+ * Sends buf completely or not at all: what the stack does not take is kept
+ * and written on the next write event of the link, before on_writable. A
+ * buffer that does not fit behind the data kept already is dropped as a
+ * whole, so the stream is never cut within buf. Returns false if dropped.
+ */
+bool relay_engine_send(relay_engine_t * engine, int link, const char * buf, size_t len);
+
+/* Takes the lock outside of a callback, e.g. from a control thread */
+int relay_engine_lock(relay_engine_t * engine, uint8_t trace_track);
+int relay_engine_unlock(relay_engine_t * engine);
+
+static inline bool relay_engine_connected(const relay_engine_t * engine, int link) {
+    return engine->links[link].conn_init;
+}
+
+static inline const relay_link_stats_t * relay_engine_stats(const relay_engine_t * engine, int link) {
+    return &engine->links[link].stats;
+}
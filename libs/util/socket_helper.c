@@ -11,6 +11,7 @@
 #include "lib_debug/Debug.h"
 
 #include "socket_helper.h"
+#include "timestamp.h"
 
 
 OS_Error_t wait_for_nw_stack_init_nb(const if_OS_Socket_t * const nw_sock) {
@@ -30,7 +31,92 @@ OS_Error_t wait_for_nw_stack_init_nb(const if_OS_Socket_t * const nw_sock) {
 }
 
 
-OS_Error_t init_socket_nb(socket_ctx_t * ctx) {
+// Looks at the status of a waiting stack and starts it once it runs
+static void nw_stack_check(nw_stack_wait_t * w) {
+    OS_NetworkStack_State_t networkStackState = OS_Socket_getStatus(&w->sock->socket);
+    int state = NW_STACK_WAITING;
+
+    if (networkStackState == FATAL_ERROR) {
+        Debug_LOG_ERROR("A FATAL_ERROR occurred in the Network Stack component.");
+        atomic_compare_exchange_strong(&w->state, &state, NW_STACK_FAILED);
+        return;
+    }
+    if (networkStackState != RUNNING ||
+        !atomic_compare_exchange_strong(&w->state, &state, NW_STACK_STARTING)) {
+        return;
+    }
+
+    // set before by a wait with NW_STACK_WAIT_SPIN
+    if (!w->t_running) {
+        w->t_running = timestamp_ticks();
+    }
+    atomic_store(&w->state, w->start(w->ctx) ? NW_STACK_FAILED : NW_STACK_STARTED);
+}
+
+
+OS_Error_t nw_stack_wait_arm(nw_stack_wait_t * w) {
+    OS_Error_t err;
+
+    atomic_init(&w->state, NW_STACK_WAITING);
+    if ((err = OS_Socket_regCallback(&w->sock->socket, nw_stack_notify, w))) {
+        Debug_LOG_ERROR("OS_Socket_regCallback() failed, code %d", err);
+    }
+    return err;
+}
+
+
+void nw_stack_notify(void * ctx) {
+    nw_stack_wait_t * w = ctx;
+    OS_Error_t err;
+
+    if (atomic_load(&w->state) == NW_STACK_WAITING) {
+        nw_stack_check(w);
+    }
+
+    // the control thread found the stack at the same time, its start() is
+    // a few socket calls
+    while (atomic_load(&w->state) == NW_STACK_STARTING) {
+        seL4_Yield();
+    }
+
+    switch (atomic_load(&w->state)) {
+    case NW_STACK_STARTED:
+        w->sock->callback(w->sock->callback_ctx);
+        break;
+    case NW_STACK_WAITING:
+        if ((err = OS_Socket_regCallback(&w->sock->socket, nw_stack_notify, w))) {
+            Debug_LOG_ERROR("OS_Socket_regCallback() failed, code %d", err);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+
+int nw_stacks_poll(nw_stack_wait_t * const * stacks, int num) {
+    int pending = 0;
+
+    for (int i = 0; i < num; i++) {
+        if (atomic_load(&stacks[i]->state) == NW_STACK_WAITING) {
+            nw_stack_check(stacks[i]);
+        }
+
+        switch (atomic_load(&stacks[i]->state)) {
+        case NW_STACK_FAILED:
+            return OS_ERROR_ABORTED;
+        case NW_STACK_STARTED:
+            break;
+        default:
+            pending++;
+            break;
+        }
+    }
+    return pending;
+}
+
+
+OS_Error_t init_nw_stack_nb(socket_ctx_t * ctx) {
     OS_Error_t err;
 
     //Wait for the Networkstack to be initialized
@@ -39,14 +125,6 @@ OS_Error_t init_socket_nb(socket_ctx_t * ctx) {
         return err;
     }
 
-    
-    //create sockets
-    if ((err = OS_Socket_create(&ctx->socket, &ctx->handle, OS_AF_INET, OS_SOCK_STREAM))) {
-        Debug_LOG_ERROR("OS_Socket_create() failed, code %d", err);
-        return err;
-    }
-
-    
     //register socket callback
     if ((err = OS_Socket_regCallback(
               &ctx->socket,
@@ -58,6 +136,21 @@ OS_Error_t init_socket_nb(socket_ctx_t * ctx) {
 }
 
 
+OS_Error_t init_socket_nb(socket_ctx_t * ctx) {
+    OS_Error_t err;
+
+    if ((err = init_nw_stack_nb(ctx))) {
+        return err;
+    }
+
+    //create sockets
+    if ((err = OS_Socket_create(&ctx->socket, &ctx->handle, OS_AF_INET, OS_SOCK_STREAM))) {
+        Debug_LOG_ERROR("OS_Socket_create() failed, code %d", err);
+    }
+    return err;
+}
+
+
 OS_Error_t init_socket_nb_server(socket_ctx_t * ctx, int backlog) {
     OS_Error_t err;
     if ((err = init_socket_nb(ctx))) {
@@ -97,4 +190,237 @@ OS_Error_t init_socket_nb_client(socket_ctx_t * ctx) {
         Debug_LOG_ERROR("OS_Socket_connect() failed, code %d", err);
     }
     return err;
-}
\ No newline at end of file
+}
+
+
+OS_Error_t connect_socket_nb(const if_OS_Socket_t * const nw_sock,
+                             OS_Socket_Handle_t * handle,
+                             const OS_Socket_Addr_t * addr) {
+    OS_Error_t err;
+
+    if ((err = OS_Socket_create(nw_sock, handle, OS_AF_INET, OS_SOCK_STREAM))) {
+        Debug_LOG_ERROR("OS_Socket_create() failed, code %d", err);
+        return err;
+    }
+
+    if ((err = OS_Socket_connect(*handle, addr))) {
+        Debug_LOG_ERROR("OS_Socket_connect() failed, code %d", err);
+        OS_Socket_close(*handle);
+    }
+    return err;
+}
+
+
+OS_Error_t listen_socket_nb(const if_OS_Socket_t * const nw_sock,
+                            OS_Socket_Handle_t * handle,
+                            const OS_Socket_Addr_t * addr,
+                            int backlog) {
+    OS_Error_t err;
+
+    if ((err = OS_Socket_create(nw_sock, handle, OS_AF_INET, OS_SOCK_STREAM))) {
+        Debug_LOG_ERROR("OS_Socket_create() failed, code %d", err);
+        return err;
+    }
+
+    if ((err = OS_Socket_bind(*handle, addr))) {
+        Debug_LOG_ERROR("OS_Socket_bind() failed, code %d", err);
+        OS_Socket_close(*handle);
+        return err;
+    }
+
+    if ((err = OS_Socket_listen(*handle, backlog))) {
+        Debug_LOG_ERROR("OS_Socket_listen() failed, code %d", err);
+        OS_Socket_close(*handle);
+    }
+    return err;
+}
+
+
+OS_Error_t socket_loop_add(socket_loop_t * loop,
+                           socket_loop_source_t * source,
+                           socket_ctx_t * ctx,
+                           socket_loop_handler_t handler,
+                           void * handler_ctx) {
+    int n = atomic_load(&loop->num_sources);
+    if (n == SOCKET_LOOP_MAX_SOURCES) {
+        Debug_LOG_ERROR("socket_loop_add() failed, all %d sources in use", SOCKET_LOOP_MAX_SOURCES);
+        return OS_ERROR_INSUFFICIENT_SPACE;
+    }
+
+    source->loop = loop;
+    source->socket = &ctx->socket;
+    source->handler = handler;
+    source->ctx = handler_ctx;
+    atomic_init(&source->armed, true);
+    atomic_init(&source->requested, false);
+    loop->sources[n] = source;
+    atomic_store(&loop->num_sources, n + 1);
+
+    ctx->callback = socket_loop_notify;
+    ctx->callback_ctx = source;
+    return OS_SUCCESS;
+}
+
+
+// Serves the requested stacks until all of them ran dry
+static int loop_dispatch(socket_loop_t * loop) {
+    OS_Socket_Evt_t events[OS_NETWORK_MAXIMUM_SOCKET_NO];
+    bool active[SOCKET_LOOP_MAX_SOURCES];
+    int num_sources = atomic_load(&loop->num_sources);
+    int total = 0;
+    bool busy;
+    OS_Error_t err;
+
+    for (int i = 0; i < num_sources; i++) {
+        active[i] = atomic_exchange(&loop->sources[i]->requested, false);
+    }
+
+    do {
+        busy = false;
+        for (int i = 0; i < num_sources; i++) {
+            socket_loop_source_t * source = loop->sources[i];
+            int num = 0;
+
+            if (!active[i]) {
+                continue;
+            }
+
+            if ((err = OS_Socket_getPendingEvents(source->socket, events, sizeof(events), &num))) {
+                Debug_LOG_ERROR("failed to retrieve pending events. Error: %d", err);
+                num = 0;
+            }
+            if (num > 0 && num <= OS_NETWORK_MAXIMUM_SOCKET_NO) {
+                source->handler(events, num, source->ctx);
+                total += num;
+                busy = true;
+                continue;
+            }
+
+            if (!atomic_load(&source->armed)) {
+                // Events arriving before the callback was armed do not notify,
+                // so the stack is looked at once more
+                atomic_store(&source->armed, true);
+                if ((err = OS_Socket_regCallback(source->socket, socket_loop_notify, source))) {
+                    Debug_LOG_ERROR("OS_Socket_regCallback() failed, code %d", err);
+                }
+                busy = true;
+                continue;
+            }
+            active[i] = false;
+        }
+    } while (busy);
+
+    return total;
+}
+
+
+// Keeps polling the spin stacks until none had an event for the spin budget
+static int loop_spin(socket_loop_t * loop) {
+    uint32_t spin_us = atomic_load(&loop->spin_us);
+    uint64_t frequency = timestamp_frequency();
+    int total = 0;
+
+    if (!spin_us || !frequency) {
+        return 0;
+    }
+
+    uint64_t budget = frequency * spin_us / 1000000;
+    uint64_t cap = frequency * loop->spin_max_us / 1000000;
+    uint64_t period = frequency * loop->spin_period_us / 1000000;
+    uint64_t t_last = timestamp_ticks();
+    uint64_t t_poll = t_last;
+    int num_sources = atomic_load(&loop->num_sources);
+
+    while (t_poll - t_last < budget) {
+        if (t_poll - loop->spin_period_start >= period) {
+            loop->spin_period_start = t_poll;
+            loop->spin_used = 0;
+        }
+        if (cap && loop->spin_used >= cap) {
+            atomic_fetch_add(&loop->spin_capped, 1);
+            return total;
+        }
+
+        // the network stacks run at the same priority
+        seL4_Yield();
+
+        for (int i = 0; i < num_sources; i++) {
+            if (loop->sources[i]->spin) {
+                atomic_store(&loop->sources[i]->requested, true);
+            }
+        }
+        int num = loop_dispatch(loop);
+        if (num) {
+            atomic_fetch_add(&loop->spin_events, num);
+            t_last = timestamp_ticks();
+            total += num;
+        }
+
+        // switched off meanwhile
+        if (!atomic_load(&loop->spin_us)) {
+            return total;
+        }
+
+        uint64_t now = timestamp_ticks();
+        loop->spin_used += now - t_poll;
+        t_poll = now;
+    }
+    atomic_fetch_add(&loop->spin_idle, 1);
+    return total;
+}
+
+
+// Entered by the thread that raised pending from 0, left once no request is left
+static int loop_run(socket_loop_t * loop) {
+    int seen = atomic_load(&loop->pending);
+    int total = 0;
+
+    for (;;) {
+        total += loop_dispatch(loop);
+        total += loop_spin(loop);
+
+        int left = atomic_fetch_sub(&loop->pending, seen) - seen;
+        if (!left) {
+            return total;
+        }
+        seen = left;
+    }
+}
+
+
+void socket_loop_notify(void * ctx) {
+    socket_loop_source_t * source = ctx;
+    socket_loop_t * loop = source->loop;
+
+    // the callback fired and is not registered anymore
+    atomic_store(&source->armed, false);
+    atomic_store(&source->requested, true);
+    if (atomic_fetch_add(&loop->pending, 1) == 0) {
+        loop_run(loop);
+    }
+}
+
+
+int socket_loop_poll(socket_loop_t * loop) {
+    int num_sources = atomic_load(&loop->num_sources);
+
+    for (int i = 0; i < num_sources; i++) {
+        atomic_store(&loop->sources[i]->requested, true);
+    }
+    if (atomic_fetch_add(&loop->pending, 1) == 0) {
+        return loop_run(loop);
+    }
+    // served by the thread in the loop
+    return 0;
+}
+
+
+void socket_loop_set_spin_cap(socket_loop_t * loop, uint32_t max_us, uint32_t period_us) {
+    loop->spin_max_us = max_us;
+    loop->spin_period_us = period_us;
+}
+
+
+void socket_loop_set_spin(socket_loop_t * loop, uint32_t spin_us) {
+    atomic_store(&loop->spin_us, spin_us);
+}
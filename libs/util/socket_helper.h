@@ -8,6 +8,10 @@
 
 #pragma once
 
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
 #include "OS_Socket.h"
 #include "interfaces/if_OS_Socket.h"
 
@@ -27,8 +31,127 @@ typedef struct {
 } socket_ctx_t;
 
 
+/*
+ * Bring-up of the network stacks of a component, all stacks in parallel.
+ *
+ * nw_stack_wait_arm() registers nw_stack_notify() as the callback of a stack,
+ * it checks the status on each notification of the stack and calls start()
+ * once the stack runs. start() sets up the sockets, but leaves the callback
+ * of sock unregistered: the pending nw_stack_notify() hands the next
+ * notification on to it. A stack may reach RUNNING without notifying, the
+ * control thread looks at the stacks not started yet with nw_stacks_poll()
+ * as a fallback, sleeping in between. Whichever finds the stack running
+ * first calls start().
+ */
+typedef OS_Error_t (*nw_stack_start_t)(void *);
+
+enum {
+    NW_STACK_WAITING,
+    NW_STACK_STARTING,
+    NW_STACK_STARTED,
+    NW_STACK_FAILED,
+};
+
+typedef struct {
+    socket_ctx_t *              sock;
+    nw_stack_start_t            start;
+    void *                      ctx;
+    atomic_int                  state;
+    uint64_t                    t_running;  // timestamp_ticks() when found running
+} nw_stack_wait_t;
+
+// Registers nw_stack_notify() for a stack, before it may run
+OS_Error_t nw_stack_wait_arm(nw_stack_wait_t *);
+
+// Stack callback until the stack started, ctx is the nw_stack_wait_t
+void nw_stack_notify(void * ctx);
+
+// Returns the number of stacks not started yet, OS_ERROR_ABORTED if one failed
+int nw_stacks_poll(nw_stack_wait_t * const *, int);
+
+// Yields until the stack runs, the bring-up before nw_stack_wait_t, see NW_STACK_WAIT_SPIN
+OS_Error_t wait_for_nw_stack_init_nb(const if_OS_Socket_t * const);
+
+
 //Because we do try to connect to us self, because we use the addr partner and addr differently when we connect client / server.
 
 OS_Error_t init_socket_nb_server(socket_ctx_t *, int);
 
-OS_Error_t init_socket_nb_client(socket_ctx_t *);
\ No newline at end of file
+OS_Error_t init_socket_nb_client(socket_ctx_t *);
+
+// Waits for the network stack and registers the callback, without creating a socket.
+// Returns at once for a running stack.
+OS_Error_t init_nw_stack_nb(socket_ctx_t *);
+
+// Opens an additional connection on an initialized network stack
+OS_Error_t connect_socket_nb(const if_OS_Socket_t * const, OS_Socket_Handle_t *, const OS_Socket_Addr_t *);
+
+// Opens an additional listening socket on an initialized network stack
+OS_Error_t listen_socket_nb(const if_OS_Socket_t * const, OS_Socket_Handle_t *, const OS_Socket_Addr_t *, int);
+
+
+/*
+ * Event loop over the network stacks of a component, like epoll.
+ *
+ * The callback of every stack is socket_loop_notify(). It only marks its
+ * stack and, if no other thread is in the loop, runs the loop itself. A
+ * thread in the loop serves the events of all stacks in batches, round robin,
+ * until every stack has run dry, so with traffic on both sides one thread
+ * does the work while the other callbacks return at once. A stack is re-armed
+ * only after it ran dry, not after every batch.
+ *
+ * With a spin budget the thread in the loop keeps polling the stacks marked
+ * spin until none had an event for that long, yielding to the stacks in
+ * between, and only then falls back to notifications. The time spent
+ * polling is capped per period, the rest of it is left to lower priorities.
+ */
+
+#define SOCKET_LOOP_MAX_SOURCES 2
+
+// Called with the events of one getPendingEvents() of a stack
+typedef void (*socket_loop_handler_t)(const OS_Socket_Evt_t * events, int num, void * ctx);
+
+typedef struct socket_loop socket_loop_t;
+
+typedef struct {
+    socket_loop_t *             loop;
+    const if_OS_Socket_t *      socket;
+    socket_loop_handler_t       handler;
+    void *                      ctx;
+    atomic_bool                 armed;      // callback registered and not fired yet
+    atomic_bool                 requested;  // to be served by the thread in the loop
+    bool                        spin;       // polled while the loop spins, set before socket_loop_add()
+} socket_loop_source_t;
+
+struct socket_loop {
+    socket_loop_source_t *      sources[SOCKET_LOOP_MAX_SOURCES];
+    atomic_int                  num_sources; // a stack may be added while the loop runs
+    atomic_int                  pending;    // requests, the thread raising it from 0 runs the loop
+    atomic_uint                 spin_us;    // busy polling after the last event, 0: off
+    uint32_t                    spin_max_us; // of busy polling per spin_period_us
+    uint32_t                    spin_period_us;
+    uint64_t                    spin_period_start; // of the thread in the loop, ticks
+    uint64_t                    spin_used;
+    atomic_uint                 spin_events; // events found by busy polling
+    atomic_uint                 spin_idle;  // busy polls ended without events for spin_us
+    atomic_uint                 spin_capped; // busy polls ended by spin_max_us
+};
+
+/*
+ * Adds the stack of ctx to a loop and sets its callback to socket_loop_notify(),
+ * before init_nw_stack_nb() or init_socket_nb_server() arm it.
+ */
+OS_Error_t socket_loop_add(socket_loop_t *, socket_loop_source_t *, socket_ctx_t *,
+                           socket_loop_handler_t, void *);
+
+// Stack callback, ctx is the socket_loop_source_t
+void socket_loop_notify(void * ctx);
+
+// Serves every stack once without waiting for a notification, returns the number of events
+int socket_loop_poll(socket_loop_t *);
+
+// Caps the busy polling to max_us per period_us, before the first socket_loop_set_spin()
+void socket_loop_set_spin_cap(socket_loop_t *, uint32_t max_us, uint32_t period_us);
+
+// Sets the spin budget in us, 0 waits for notifications only, takes effect with the next event
+void socket_loop_set_spin(socket_loop_t *, uint32_t);
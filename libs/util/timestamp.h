@@ -0,0 +1,41 @@
+/*
+ * Copyright (C) 2023-2024, HENSOLDT Cyber GmbH
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * For commercial licensing, contact: info.cyber@hensoldt.net
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * Generic timer counter, readable from user space with
+ * KernelArmExportVCNTUser. The same counter runs in every component, so
+ * timestamps of different components can be compared.
+ */
+static inline uint64_t timestamp_ticks(void) {
+#if defined(__aarch64__)
+    uint64_t t;
+    __asm__ volatile("mrs %0, cntvct_el0" : "=r"(t));
+    return t;
+#else
+    return 0;
+#endif
+}
+
+// Ticks per second, 0 if there is no counter
+static inline uint64_t timestamp_frequency(void) {
+#if defined(__aarch64__)
+    uint64_t f;
+    __asm__ volatile("mrs %0, cntfrq_el0" : "=r"(f));
+    return f;
+#else
+    return 0;
+#endif
+}
+
+static inline uint64_t timestamp_to_us(uint64_t ticks, uint64_t frequency) {
+    return frequency ? ticks / frequency * 1000000 + ticks % frequency * 1000000 / frequency : 0;
+}
@@ -0,0 +1,241 @@
+/*
+ * Copyright (C) 2023-2024, HENSOLDT Cyber GmbH
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * For commercial licensing, contact: info.cyber@hensoldt.net
+ */
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "trace_buf.h"
+
+// Without tracing nothing is recorded, only an empty document is exported
+#define RING_SIZE (TRACE_ENABLED ? TRACE_BUFFER_EVENTS : 1)
+#define RING_MASK (RING_SIZE - 1)
+
+_Static_assert((RING_SIZE & RING_MASK) == 0, "TRACE_BUFFER_EVENTS must be a power of two");
+
+// Longest JSON record of a single event
+#define RECORD_LEN 256
+
+/*
+ * Writers never wait: a slot is overwritten when the ring wraps. seq is odd
+ * while the slot is written and 2 * pos + 2 once event pos is complete, so
+ * the exporter can tell a stable copy from a torn one.
+ */
+typedef struct {
+    atomic_uint             seq;
+    char                    phase;
+    uint8_t                 track;
+    const char *            name;
+    const char *            arg_name;   // NULL: no argument
+    int32_t                 arg;
+    uint64_t                start;
+    uint64_t                end;
+} trace_event_t;
+
+static trace_event_t ring[RING_SIZE];
+static atomic_uint head;
+
+static int pid;
+static const char * process_name = "TRENTOS";
+static const char * track_names[TRACE_MAX_TRACKS];
+
+static uint64_t ticks_per_sec;
+
+enum {
+    STAGE_HEADER,
+    STAGE_PROCESS,
+    STAGE_TRACKS,
+    STAGE_EVENTS,
+    STAGE_FOOTER,
+    STAGE_DONE,
+};
+
+
+void trace_init(int id, const char * name) {
+    pid = id;
+    if (name) {
+        process_name = name;
+    }
+    ticks_per_sec = timestamp_frequency();
+}
+
+
+void trace_track_name(uint8_t track, const char * name) {
+    if (track < TRACE_MAX_TRACKS) {
+        track_names[track] = name;
+    }
+}
+
+
+void trace_record(char phase, uint8_t track, const char * name, uint64_t start,
+                  uint64_t end, const char * arg_name, int32_t arg) {
+    unsigned int pos = atomic_fetch_add_explicit(&head, 1, memory_order_relaxed);
+    trace_event_t * e = &ring[pos & RING_MASK];
+
+    atomic_store_explicit(&e->seq, 2 * pos + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    e->phase = phase;
+    e->track = track;
+    e->name = name;
+    e->arg_name = arg_name;
+    e->arg = arg;
+    e->start = start;
+    e->end = end;
+
+    atomic_store_explicit(&e->seq, 2 * pos + 2, memory_order_release);
+}
+
+
+static bool read_event(unsigned int pos, trace_event_t * out) {
+    const trace_event_t * e = &ring[pos & RING_MASK];
+
+    unsigned int seq = atomic_load_explicit(&e->seq, memory_order_acquire);
+    if (seq != 2 * pos + 2) {
+        return false;
+    }
+
+    out->phase = e->phase;
+    out->track = e->track;
+    out->name = e->name;
+    out->arg_name = e->arg_name;
+    out->arg = e->arg;
+    out->start = e->start;
+    out->end = e->end;
+
+    atomic_thread_fence(memory_order_acquire);
+    return atomic_load_explicit(&e->seq, memory_order_relaxed) == seq;
+}
+
+
+static uint64_t to_ns(uint64_t ticks) {
+    if (!ticks_per_sec) {
+        return 0;
+    }
+    return ticks / ticks_per_sec * 1000000000 + ticks % ticks_per_sec * 1000000000 / ticks_per_sec;
+}
+
+
+// Timestamps are exported in microseconds with nanosecond fraction
+static int format_event(char * buf, const trace_event_t * e) {
+    uint64_t ts = to_ns(e->start);
+    char args[64] = "";
+
+    if (e->arg_name) {
+        snprintf(args, sizeof(args), "\"%s\":%d", e->arg_name, (int)e->arg);
+    }
+
+    if (e->phase == 'X') {
+        uint64_t dur = to_ns(e->end) - ts;
+        return snprintf(buf, RECORD_LEN,
+                        ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%u,"
+                        "\"ts\":%llu.%03u,\"dur\":%llu.%03u,\"args\":{%s}}",
+                        e->name, pid, e->track,
+                        (unsigned long long)(ts / 1000), (unsigned int)(ts % 1000),
+                        (unsigned long long)(dur / 1000), (unsigned int)(dur % 1000),
+                        args);
+    }
+    return snprintf(buf, RECORD_LEN,
+                    ",\n{\"name\":\"%s\",\"ph\":\"%c\",\"s\":\"t\",\"pid\":%d,\"tid\":%u,"
+                    "\"ts\":%llu.%03u,\"args\":{%s}}",
+                    e->name, e->phase, pid, e->track,
+                    (unsigned long long)(ts / 1000), (unsigned int)(ts % 1000),
+                    args);
+}
+
+
+void trace_export_begin(trace_export_t * x) {
+    memset(x, 0, sizeof(*x));
+    x->end = atomic_load_explicit(&head, memory_order_acquire);
+    x->pos = x->end > RING_SIZE ? x->end - RING_SIZE : 0;
+    x->stage = STAGE_HEADER;
+}
+
+
+/* Formats the next record, 0 if the current stage has none left */
+static int next_record(trace_export_t * x, char * rec) {
+    switch (x->stage) {
+    case STAGE_HEADER:
+        return snprintf(rec, RECORD_LEN, "{\"traceEvents\":[");
+
+    case STAGE_PROCESS:
+        return snprintf(rec, RECORD_LEN,
+                        "\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,"
+                        "\"args\":{\"name\":\"%s\"}}",
+                        pid, process_name);
+
+    case STAGE_TRACKS:
+        for (; x->track < TRACE_MAX_TRACKS; x->track++) {
+            if (track_names[x->track]) {
+                return snprintf(rec, RECORD_LEN,
+                                ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,"
+                                "\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+                                pid, x->track, track_names[x->track]);
+            }
+        }
+        return 0;
+
+    case STAGE_EVENTS:
+        // events overwritten since the export started are skipped
+        for (; x->pos != x->end; x->pos++) {
+            trace_event_t e;
+            if (read_event(x->pos, &e)) {
+                return format_event(rec, &e);
+            }
+            x->lost++;
+        }
+        return 0;
+
+    case STAGE_FOOTER:
+        return snprintf(rec, RECORD_LEN,
+                        "\n],\"displayTimeUnit\":\"ns\",\"otherData\":{\"lost\":%u}}\n",
+                        (unsigned int)x->lost);
+
+    default:
+        return 0;
+    }
+}
+
+
+static void advance(trace_export_t * x) {
+    switch (x->stage) {
+    case STAGE_TRACKS:
+        x->track++;
+        break;
+    case STAGE_EVENTS:
+        x->pos++;
+        break;
+    default:
+        x->stage++;
+        break;
+    }
+}
+
+
+size_t trace_export_chunk(trace_export_t * x, char * buf, size_t size) {
+    char rec[RECORD_LEN];
+    size_t len = 0;
+
+    while (x->stage != STAGE_DONE) {
+        int n = next_record(x, rec);
+        if (n <= 0) {
+            x->stage++;
+            continue;
+        }
+        if (n >= RECORD_LEN) {
+            n = RECORD_LEN - 1;
+        }
+        if (size - len < (size_t)n) {
+            break;
+        }
+        memcpy(&buf[len], rec, n);
+        len += n;
+        advance(x);
+    }
+    return len;
+}
@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2023-2024, HENSOLDT Cyber GmbH
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * For commercial licensing, contact: info.cyber@hensoldt.net
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "system_config.h"
+
+#include "timestamp.h"
+
+/*
+ * In-memory trace of the relay path, exported in the Chrome trace event
+ * format (chrome://tracing, ui.perfetto.dev). Events go to a ring that
+ * overwrites the oldest entries, so the export shows the last
+ * TRACE_BUFFER_EVENTS events before it was requested.
+ *
+ * Events are drawn on tracks, a track is a row in the viewer and is chosen
+ * by the caller. Names and argument names must be string literals, only the
+ * pointers are stored.
+ */
+
+#define TRACE_MAX_TRACKS 16
+
+typedef struct {
+    uint32_t                pos;        // next event to export
+    uint32_t                end;        // head when the export started
+    uint32_t                lost;       // overwritten while exporting
+    uint8_t                 stage;
+    uint8_t                 track;      // next track name to export
+} trace_export_t;
+
+
+/* Sets the process id the events are exported with, and its name */
+void trace_init(int pid, const char * process_name);
+
+void trace_track_name(uint8_t track, const char * name);
+
+void trace_record(char phase, uint8_t track, const char * name, uint64_t start,
+                  uint64_t end, const char * arg_name, int32_t arg);
+
+
+/* Start of a span, pass the value to trace_span */
+static inline uint64_t trace_now(void) {
+    return TRACE_ENABLED ? timestamp_ticks() : 0;
+}
+
+/* Span from start until now, e.g. a callback or a socket call */
+static inline void trace_span(uint8_t track, const char * name, uint64_t start,
+                              const char * arg_name, int32_t arg) {
+    if (TRACE_ENABLED) {
+        trace_record('X', track, name, start, timestamp_ticks(), arg_name, arg);
+    }
+}
+
+/* Point in time, e.g. a filter decision */
+static inline void trace_instant(uint8_t track, const char * name,
+                                 const char * arg_name, int32_t arg) {
+    if (TRACE_ENABLED) {
+        uint64_t now = timestamp_ticks();
+        trace_record('i', track, name, now, now, arg_name, arg);
+    }
+}
+
+
+/* Snapshots the events recorded so far */
+void trace_export_begin(trace_export_t * x);
+
+/*
+ * Writes the next part of the JSON document to buf, only whole events.
+ * Returns the number of bytes written, 0 once the document is complete.
+ */
+size_t trace_export_chunk(trace_export_t * x, char * buf, size_t size);
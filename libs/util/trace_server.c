@@ -0,0 +1,126 @@
+/*
+ * Copyright (C) 2023-2024, HENSOLDT Cyber GmbH
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * For commercial licensing, contact: info.cyber@hensoldt.net
+ */
+
+#include "lib_debug/Debug.h"
+
+#include "socket_helper.h"
+#include "trace_server.h"
+
+
+OS_Error_t trace_server_init(trace_server_t * srv,
+                             const if_OS_Socket_t * const nw_sock,
+                             const OS_Socket_Addr_t * addr) {
+    OS_Error_t err;
+
+    if ((err = listen_socket_nb(nw_sock, &srv->handle, addr, 1))) {
+        return err;
+    }
+    srv->listening = true;
+    srv->exporting = false;
+    return OS_SUCCESS;
+}
+
+
+static void finish(trace_server_t * srv) {
+    OS_Error_t err;
+
+    if ((err = OS_Socket_close(srv->client_handle))) {
+        Debug_LOG_ERROR("OS_Socket_close() failed, code %d", err);
+    }
+    srv->exporting = false;
+}
+
+
+// Writes until the socket is full, the rest follows on OS_SOCK_EV_WRITE
+static void send_export(trace_server_t * srv) {
+    OS_Error_t err;
+
+    for (;;) {
+        if (srv->buf_head == srv->buf_tail) {
+            srv->buf_head = 0;
+            srv->buf_tail = trace_export_chunk(&srv->export, srv->buf, sizeof(srv->buf));
+            if (!srv->buf_tail) {
+                Debug_LOG_INFO("Trace export done, %u events lost",
+                               (unsigned int)srv->export.lost);
+                finish(srv);
+                return;
+            }
+        }
+
+        size_t len_actual = 0;
+        err = OS_Socket_write(srv->client_handle,
+                              &srv->buf[srv->buf_head],
+                              srv->buf_tail - srv->buf_head,
+                              &len_actual);
+        if (err == OS_ERROR_TRY_AGAIN) {
+            return;
+        } else if (err) {
+            Debug_LOG_ERROR("OS_Socket_write() failed, code %d", err);
+            finish(srv);
+            return;
+        }
+        srv->buf_head += len_actual;
+        if (srv->buf_head < srv->buf_tail) {
+            return;
+        }
+    }
+}
+
+
+static void accept_client(trace_server_t * srv) {
+    OS_Error_t err;
+    OS_Socket_Handle_t handle;
+    OS_Socket_Addr_t addr_partner;
+
+    err = OS_Socket_accept(srv->handle, &handle, &addr_partner);
+    if (err) {
+        if (err != OS_ERROR_TRY_AGAIN) {
+            Debug_LOG_ERROR("OS_Socket_accept() failed, error %d", err);
+        }
+        return;
+    }
+
+    // one export at a time
+    if (srv->exporting) {
+        OS_Socket_close(handle);
+        return;
+    }
+
+    Debug_LOG_INFO("Trace export to %s", addr_partner.addr);
+    srv->client_handle = handle;
+    srv->exporting = true;
+    srv->buf_head = 0;
+    srv->buf_tail = 0;
+    trace_export_begin(&srv->export);
+    send_export(srv);
+}
+
+
+bool trace_server_handle_event(trace_server_t * srv, const OS_Socket_Evt_t * event) {
+    if (!srv->listening) {
+        return false;
+    }
+
+    if (event->socketHandle == srv->handle.handleID) {
+        if (event->eventMask & OS_SOCK_EV_CONN_ACPT) {
+            accept_client(srv);
+        }
+        return true;
+    }
+
+    if (!srv->exporting || event->socketHandle != srv->client_handle.handleID) {
+        return false;
+    }
+
+    if (event->eventMask & (OS_SOCK_EV_ERROR | OS_SOCK_EV_FIN)) {
+        finish(srv);
+    } else if (event->eventMask & OS_SOCK_EV_WRITE) {
+        send_export(srv);
+    }
+    return true;
+}
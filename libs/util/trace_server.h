@@ -0,0 +1,42 @@
+/*
+ * Copyright (C) 2023-2024, HENSOLDT Cyber GmbH
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * For commercial licensing, contact: info.cyber@hensoldt.net
+ */
+
+#pragma once
+
+#include <stdbool.h>
+
+#include "OS_Dataport.h"
+#include "OS_Socket.h"
+#include "interfaces/if_OS_Socket.h"
+
+#include "trace_buf.h"
+
+/*
+ * Debug socket for the trace buffer: every client that connects gets the
+ * trace as Chrome trace JSON, then the connection is closed. Uses two
+ * sockets of the network stack, the listening one and the client.
+ */
+typedef struct {
+    OS_Socket_Handle_t      handle;
+    OS_Socket_Handle_t      client_handle;
+    bool                    listening;
+    bool                    exporting;
+    trace_export_t          export;
+    size_t                  buf_head;
+    size_t                  buf_tail;
+    char                    buf[OS_DATAPORT_DEFAULT_SIZE];
+} trace_server_t;
+
+/* Listens on addr, the network stack must be running */
+OS_Error_t trace_server_init(trace_server_t *, const if_OS_Socket_t * const, const OS_Socket_Addr_t *);
+
+/*
+ * Handles an event of the stack the server listens on. Returns false if the
+ * event is for another socket.
+ */
+bool trace_server_handle_event(trace_server_t *, const OS_Socket_Evt_t *);
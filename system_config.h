@@ -56,10 +56,20 @@
 #define PX4_TRENTOS_ADDR "10.0.0.11"
 #define PX4_TRENTOS_PORT  7000
 #define PX4_TRENTOS_PORT_SIMCOUPLER 5555
+// Trace export, see TRACE_ENABLED
+#define PX4_TRENTOS_PORT_TRACE 7001
+#define PX4_TRENTOS_PORT_SIMCOUPLER_TRACE 5556
 
 #define PX4_DRONE_ADDR "172.17.0.1"
 #define PX4_DRONE_PORT 7000
 
+// PX4 instances the SerialFilter connects to, one link per entry (max. 4, max. 2 with TRACE_ENABLED)
+#define PX4_DRONE_PEERS { \
+  {PX4_DRONE_ADDR, PX4_DRONE_PORT}, \
+}
+// A closed PX4 link is reconnected at once, but at most once per interval
+#define PX4_RECONNECT_INTERVAL_MS 1000
+
 
 #define PX4_GATEWAY_ADDR "10.0.0.1"
 
@@ -74,4 +84,124 @@
 
 #define HOME_POSITION {48.05502700126609, 11.652206077452211, NAN}
 
+// MAVLink 2 signing
+
+// Verify signed frames from the VM, frames with a bad signature are dropped
+#define MAVLINK_SIGNING_VERIFY_VM         false
+// Forward unsigned frames from the VM while verification is enabled
+#define MAVLINK_SIGNING_ACCEPT_UNSIGNED   true
+// Sign all frames forwarded to PX4
+#define MAVLINK_SIGNING_SIGN_PX4          false
+#define MAVLINK_SIGNING_LINK_ID_PX4       1
+// The key is not part of the sources, it is read at build time from the
+// file in MAVLINK_SIGNING_KEY_FILE (64 hex digits). Without it verification
+// and signing fail closed.
+
+// Parameters
+
+// Answer PARAM_REQUEST_LIST/READ from the VM with the parameters PX4 sent before
+#define MAVLINK_PARAM_CACHE_ENABLED       true
+// Forward PARAM_REQUEST_LIST from the VM to PX4 while the cache is incomplete.
+// PX4 only sends its whole parameter set on such a request, so without it the
+// cache is filled by single reads only. false drops the list requests the
+// cache cannot answer, like the filter did before the cache.
+#define MAVLINK_PARAM_REQUEST_LIST_FORWARDED true
+// Forward PARAM_SET from the VM, the cached value is refreshed by PX4's answer
+#define MAVLINK_PARAM_SET_ALLOWED         false
+
+// Message rates
+
+// Shortest interval the VM may request with MAV_CMD_SET_MESSAGE_INTERVAL
+#define MAVLINK_RATE_MIN_INTERVAL_US      20000
+// Exceptions to the default minimum, as {msgid, interval in us}
+#define MAVLINK_RATE_MIN_INTERVALS { \
+  {MAVLINK_MSG_ID_ATTITUDE,            5000}, \
+  {MAVLINK_MSG_ID_ATTITUDE_QUATERNION, 5000}, \
+  {MAVLINK_MSG_ID_HIGHRES_IMU,         5000}, \
+  {MAVLINK_MSG_ID_LOCAL_POSITION_NED, 10000}, \
+  {MAVLINK_MSG_ID_GLOBAL_POSITION_INT,10000}, \
+}
+// Bytes per second all requested streams of one VM link may add up to
+#define MAVLINK_RATE_LINK_BUDGET          100000
+
+// Missions
+
+// Forward the mission protocol from the VM, every uploaded item is checked
+// against the geofence and the whole upload is rejected if one is outside
+#define MAVLINK_MISSION_ENABLED           true
+
+// Bulk transfers
+
+// Forward log downloads and read-only MAVLink FTP from the VM
+#define MAVLINK_BULK_TRANSFER_ENABLED     false
+// A transfer without requests or data for this long counts as ended, e.g. the
+// guest disconnected from PX4 without LOG_REQUEST_END
+#define MAVLINK_BULK_IDLE_TIMEOUT_MS      3000
+
+// Link monitoring
+
+// Interval of the PING/TIMESYNC probes the SerialFilter sends on every VM
+// and PX4 link to estimate its RTT and clock offset, 0: off
+#define LINK_MONITOR_INTERVAL_MS          1000
+// Sender of the probes, the answers are not forwarded
+#define LINK_MONITOR_SYSID                250
+#define LINK_MONITOR_COMPID               250
+// A link is flagged degraded above this smoothed RTT, or after this many
+// probes in a row without answer
+#define LINK_MONITOR_DEGRADED_RTT_MS      50
+#define LINK_MONITOR_DEGRADED_LOST        3
+
+// Boot
+
+// The SerialFilter and SimCoupler start each side once the notification of
+// its network stack finds it running. A stack reaching RUNNING without
+// notifying is found by the control thread, it looks at the stacks not
+// started yet at this interval and sleeps in between
+#define NW_STACK_POLL_INTERVAL_MS         10
+// 1: post_init() first waits for both stacks one after the other, yielding
+// in a loop as before the notifications, to compare the boot time printed
+#define NW_STACK_WAIT_SPIN                0
+
+// Busy polling
+
+// While a vehicle is armed the SerialFilter keeps polling the PX4 network
+// stack for this long after the last event, instead of waiting for a
+// notification. Lowers the relay latency at the cost of CPU, the guest gets
+// no CPU while the filter polls. 0: always wait
+#define RELAY_BUSY_POLL_US                500
+// At most this much busy polling per period, the rest is left to the guest
+#define RELAY_BUSY_POLL_MAX_US            2000
+#define RELAY_BUSY_POLL_PERIOD_MS         10
+
+// Counters
+
+// Interval the SerialFilter prints its counters (link RTTs, ...), 0: never
+#define COUNTERS_PRINT_INTERVAL_MS        10000
+
+// Deferred logging of the SerialFilter relay path
+
+// Entries of the log ring, must be a power of two
+#define LOG_RING_ENTRIES                  1024
+// Repeats of one log statement within this interval are only counted
+#define LOG_RING_SITE_INTERVAL_US         100000
+#define LOG_RING_DRAIN_INTERVAL_MS        20
+// The drain runs at the priority of the relay: after each batch of entries it
+// yields to the relay and the network stacks, and it stops after a number of
+// batches per interval so the guest gets the CPU again
+#define LOG_RING_DRAIN_BATCH              16
+#define LOG_RING_DRAIN_BATCHES            8
+
+// Tracing of the SerialFilter and SimCoupler relay paths
+
+// Record callbacks, socket reads/writes and filter decisions, connecting to
+// PX4_TRENTOS_ADDR on one of the trace ports returns them as Chrome trace JSON
+#define TRACE_ENABLED                     false
+// Events kept per component, must be a power of two
+#define TRACE_BUFFER_EVENTS               4096
+
+// Report the round trip of every COMMAND_LONG/COMMAND_INT to the guest that
+// sent it: a DEBUG_FLOAT_ARRAY "CMDTRACE" with the time spent in the filter
+// and behind it follows each COMMAND_ACK, see cmd_trace.h
+#define MAVLINK_CMD_TRACE_ENABLED         false
+
 #endif // SYSTEM_CONFIG_H_
\ No newline at end of file